@@ -17,15 +17,37 @@
 
 #include "stdafx.h"
 
+#include <climits>
+
 #include "AssFilter.h"
 #include "AssDebug.h"
 #include "AssPin.h"
 #include "AssFilterSettingsProps.h"
 #include "registry.h"
 #include "resource.h"
+#include "SubDirIndex.h"
 #include "SubFrame.h"
 #include "Tools.h"
 
+// Window size changes closer than this are one resize, ms
+#define RESIZE_DEBOUNCE_MS 250
+// Frame sizes kept with their libass caches: windowed, fullscreen and a governor size
+#define RENDERER_POOL_SIZES 3
+// libass caches of all the renderers of the pool, MB
+#define RENDERER_CACHE_MB 512
+// Events shown at once from which a frame is rendered on several renderers in parallel
+#define PARALLEL_MIN_EVENTS 100
+#define PARALLEL_MAX_RENDERERS 4
+
+namespace
+{
+    // The frames kept by the filter are all SubFrames
+    inline SubFrame* ToSubFrame(const ISubRenderFramePtr& frame)
+    {
+        return static_cast<SubFrame*>(frame.GetInterfacePtr());
+    }
+}
+
 AssFilter::AssFilter(LPUNKNOWN pUnk, HRESULT* pResult)
 	: CBaseFilter(NAME("AssFilterMod"), pUnk, this, __uuidof(AssFilter))
 {
@@ -35,14 +57,22 @@ AssFilter::AssFilter(LPUNKNOWN pUnk, HRESULT* pResult)
     m_pin = std::make_unique<AssPin>(this, pResult);
 
     m_ass = decltype(m_ass)(ass_library_init());
-    m_renderer = decltype(m_renderer)(ass_renderer_init(m_ass.get()));
+    m_watchLibrary = decltype(m_watchLibrary)(ass_library_init());
+    m_renderers = std::make_unique<CRendererPool>(m_ass.get(), RENDERER_POOL_SIZES, RENDERER_CACHE_MB);
 
-    m_stringOptions["name"] = L"AssFilterMod";
-    m_stringOptions["version"] = L"0.4.0.0";
-    m_stringOptions["yuvMatrix"] = L"None";
-    m_stringOptions["outputLevels"] = L"PC";
-    m_boolOptions["combineBitmaps"] = false;
-    m_boolOptions["isMovable"] = false;
+    m_fontStore = CFontStore::GetShared();
+
+    m_stringOptions[SRO_NAME] = L"AssFilterMod";
+    m_stringOptions[SRO_VERSION] = L"0.4.0.0";
+    m_stringOptions[SRO_YUV_MATRIX] = L"None";
+    m_stringOptions[SRO_OUTPUT_LEVELS] = L"PC";
+    m_boolOptions[SRO_COMBINE_BITMAPS] = false;
+    m_boolOptions[SRO_IS_BITMAP] = false;
+    m_boolOptions[SRO_IS_MOVABLE] = false;
+    m_boolOptions[SRO_LOW_LATENCY] = false;
+
+    m_preRenderGuard = std::make_shared<s_prerender_guard>();
+    m_preRenderGuard->filter = this;
 
     m_bSrtHeaderDone = false;
     m_bExternalFile = false;
@@ -51,10 +81,19 @@ AssFilter::AssFilter(LPUNKNOWN pUnk, HRESULT* pResult)
     m_bUnsupportedSub = false;
     m_iCurExtSubTrack = 0;
     m_ExtSubFiles = {};
+    m_bPendingScript = false;
 
     LoadSettings();
+    PublishStatus();
+
+    auto settings = GetSettings();
+    m_scheduler = CTaskScheduler::GetShared(settings->SchedulerWorkers);
+    ws2s(settings->CustomTags, m_srtCustomTags);
+    if (settings->TrackCacheSize)
+        m_pTrackCache = std::make_unique<CTrackCache>((ULONGLONG)settings->TrackCacheSize * 1024 * 1024);
 
-    ass_set_font_ligatures(m_renderer.get(), m_settings.DisableFontLigatures);
+    m_renderers->SetFontLigatures(settings->DisableFontLigatures != FALSE);
+    UpdateParallelGroups(*settings);
 
 #ifdef DEBUG
     DbgSetModuleLevel(LOG_ERROR, DWORD_MAX);
@@ -65,6 +104,16 @@ AssFilter::AssFilter(LPUNKNOWN pUnk, HRESULT* pResult)
 
 AssFilter::~AssFilter()
 {
+    // Waits for the frame being rendered ahead, the next ones are dropped.
+    // The renderer of the guard goes before the library.
+    {
+        CAutoLock lock(&m_preRenderGuard->cs);
+        m_preRenderGuard->filter = nullptr;
+        m_preRenderGuard->renderer.reset();
+    }
+
+    m_pFileWatcher.reset();
+
     if (m_consumer)
         m_consumer->Disconnect();
 
@@ -108,6 +157,8 @@ void AssFilter::SetMediaType(const CMediaType& mt, IPin* pPin)
 
     m_bExternalFile = false;
     m_bUnsupportedSub = false;
+    InvalidateFrames();
+    ResetEventSplit();
 
     // Check if there is already a track
     bool bTrackExist = false;
@@ -141,7 +192,7 @@ void AssFilter::SetMediaType(const CMediaType& mt, IPin* pPin)
     std::wstring tmpIsoLang = s2ws(std::string(psi->IsoLang));
     m_wsTrackLang.assign(MatchLanguage(tmpIsoLang) + L" (" + tmpIsoLang + L")");
 
-    if (!m_pTrayIcon && m_settings.TrayIcon)
+    if (!m_pTrayIcon && GetSettings()->TrayIcon)
         CreateTrayIcon();
 
     // SRT Media Sub-Type
@@ -150,33 +201,34 @@ void AssFilter::SetMediaType(const CMediaType& mt, IPin* pPin)
         m_track = decltype(m_track)(ass_new_track(m_ass.get()));
         m_wsSubType.assign(L"SRT");
         m_bSrtHeaderDone = false;
-        m_boolOptions["isMovable"] = true;
-        m_stringOptions["yuvMatrix"] = L"None";
-        //m_stringOptions["outputLevels"] = L"PC";
+        m_srtSettings = nullptr;
+        m_boolOptions[SRO_IS_MOVABLE] = true;
+        SetStringOption(SRO_YUV_MATRIX, L"None");
+        //SetStringOption(SRO_OUTPUT_LEVELS, L"PC");
     }
     // ASS Media Sub-Type
     else if (mt.subtype == MEDIASUBTYPE_ASS || mt.subtype == MEDIASUBTYPE_SSA)
     {
         m_track = decltype(m_track)(ass_new_track(m_ass.get()));
         m_wsSubType.assign(L"ASS");
-        m_boolOptions["isMovable"] = false;
+        m_boolOptions[SRO_IS_MOVABLE] = false;
 
         // Extract the yuv Matrix
         std::string strTmp((char*)mt.Format() + psi->dwOffset, mt.FormatLength() - psi->dwOffset);
         if (strTmp.find("YCbCr Matrix: TV.601") != std::string::npos)
         {
-            m_stringOptions["yuvMatrix"] = L"TV.601";
-            //m_stringOptions["outputLevels"] = L"TV";
+            SetStringOption(SRO_YUV_MATRIX, L"TV.601");
+            //SetStringOption(SRO_OUTPUT_LEVELS, L"TV");
         }
         else if (strTmp.find("YCbCr Matrix: TV.709") != std::string::npos)
         {
-            m_stringOptions["yuvMatrix"] = L"TV.709";
-            //m_stringOptions["outputLevels"] = L"TV";
+            SetStringOption(SRO_YUV_MATRIX, L"TV.709");
+            //SetStringOption(SRO_OUTPUT_LEVELS, L"TV");
         }
         else
         {
-            m_stringOptions["yuvMatrix"] = L"None";
-            //m_stringOptions["outputLevels"] = L"PC";
+            SetStringOption(SRO_YUV_MATRIX, L"None");
+            //SetStringOption(SRO_OUTPUT_LEVELS, L"PC");
         }
         ass_process_codec_private(m_track.get(), (char*)mt.Format() + psi->dwOffset, mt.FormatLength() - psi->dwOffset);
     }
@@ -186,7 +238,7 @@ void AssFilter::SetMediaType(const CMediaType& mt, IPin* pPin)
         m_track = decltype(m_track)(ass_new_track(m_ass.get()));
         m_wsTrackName.assign(L"Not supported!");
         m_wsSubType.assign(L"VOBSUB");
-        m_stringOptions["yuvMatrix"] = L"None";
+        SetStringOption(SRO_YUV_MATRIX, L"None");
         m_bUnsupportedSub = true;
     }
     // PGS Media Sub-Type (NOT SUPPORTED)
@@ -195,9 +247,11 @@ void AssFilter::SetMediaType(const CMediaType& mt, IPin* pPin)
         m_track = decltype(m_track)(ass_new_track(m_ass.get()));
         m_wsTrackName.assign(L"Not supported!");
         m_wsSubType.assign(L"PGS");
-        m_stringOptions["yuvMatrix"] = L"None";
+        SetStringOption(SRO_YUV_MATRIX, L"None");
         m_bUnsupportedSub = true;
     }
+
+    PublishStatus();
 }
 
 void AssFilter::Receive(IMediaSample* pSample, REFERENCE_TIME tSegmentStart)
@@ -217,17 +271,22 @@ void AssFilter::Receive(IMediaSample* pSample, REFERENCE_TIME tSegmentStart)
     {
         tStart += tSegmentStart;
         tStop += tSegmentStart;
+        int nEvents = m_track->n_events;
+
+        // The new events only show on the frames kept for reuse within their times
+        InvalidateFrames(tStart, tStop);
 
         DbgLog((LOG_TRACE, 1, L"AssFilter::Receive() tStart: %I64d, tStop: %I64d", tStart, tStop));
 
         if (m_wsSubType == L"SRT")
         {
             // Send the codec private data
+            auto settings = GetSettings();
             if (!m_bSrtHeaderDone)
             {
                 char outBuffer[1024] {};
-                double resx = m_settings.SrtResX / 384.0;
-                double resy = m_settings.SrtResY / 288.0;
+                double resx = settings->SrtResX / 384.0;
+                double resy = settings->SrtResY / 288.0;
 
                 // Generate a standard ass header
                 _snprintf_s(outBuffer, _TRUNCATE, "[Script Info]\n"
@@ -247,15 +306,18 @@ void AssFilter::Receive(IMediaSample* pSample, REFERENCE_TIME tSegmentStart)
                     "Style: Default,%s,%u,&H%X,&H%X,&H%X,&H%X,0,0,0,0,%u,%u,%u,0,1,%u,%u,%u,%u,%u,%u,1"
                     "\n\n[Events]\n"
                     "Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n\n",
-                    m_settings.ScaledBorderAndShadow ? "yes" : "no", m_settings.Kerning ? "yes" : "no",
-                    m_settings.SrtResX, m_settings.SrtResY,
-                    ws2s(m_settings.FontName).c_str(), (int)std::round(m_settings.FontSize * resy), m_settings.ColorPrimary,
-                    m_settings.ColorSecondary, m_settings.ColorOutline, m_settings.ColorShadow, 
-                    m_settings.FontScaleX, m_settings.FontScaleY, m_settings.FontSpacing, m_settings.FontOutline, 
-                    m_settings.FontShadow, m_settings.LineAlignment, (int)std::round(m_settings.MarginLeft * resx),
-                    (int)std::round(m_settings.MarginRight * resx), (int)std::round(m_settings.MarginVertical * resy));
+                    settings->ScaledBorderAndShadow ? "yes" : "no", settings->Kerning ? "yes" : "no",
+                    settings->SrtResX, settings->SrtResY,
+                    ws2s(settings->FontName).c_str(), (int)std::round(settings->FontSize * resy), settings->ColorPrimary,
+                    settings->ColorSecondary, settings->ColorOutline, settings->ColorShadow, 
+                    settings->FontScaleX, settings->FontScaleY, settings->FontSpacing, settings->FontOutline, 
+                    settings->FontShadow, settings->LineAlignment, (int)std::round(settings->MarginLeft * resx),
+                    (int)std::round(settings->MarginRight * resx), (int)std::round(settings->MarginVertical * resy));
                 ass_process_codec_private(m_track.get(), outBuffer, static_cast<int>(strnlen_s(outBuffer, sizeof(outBuffer))));
                 m_bSrtHeaderDone = true;
+
+                // The style applies to every frame
+                InvalidateFrames();
             }
 
             // Subtitle data is in UTF-8 format.
@@ -269,17 +331,10 @@ void AssFilter::Receive(IMediaSample* pSample, REFERENCE_TIME tSegmentStart)
             m_iSubLineCount = tStart / 10000;
 
             // Change srt tags to ass tags
-            ParseSrtLine(str, m_settings);
-
-            // Add the custom tags
-            str.insert(0, ws2s(m_settings.CustomTags));
-
-            // Add blur
-            char blur[20] {};
-            _snprintf_s(blur, _TRUNCATE, "{\\blur%u}", m_settings.FontBlur);
-            str.insert(0, blur);
+            ParseSrtLine(str, *settings);
 
-            // ASS in MKV: ReadOrder, Layer, Style, Name, MarginL, MarginR, MarginV, Effect, Text
+            // ASS in MKV: ReadOrder, Layer, Style, Name, MarginL, MarginR, MarginV, Effect, Text,
+            // the Default style carries the settings and the custom tags are added when rendering
             char outBuffer[1024] {};
             _snprintf_s(outBuffer, _TRUNCATE, "%lld,0,Default,Main,0,0,0,,%s", m_iSubLineCount, str.c_str());
             ass_process_chunk(m_track.get(), outBuffer, static_cast<int>(strnlen_s(outBuffer, sizeof(outBuffer))), tStart / 10000, (tStop - tStart) / 10000);
@@ -331,6 +386,20 @@ void AssFilter::Receive(IMediaSample* pSample, REFERENCE_TIME tSegmentStart)
                 }
             }
         }
+
+        // A live line for frames the consumer already queued only shows once they're requested again
+        LARGE_INTEGER freq, tNow;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&tNow);
+        std::vector<int64_t> frames;
+        if (m_track->n_events > nEvents &&
+            m_liveCaptions.AddLine(tStart, tStop, tNow.QuadPart * 1000.0 / freq.QuadPart, frames) &&
+            m_boolOptions[SRO_LOW_LATENCY] && m_consumer)
+        {
+            DbgLog((LOG_TRACE, 1, L"AssFilter::Receive() late line, clearing %Iu frames", frames.size()));
+            ClearConsumerAsync(tStart);
+            PreRenderFrames(frames);
+        }
     }
 }
 
@@ -383,7 +452,7 @@ STDMETHODIMP AssFilter::Pause()
             if (FAILED(LoadExternalFile()))
                 m_bNoExtFile = true;
 
-            if (m_settings.TrayIcon)
+            if (GetSettings()->TrayIcon)
                 CreateTrayIcon();
         }
 
@@ -454,6 +523,31 @@ STDMETHODIMP AssFilter::RequestFrame(REFERENCE_TIME start, REFERENCE_TIME stop,
 
     CheckPointer(m_consumer, E_UNEXPECTED);
 
+    // Pick up the changes of the external file and of the settings
+    ApplyPendingScript();
+    UpdateSrtStyle();
+
+    ULONGLONG frameDuration = 0;
+    if (FAILED(m_consumer->GetUlonglong("frameRate", &frameDuration)))
+        frameDuration = 0;
+    m_governor.SetFrameDuration(static_cast<int64_t>(frameDuration));
+
+    // Fast forward, rewind and scrubbing from the cadence of the requests, or from the consumer
+    LARGE_INTEGER freq, tStart, tEnd;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&tStart);
+    m_trickPlay.SetRate(m_playbackRate.load());
+    if (m_trickPlay.AddRequest(start, static_cast<int64_t>(frameDuration), tStart.QuadPart * 1000.0 / freq.QuadPart))
+        DbgLog((LOG_TRACE, 1, L"AssFilter::RequestFrame() trick play: %d, rate: %.2f", m_trickPlay.IsActive(), m_trickPlay.GetRate()));
+
+    // Better the previous subtitles than a dropped video frame
+    if (!m_governor.ShouldRender())
+    {
+        if (m_lastFrame)
+            return m_consumer->DeliverFrame(start, stop, context, m_lastFrame);
+        m_governor.CancelRepeat();
+    }
+
     RECT videoOutputRect;
     m_consumer->GetRect("videoOutputRect", &videoOutputRect);
     DbgLog((LOG_TRACE, 1, L"AssFilter::RequestFrame() videoOutputRect: %u, %u, %u, %u", videoOutputRect.left, videoOutputRect.top, videoOutputRect.right, videoOutputRect.bottom));
@@ -462,12 +556,14 @@ STDMETHODIMP AssFilter::RequestFrame(REFERENCE_TIME start, REFERENCE_TIME stop,
     RECT videoRect{};
 
     // Check to draw subtitles at custom resolution
-    if (m_settings.NativeSize)
+    auto settings = GetSettings();
+    UpdateParallelGroups(*settings);
+    if (settings->NativeSize)
     {
         SIZE originalVideoSize;
         m_consumer->GetSize("originalVideoSize", &originalVideoSize);
 
-        switch (m_settings.CustomRes)
+        switch (settings->CustomRes)
         {
         case 0:
             videoRect.right = originalVideoSize.cx;
@@ -514,16 +610,447 @@ STDMETHODIMP AssFilter::RequestFrame(REFERENCE_TIME start, REFERENCE_TIME stop,
     else
         videoRect = videoOutputRect;
 
-    ass_set_frame_size(m_renderer.get(), videoRect.right , videoRect.bottom);
+    // Under load render smaller like with a custom resolution, the consumer scales the bitmap
+    double scale = m_governor.GetScale();
+    if (m_trickPlay.IsActive())
+        scale = (std::min)(scale, CTrickPlay::kScale);
+    if (scale < 1.0)
+    {
+        RECT scaledRect{};
+        scaledRect.right = (std::max)(1L, (LONG)std::lround((videoRect.right - videoRect.left) * scale));
+        scaledRect.bottom = (std::max)(1L, (LONG)std::lround((videoRect.bottom - videoRect.top) * scale));
+        videoRect = scaledRect;
+    }
+
+    // While the window is being resized keep the size the frames are rendered at, the consumer
+    // scales them. Sizes still in the renderer pool, like fullscreen and back, switch at once.
+    SIZE size = { videoRect.right, videoRect.bottom };
+    if (!EqualRect(&videoRect, &m_renderRect))
+    {
+        ULONGLONG now = GetTickCount64();
+        if (size.cx != m_pendingSize.cx || size.cy != m_pendingSize.cy)
+        {
+            m_pendingSize = size;
+            m_pendingSince = now;
+        }
+
+        if (!IsRectEmpty(&m_renderRect) && now - m_pendingSince < RESIZE_DEBOUNCE_MS &&
+            !m_renderers->Contains(size.cx, size.cy))
+            videoRect = m_renderRect;
+        else
+            m_renderRect = videoRect;
+    }
+
+    ASS_Renderer* renderer = m_renderers->Get(videoRect.right, videoRect.bottom);
+    CheckPointer(renderer, E_OUTOFMEMORY);
 
     DbgLog((LOG_TRACE, 1, L"AssFilter::RequestFrame() videoRect: %u, %u, %u, %u", videoRect.left, videoRect.top, videoRect.right, videoRect.bottom));
 
+    // Where the consumer wants the subtitles, mapped to the rect they're rendered for
+    RECT clipRect = videoRect;
+    RECT subtitleTargetRect;
+    if (m_boolOptions[SRO_IS_MOVABLE] &&
+        SUCCEEDED(m_consumer->GetRect("subtitleTargetRect", &subtitleTargetRect)) &&
+        !EqualRect(&subtitleTargetRect, &videoOutputRect) &&
+        videoOutputRect.right > videoOutputRect.left && videoOutputRect.bottom > videoOutputRect.top)
+    {
+        double sx = double(videoRect.right - videoRect.left) / (videoOutputRect.right - videoOutputRect.left);
+        double sy = double(videoRect.bottom - videoRect.top) / (videoOutputRect.bottom - videoOutputRect.top);
+        clipRect.left = videoRect.left + std::lround((subtitleTargetRect.left - videoOutputRect.left) * sx);
+        clipRect.top = videoRect.top + std::lround((subtitleTargetRect.top - videoOutputRect.top) * sy);
+        clipRect.right = videoRect.right + std::lround((subtitleTargetRect.right - videoOutputRect.right) * sx);
+        clipRect.bottom = videoRect.bottom + std::lround((subtitleTargetRect.bottom - videoOutputRect.bottom) * sy);
+    }
+
+    // The upper subtitles follow the top of the target, the lower ones its bottom
+    LONG topOffset = clipRect.top - videoRect.top;
+    LONG bottomOffset = clipRect.bottom - videoRect.bottom;
+
+    QueryPerformanceCounter(&tStart);
+
+    // When only the target moved the bitmaps are translated, not rendered again
+    if (!m_baseFrame || start != m_baseFrameStart || !EqualRect(&videoRect, &m_baseFrameRect))
+    {
+        // Rendered ahead after a late live line, expanded from the cache
+        const CFrameCache::s_frame* packed = EqualRect(&videoRect, &m_preRenderRect) ? m_renderAhead.Find(start) : nullptr;
+        if (packed)
+        {
+            m_baseFrame = new SubFrame(*packed);
+            LARGE_INTEGER tDecoded;
+            QueryPerformanceCounter(&tDecoded);
+            m_renderAhead.AddDecodeTime((tDecoded.QuadPart - tStart.QuadPart) * 1000.0 / freq.QuadPart);
+        }
+        else
+        {
+            m_baseFrame = RenderFrame(renderer, videoRect, start / 10000);
+        }
+        m_baseFrameStart = start;
+        m_baseFrameRect = videoRect;
+
+        // The consumer requests the frames in order
+        m_renderAhead.EraseUpTo(start);
+        while (!m_preRenderQueue.empty() && m_preRenderQueue.front() <= start)
+            m_preRenderQueue.pop_front();
+    }
+
+    // The frames of trick play are smaller and don't tell the cost of playback
+    QueryPerformanceCounter(&tEnd);
+    if (!m_trickPlay.IsActive() && m_governor.AddRenderTime((tEnd.QuadPart - tStart.QuadPart) * 1000.0 / freq.QuadPart))
+    {
+        DbgLog((LOG_TRACE, 1, L"AssFilter::RequestFrame() governor level: %s", CRenderGovernor::GetLevelName(m_governor.GetLevel())));
+        m_renderers->SetShaper(m_governor.UseSimpleShaper() ? ASS_SHAPING_SIMPLE : ASS_SHAPING_COMPLEX);
+    }
+
+    ISubRenderFramePtr frame = m_baseFrame;
+    if (topOffset || bottomOffset || !EqualRect(&clipRect, &videoRect))
+    {
+        DbgLog((LOG_TRACE, 1, L"AssFilter::RequestFrame() clipRect: %d, %d, %d, %d", clipRect.left, clipRect.top, clipRect.right, clipRect.bottom));
+        frame = new SubFrame(*ToSubFrame(m_baseFrame), clipRect, topOffset, bottomOffset);
+    }
+
+    m_lastFrame = frame;
+    HRESULT hr = m_consumer->DeliverFrame(start, stop, context, frame);
+
+    QueryPerformanceCounter(&tEnd);
+    m_liveCaptions.AddFrame(start, stop, tEnd.QuadPart * 1000.0 / freq.QuadPart);
+
+    return hr;
+}
+
+// Drop the frames kept for reuse, the track or the output changed
+void AssFilter::InvalidateFrames()
+{
+    m_lastFrame = nullptr;
+    m_baseFrame = nullptr;
+    m_staticFrame = nullptr;
+    m_trickFrame = nullptr;
+    m_prevRenderFrame = nullptr;
+    m_renderAhead.Clear();
+    m_preRenderQueue.clear();
+    m_framesGeneration++;
+}
+
+// Drop the frames kept for reuse that show the time of events added from tStart to tStop.
+// The frame of the last ass_render_frame call stays, libass tells whether it changed.
+void AssFilter::InvalidateFrames(REFERENCE_TIME tStart, REFERENCE_TIME tStop)
+{
+    // The frames are rendered at their start in ms, like the events are timed
+    long long begin = tStart / 10000;
+    long long end = begin + (tStop - tStart) / 10000;
+    auto overlaps = [begin, end](long long first, long long last) { return first < end && begin < last; };
+
+    if (m_baseFrame && overlaps(m_baseFrameStart / 10000, m_baseFrameStart / 10000 + 1))
+    {
+        m_lastFrame = nullptr;
+        m_baseFrame = nullptr;
+    }
+    if (m_staticFrame && overlaps(m_staticBegin, m_staticEnd))
+        m_staticFrame = nullptr;
+    if (m_trickFrame && overlaps(m_trickBegin, m_trickEnd))
+        m_trickFrame = nullptr;
+
+    m_renderAhead.EraseRange(begin * 10000, end * 10000);
+    m_framesGeneration++;
+}
+
+// Render the current track, the static events once for each interval in which they don't change
+ISubRenderFramePtr AssFilter::RenderFrame(ASS_Renderer* renderer, RECT videoRect, long long now)
+{
+    ASS_Track* track = m_bExternalFile ? m_extSubTrack[m_ExtSubFiles[m_iCurExtSubTrack].vecPos].get() : m_track.get();
+    if (!track)
+        return new SubFrame(videoRect, m_consumerLastId++, nullptr, SplitBitmaps(), *m_scheduler);
+
+    LoadReferencedFonts(track);
+
+    if (!m_eventSplit || m_eventSplit->GetSource() != track)
+    {
+        ResetEventSplit();
+        m_eventSplit = std::make_unique<CEventSplit>(m_ass.get(), track, GetEventPrefix());
+    }
+    else if (m_eventSplit->Update())
+    {
+        // The parallel renderers may have copied a track that was freed, and the static
+        // frame may hold events that moved to the animated track
+        m_parallel.clear();
+        m_staticFrame = nullptr;
+    }
+
+    // Trick play renders the events long enough to be seen, without following their animations
+    long long begin, end;
+    CEventIndex* sourceIndex = m_eventSplit->GetSourceIndex();
+    sourceIndex->SetMinDuration(m_trickPlay.GetInterval());
+    if (m_trickPlay.IsActive())
+    {
+        sourceIndex->GetView(now);
+        sourceIndex->GetViewInterval(begin, end);
+        if (!m_trickFrame || now < m_trickBegin || now >= m_trickEnd || !EqualRect(&videoRect, &m_trickRect))
+        {
+            m_trickFrame = RenderTrack(renderer, *sourceIndex, videoRect, now);
+            m_trickBegin = begin;
+            m_trickEnd = end;
+            m_trickRect = videoRect;
+        }
+        return m_trickFrame;
+    }
+    m_trickFrame = nullptr;
+
+    // The consumer wants one bitmap, the static events can't keep their own
+    if (m_boolOptions[SRO_COMBINE_BITMAPS])
+        return RenderTrack(renderer, *sourceIndex, videoRect, now);
+
+    CEventSplit::Order order = m_eventSplit->GetOrder(now, begin, end);
+    CEventIndex* staticIndex = m_eventSplit->GetStaticIndex();
+    CEventIndex* animatedIndex = m_eventSplit->GetAnimatedIndex();
+
+    // The bitmaps of the two tracks can't be stacked when their layers interleave
+    if (order == CEventSplit::ORDER_MIXED)
+        return RenderTrack(renderer, *sourceIndex, videoRect, now);
+    if (!staticIndex)
+        return RenderTrack(renderer, *animatedIndex, videoRect, now);
+
+    if (m_staticFrame && now >= m_staticBegin && now < m_staticEnd && EqualRect(&videoRect, &m_staticRect))
+    {
+        m_framesStaticCached.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        m_staticFrame = RenderTrack(renderer, *staticIndex, videoRect, now);
+        m_staticBegin = begin;
+        m_staticEnd = end;
+        m_staticRect = videoRect;
+    }
+
+    if (!animatedIndex)
+        return m_staticFrame;
+
+    // Separate bitmaps, the static ones keep their ids and the consumer their textures
+    ISubRenderFramePtr animatedFrame = RenderTrack(renderer, *animatedIndex, videoRect, now);
+    if (order == CEventSplit::ORDER_STATIC_BELOW)
+        return new SubFrame(*ToSubFrame(m_staticFrame), *ToSubFrame(animatedFrame));
+    else
+        return new SubFrame(*ToSubFrame(animatedFrame), *ToSubFrame(m_staticFrame));
+}
+
+// Frames with the same images as the previous ass_render_frame call aren't flattened again
+ISubRenderFramePtr AssFilter::RenderTrack(ASS_Renderer* renderer, CEventIndex& index, RECT videoRect, long long now)
+{
     int frameChange = 0;
-    ISubRenderFramePtr frame = new SubFrame(videoRect, m_consumerLastId++,
-                                            ass_render_frame(m_renderer.get(),
-                                            m_bExternalFile ? m_extSubTrack[m_ExtSubFiles[m_iCurExtSubTrack].vecPos].get() : m_track.get(),
-                                            start / 10000, &frameChange));
-    return m_consumer->DeliverFrame(start, stop, context, frame);
+    std::vector<ASS_Image*> images;
+    std::vector<ASS_Renderer*> renderers;
+
+    // libass only goes through the events shown at now
+    ASS_Track* track = index.GetSource();
+    ASS_Track* view = index.GetView(now);
+
+    // The same state was rendered before, at another time or before a seek
+    m_stateCache.SetBudget((size_t)GetSettings()->StateCacheSize * 1024 * 1024);
+    bool bCacheState = false;
+    if (m_stateCache.IsEnabled())
+    {
+        m_stateKey.assign({ videoRect.left, videoRect.top, videoRect.right, videoRect.bottom,
+                            m_governor.UseSimpleShaper(), SplitBitmaps() });
+        bCacheState = index.GetViewState(now, m_stateKey);
+
+        ISubRenderFramePtr frame = bCacheState ? m_stateCache.Find(m_stateKey) : nullptr;
+        if (frame)
+            return frame;
+    }
+
+    // Heavy frames are split by layer over several renderers, the images are the same
+    if (m_parallelGroups > 1 && view->n_events >= PARALLEL_MIN_EVENTS && !m_trickPlay.IsActive())
+    {
+        auto& parallel = m_parallel[track];
+        if (!parallel)
+            parallel = std::make_unique<CParallelRenderer>(m_ass.get(), track, m_parallelGroups, *m_scheduler, GetEventPrefix());
+        else
+            parallel->Update();
+
+        if (!m_renderers->GetWorkers(parallel->GetGroupCount(), renderers) ||
+            !parallel->Render(renderers.data(), now, images, frameChange))
+            renderers.clear();
+    }
+
+    if (renderers.empty())
+        images.assign(1, ass_render_frame(renderer, view, now, &frameChange));
+
+    if (!m_prevRenderFrame || frameChange != 0 || renderer != m_prevRenderer || track != m_prevTrack ||
+        renderers.size() != m_prevGroups)
+    {
+        m_prevRenderFrame = new SubFrame(videoRect, m_consumerLastId++, images, SplitBitmaps(), *m_scheduler);
+        m_prevRenderer = renderer;
+        m_prevTrack = track;
+        m_prevGroups = renderers.size();
+    }
+
+    // Keeps the ids of the bitmaps, the consumer may still hold their textures when the state comes back
+    if (bCacheState)
+        m_stateCache.Add(m_stateKey, m_prevRenderFrame, ToSubFrame(m_prevRenderFrame)->GetSize());
+
+    return m_prevRenderFrame;
+}
+
+// Renders the frames the consumer requests again after a Clear on a worker, one at a time
+// and without the filter lock so that its requests in the meantime don't wait
+void AssFilter::PreRenderFrames(const std::vector<int64_t>& frames)
+{
+    if (frames.empty() || IsRectEmpty(&m_baseFrameRect))
+        return;
+
+    m_preRenderRect = m_baseFrameRect;
+    m_preRenderQueue.assign(frames.begin(), frames.end());
+    if (m_bPreRendering)
+        return;
+
+    m_bPreRendering = true;
+    std::shared_ptr<s_prerender_guard> guard = m_preRenderGuard;
+    m_scheduler->Submit([guard]()
+    {
+        for (;;)
+        {
+            CAutoLock lock(&guard->cs);
+            if (!guard->filter || !guard->filter->PreRenderNext())
+                break;
+        }
+    });
+}
+
+// Clear calls back into the filter from the thread of the consumer, it's made from a worker
+// without the filter lock
+void AssFilter::ClearConsumerAsync(REFERENCE_TIME clearNewerThan)
+{
+    std::shared_ptr<s_prerender_guard> guard = m_preRenderGuard;
+    m_scheduler->Submit([guard, clearNewerThan]()
+    {
+        ISubRenderConsumer2Ptr consumer;
+        {
+            CAutoLock lock(&guard->cs);
+            if (!guard->filter)
+                return;
+
+            CAutoLock filterLock(guard->filter);
+            consumer = guard->filter->m_consumer;
+        }
+
+        if (consumer)
+            consumer->Clear(clearNewerThan);
+    });
+}
+
+// Called by the task with the guard locked. The events shown at the start of the frame are
+// copied under the filter lock and rendered on the renderer of the guard, the frame is only
+// kept if nothing invalidated the frames in the meantime.
+bool AssFilter::PreRenderNext()
+{
+    s_prerender_guard& guard = *m_preRenderGuard;
+    std::unique_ptr<ASS_Track, ASS_TrackDeleter> track;
+    REFERENCE_TIME start;
+    RECT rect;
+    ULONGLONG id;
+    ULONGLONG generation;
+    ASS_ShapingLevel shaper;
+    bool bSplit;
+    {
+        CAutoLock lock(this);
+
+        if (m_preRenderQueue.empty() || !m_consumer)
+        {
+            m_bPreRendering = false;
+            return false;
+        }
+
+        // The frames past the budget are rendered when requested
+        m_renderAhead.SetBudget((size_t)GetSettings()->RenderAheadBudget * 1024 * 1024);
+        if (!m_renderAhead.HasRoom())
+        {
+            DbgLog((LOG_TRACE, 1, L"AssFilter::PreRenderNext() budget reached, %Iu frames left", m_preRenderQueue.size()));
+            m_preRenderQueue.clear();
+            m_bPreRendering = false;
+            return false;
+        }
+
+        start = m_preRenderQueue.front();
+        m_preRenderQueue.pop_front();
+
+        ASS_Track* source = m_bExternalFile ? m_extSubTrack[m_ExtSubFiles[m_iCurExtSubTrack].vecPos].get() : m_track.get();
+        if (!source)
+            return true;
+
+        LoadReferencedFonts(source);
+        track.reset(CopyTrackHeader(m_ass.get(), source));
+        if (!track)
+            return true;
+
+        long long now = start / 10000;
+        for (int i = 0; i < source->n_events; ++i)
+        {
+            const ASS_Event& event = source->events[i];
+            if (event.Start <= now && now < event.Start + event.Duration)
+                CopyTrackEvent(track.get(), event, GetEventPrefix());
+        }
+
+        if (guard.renderer && guard.fontSetup != m_renderers->GetFontSetup())
+            guard.renderer.reset();
+        if (!guard.renderer)
+        {
+            guard.renderer = m_renderers->NewDetached();
+            guard.fontSetup = m_renderers->GetFontSetup();
+            if (!guard.renderer)
+                return true;
+        }
+
+        rect = m_preRenderRect;
+        id = m_consumerLastId++;
+        generation = m_framesGeneration;
+        shaper = m_governor.UseSimpleShaper() ? ASS_SHAPING_SIMPLE : ASS_SHAPING_COMPLEX;
+        bSplit = SplitBitmaps();
+    }
+
+    // The images stay valid until the next render of the renderer of the guard
+    ASS_Image* image;
+    {
+        CAutoLock fontsLock(&m_csFonts);
+        ass_set_frame_size(guard.renderer.get(), rect.right, rect.bottom);
+        ass_set_shaper(guard.renderer.get(), shaper);
+        image = ass_render_frame(guard.renderer.get(), track.get(), start / 10000, nullptr);
+    }
+
+    ISubRenderFramePtr frame = new SubFrame(rect, id, image, bSplit, *m_scheduler);
+    CFrameCache::s_frame packed;
+    ToSubFrame(frame)->Pack(nullptr, packed);
+
+    // A frame the consumer requested meanwhile was rendered for it
+    CAutoLock lock(this);
+    if (generation == m_framesGeneration && EqualRect(&rect, &m_preRenderRect) && start > m_baseFrameStart)
+        m_renderAhead.Add(start, std::move(packed));
+
+    return true;
+}
+
+// The calling thread renders a group too, more renderers than threads only add their caches
+void AssFilter::UpdateParallelGroups(const AssFSettings& settings)
+{
+    size_t groups = (std::min)(m_scheduler->GetWorkerCount() + 1, static_cast<size_t>(PARALLEL_MAX_RENDERERS));
+    groups = (std::max)((std::min)(static_cast<size_t>(settings.ParallelRenderers), groups), static_cast<size_t>(1));
+    if (groups == m_parallelGroups)
+        return;
+
+    m_parallelGroups = groups;
+    m_parallel.clear();
+    m_renderers->SetWorkerCount(groups);
+}
+
+void AssFilter::ResetEventSplit()
+{
+    m_eventSplit.reset();
+    m_parallel.clear();
+    m_stateCache.Clear();
+    m_fontTrack = nullptr;
+}
+
+const std::string& AssFilter::GetEventPrefix() const
+{
+    static const std::string none;
+    return m_wsSubType == L"SRT" ? m_srtCustomTags : none;
 }
 
 STDMETHODIMP AssFilter::Disconnect(void)
@@ -532,6 +1059,9 @@ STDMETHODIMP AssFilter::Disconnect(void)
 
     CAutoLock lock(this);
     m_consumer = nullptr;
+    InvalidateFrames();
+    m_stateCache.Clear();
+    m_liveCaptions.Reset();
 
     return S_OK;
 }
@@ -539,98 +1069,136 @@ STDMETHODIMP AssFilter::Disconnect(void)
 STDMETHODIMP AssFilter::GetBool(LPCSTR field, bool* value)
 {
     CheckPointer(value, E_POINTER);
-    *value = m_boolOptions[field];
+
+    int option = FindSubRenderOption(field, SRO_TYPE_BOOL);
+    if (option < 0)
+        return E_INVALIDARG;
+
+    *value = m_boolOptions[option];
 
     return S_OK;
 }
 
+// The provider has no int, size, rect or ulonglong fields
+
 STDMETHODIMP AssFilter::GetInt(LPCSTR field, int* value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::GetSize(LPCSTR field, SIZE* value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::GetRect(LPCSTR field, RECT* value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::GetUlonglong(LPCSTR field, ULONGLONG* value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::GetDouble(LPCSTR field, double* value)
 {
-    return S_FALSE;
+    CheckPointer(value, E_POINTER);
+
+    if (FindSubRenderOption(field, SRO_TYPE_DOUBLE) != SRO_PLAYBACK_RATE)
+        return E_INVALIDARG;
+
+    *value = m_playbackRate.load();
+
+    return S_OK;
 }
 
 STDMETHODIMP AssFilter::GetString(LPCSTR field, LPWSTR* value, int* chars)
 {
     CheckPointer(value, E_POINTER);
-    auto str = m_stringOptions[field];
+
+    int option = FindSubRenderOption(field, SRO_TYPE_STRING);
+    if (option < 0)
+        return E_INVALIDARG;
+
+    CAutoLock lock(&m_csOptions);
+    const std::wstring& str = m_stringOptions[option];
     size_t len = str.length();
-    *value = (LPWSTR)LocalAlloc(0, (len + 1) * sizeof(WCHAR));
-    memcpy(*value, str.data(), len * sizeof(WCHAR));
-    (*value)[len] = '\0';
+    *value = LocalAllocString(str);
+    if (!*value)
+        return E_OUTOFMEMORY;
     if (chars)
         *chars = static_cast<int>(len);
 
-    DbgLog((LOG_TRACE, 1, L"AssFilter::GetString() field: %S, value: %s, chars: %d", field, *value, *chars));
+    DbgLog((LOG_TRACE, 1, L"AssFilter::GetString() field: %S, value: %s, chars: %d", field, *value, static_cast<int>(len)));
 
     return S_OK;
 }
 
 STDMETHODIMP AssFilter::GetBin(LPCSTR field, LPVOID* value, int* size)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::SetBool(LPCSTR field, bool value)
 {
-    if (strcmp(field, "combineBitmaps") == 0)
-        m_boolOptions[field] = value;
+    int option = FindSubRenderOption(field, SRO_TYPE_BOOL);
+    if (option < 0)
+        return E_INVALIDARG;
+    if (!subrender_option[option].writable)
+        return E_ACCESSDENIED;
+
+    m_boolOptions[option] = value;
 
     return S_OK;
 }
 
 STDMETHODIMP AssFilter::SetInt(LPCSTR field, int value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::SetSize(LPCSTR field, SIZE value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::SetRect(LPCSTR field, RECT value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::SetUlonglong(LPCSTR field, ULONGLONG value)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
 }
 
 STDMETHODIMP AssFilter::SetDouble(LPCSTR field, double value)
 {
-    return S_FALSE;
+    if (FindSubRenderOption(field, SRO_TYPE_DOUBLE) != SRO_PLAYBACK_RATE || !std::isfinite(value))
+        return E_INVALIDARG;
+
+    m_playbackRate = value;
+
+    return S_OK;
 }
 
 STDMETHODIMP AssFilter::SetString(LPCSTR field, LPWSTR value, int chars)
 {
-    return S_FALSE;
+    // All the string fields are read only
+    return FindSubRenderOption(field, SRO_TYPE_STRING) < 0 ? E_INVALIDARG : E_ACCESSDENIED;
 }
 
 STDMETHODIMP AssFilter::SetBin(LPCSTR field, LPVOID value, int size)
 {
-    return S_FALSE;
+    return E_INVALIDARG;
+}
+
+// The consumer reads the strings from its own thread
+void AssFilter::SetStringOption(SubRenderOption option, const std::wstring& value)
+{
+    CAutoLock lock(&m_csOptions);
+    m_stringOptions[option] = value;
 }
 
 STDMETHODIMP AssFilter::GetPages(CAUUID *pPages)
@@ -684,31 +1252,102 @@ STDMETHODIMP AssFilter::CreatePage(const GUID& guid, IPropertyPage** ppPage)
 }
 
 // IAssFilterSettings
-STDMETHODIMP AssFilter::GetTrackInfo(const WCHAR **pTrackName, const WCHAR **pTrackLang, const WCHAR **pSubType)
+// The strings are copied from the status snapshot, the filter may publish a new one meanwhile
+STDMETHODIMP AssFilter::GetTrackInfo(LPWSTR *pTrackName, LPWSTR *pTrackLang, LPWSTR *pSubType)
 {
+    auto status = GetStatus();
+    bool bFailed = false;
+
     if (pTrackName)
-        *pTrackName = m_wsTrackName.c_str();
+        bFailed |= !(*pTrackName = LocalAllocString(status->trackName));
 
     if (pTrackLang)
-        *pTrackLang = m_wsTrackLang.c_str();
+        bFailed |= !(*pTrackLang = LocalAllocString(status->trackLang));
 
     if (pSubType)
-        *pSubType = m_wsSubType.c_str();
+        bFailed |= !(*pSubType = LocalAllocString(status->subType));
 
-    return S_OK;
+    return bFailed ? E_OUTOFMEMORY : S_OK;
 }
 
-STDMETHODIMP AssFilter::GetConsumerInfo(const WCHAR **pName, const WCHAR **pVersion)
+STDMETHODIMP AssFilter::GetConsumerInfo(LPWSTR *pName, LPWSTR *pVersion)
 {
+    auto status = GetStatus();
+    bool bFailed = false;
+
     if (pName)
-        *pName = m_wsConsumerName.c_str();
+        bFailed |= !(*pName = LocalAllocString(status->consumerName));
 
     if (pVersion)
-        *pVersion = m_wsConsumerVer.c_str();
+        bFailed |= !(*pVersion = LocalAllocString(status->consumerVer));
+
+    return bFailed ? E_OUTOFMEMORY : S_OK;
+}
+
+// Never takes the filter lock, the render paths pick the new snapshot up on their next call.
+// The track cache and the loaded tracks keep the settings they were created with.
+STDMETHODIMP AssFilter::ReloadSettings()
+{
+    DbgLog((LOG_TRACE, 1, L"AssFilter::ReloadSettings()"));
+
+    return LoadSettings();
+}
+
+STDMETHODIMP AssFilter::GetRenderStats(AssFRenderStats *pStats)
+{
+    CheckPointer(pStats, E_POINTER);
+
+    CRenderGovernor::s_stats stats;
+    m_governor.GetStats(stats);
+
+    pStats->Level = stats.level;
+    pStats->LevelName = CRenderGovernor::GetLevelName(stats.level);
+    pStats->RenderTime = stats.renderTime;
+    pStats->FrameBudget = stats.frameBudget;
+    pStats->FramesRendered = stats.framesRendered;
+    pStats->FramesDegraded = stats.framesDegraded;
+    pStats->FramesRepeated = stats.framesRepeated;
+    pStats->FramesStaticCached = m_framesStaticCached.load(std::memory_order_relaxed);
+    pStats->LevelDowns = stats.levelDowns;
+    pStats->LevelUps = stats.levelUps;
+
+    CLiveCaptions::s_stats live;
+    m_liveCaptions.GetStats(live);
+    pStats->LateLines = live.lateLines;
+    pStats->LateLinesShown = live.linesShown;
+    pStats->LineLatency = live.averageLatency;
+    pStats->LineLatencyMax = live.maxLatency;
+
+    CFrameCache::s_stats ahead;
+    m_renderAhead.GetStats(ahead);
+    pStats->AheadFrames = ahead.frames;
+    pStats->AheadBytes = ahead.bytes;
+    pStats->AheadBudget = ahead.budget;
+    pStats->AheadRatio = ahead.ratio;
+    pStats->AheadDecodeTime = ahead.decodeTime;
+
+    CStateCache::s_stats state;
+    m_stateCache.GetStats(state);
+    pStats->StateLookups = state.lookups;
+    pStats->StateHits = state.hits;
+    pStats->StateFrames = state.frames;
+    pStats->StateBytes = state.bytes;
 
     return S_OK;
 }
 
+void AssFilter::PublishStatus()
+{
+    auto status = std::make_shared<s_filter_status>();
+    status->trackName = m_wsTrackName;
+    status->trackLang = m_wsTrackLang;
+    status->subType = m_wsSubType;
+    status->consumerName = m_wsConsumerName;
+    status->consumerVer = m_wsConsumerVer;
+
+    std::atomic_store(&m_status, std::shared_ptr<const s_filter_status>(std::move(status)));
+}
+
 // IAFMExtSubtitles
 STDMETHODIMP_(int) AssFilter::GetTotalExternalSubs()
 {
@@ -727,30 +1366,53 @@ STDMETHODIMP AssFilter::SetCurExternalSub(int iCurExtSub)
 
     CAutoLock lock(this);
 
+    // Stop watching the previous file, its watcher never waits on the filter lock
+    m_pFileWatcher.reset();
+    {
+        CAutoLock pendingLock(&m_csPendingScript);
+        m_pendingTrack.reset();
+        m_bPendingScript = false;
+        m_pendingScript.clear();
+    }
+
     m_iCurExtSubTrack = iCurExtSub;
-    if (m_ExtSubFiles[m_iCurExtSubTrack].vecPos == SIZE_MAX)
+    m_srtSettings = nullptr;
+    InvalidateFrames();
+    ResetEventSplit();
+    s_ext_sub& extSub = m_ExtSubFiles[m_iCurExtSubTrack];
+    std::string script;
+    if (extSub.vecPos == SIZE_MAX)
     {
-        if (m_ExtSubFiles[m_iCurExtSubTrack].subType == L"ASS")
+        // Reuse the slot of an evicted track
+        if (m_freeExtSubSlots.empty())
         {
-            m_track = decltype(m_track)(ass_read_file(m_ass.get(), const_cast<char*>(ws2s(m_ExtSubFiles[m_iCurExtSubTrack].subFile).c_str()), "UTF-8"));
-            m_ExtSubFiles[m_iCurExtSubTrack].yuvMatrix = ExtractYuvMatrix(m_ExtSubFiles[m_iCurExtSubTrack].subFile);
+            extSub.vecPos = m_extSubTrack.size();
+            m_extSubTrack.emplace_back();
         }
         else
         {
-            // Check if the file needs conversion to UTF-8
-            if ((m_ExtSubFiles[m_iCurExtSubTrack].codePage != 0) && isFileUTF8(m_ExtSubFiles[m_iCurExtSubTrack].subFile))
-                m_ExtSubFiles[m_iCurExtSubTrack].codePage = 0;
-            m_track = decltype(m_track)(srt_read_file(m_ass.get(), m_ExtSubFiles[m_iCurExtSubTrack].subFile, m_settings, m_ExtSubFiles[m_iCurExtSubTrack].codePage));
+            extSub.vecPos = m_freeExtSubSlots.back();
+            m_freeExtSubSlots.pop_back();
         }
-        m_extSubTrack.push_back(std::move(m_track));
-        m_track.reset();
-        m_ExtSubFiles[m_iCurExtSubTrack].vecPos = m_extSubTrack.size() - 1;
+
+        m_extSubTrack[extSub.vecPos].reset(LoadExternalTrack(extSub, &script));
+        extSub.residentSize = GetTrackMemorySize(m_extSubTrack[extSub.vecPos].get());
+        DbgLog((LOG_TRACE, 1, L"AssFilter::SetCurExternalSub() loaded %s, resident size %Iu KB", extSub.subFile.c_str(),
+            extSub.residentSize / 1024));
     }
-    m_stringOptions["yuvMatrix"] = m_ExtSubFiles[m_iCurExtSubTrack].yuvMatrix;
-    m_boolOptions["isMovable"] = m_ExtSubFiles[m_iCurExtSubTrack].subType == L"SRT" ? true : false;
+
+    // The current track is the most recently used one
+    m_extSubLru.remove(m_iCurExtSubTrack);
+    m_extSubLru.push_front(m_iCurExtSubTrack);
+    EvictExternalTracks();
+
+    WatchExternalFile(script);
+    SetStringOption(SRO_YUV_MATRIX, m_ExtSubFiles[m_iCurExtSubTrack].yuvMatrix);
+    m_boolOptions[SRO_IS_MOVABLE] = m_ExtSubFiles[m_iCurExtSubTrack].subType == L"SRT" ? true : false;
     m_wsTrackName = m_ExtSubFiles[m_iCurExtSubTrack].subFile;
     m_wsTrackLang = m_ExtSubFiles[m_iCurExtSubTrack].subLang;
     m_wsSubType = m_ExtSubFiles[m_iCurExtSubTrack].subType;
+    PublishStatus();
 
     if (m_consumer)
         m_consumer->Clear();
@@ -758,44 +1420,368 @@ STDMETHODIMP AssFilter::SetCurExternalSub(int iCurExtSub)
     return S_OK;
 }
 
-HRESULT AssFilter::LoadDefaults()
-{
-    m_settings.TrayIcon = FALSE;
-    m_settings.NativeSize = FALSE;
-    m_settings.ScaledBorderAndShadow = TRUE;
-    m_settings.DisableFontLigatures = FALSE;
-    m_settings.DisableAutoLoad = FALSE;
-    m_settings.Kerning = FALSE;
-
-    m_settings.FontName = L"Arial";
-    m_settings.FontSize = 18;
-    m_settings.FontScaleX = 100;
-    m_settings.FontScaleY = 100;
-    m_settings.FontSpacing = 0;
-    m_settings.FontBlur = 0;
-
-    m_settings.FontOutline = 2;
-    m_settings.FontShadow = 3;
-    m_settings.LineAlignment = 2;
-    m_settings.MarginLeft = 20;
-    m_settings.MarginRight = 20;
-    m_settings.MarginVertical = 10;
-    m_settings.ColorPrimary = 0x00FFFFFF;
-    m_settings.ColorSecondary = 0x00FFFF;
-    m_settings.ColorOutline = 0;
-    m_settings.ColorShadow = 0x7F000000;
-    m_settings.CustomRes = 0;
-    m_settings.SrtResX = 1920;
-    m_settings.SrtResY = 1080;
-
-    m_settings.CustomTags = L"";
-    m_settings.ExtraFontsDir = L"{FILE_DIR}";
-    m_settings.ExtraSubsDir = L"Subs";
+ASS_Track* AssFilter::LoadExternalTrack(s_ext_sub& extSub, std::string* pScript)
+{
+    LARGE_INTEGER freq, tStart, tEnd;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&tStart);
+
+    auto settings = GetSettings();
+    bool bIsAss = extSub.subType == L"ASS";
+    UINT codePage = extSub.codePage;
+    extSub.scriptHash = bIsAss ? 0 : CTrackCache::HashSettings(*settings);
+
+    s_track_key key;
+    bool bCacheable = m_pTrackCache && CTrackCache::GetFileKey(extSub.subFile, key);
+    if (bCacheable)
+    {
+        key.codePage = codePage;
+        key.settingsHash = extSub.scriptHash;
+
+        std::wstring yuvMatrix;
+        ASS_Track* track = m_pTrackCache->Load(m_ass.get(), key, yuvMatrix);
+        if (track)
+        {
+            if (bIsAss)
+                extSub.yuvMatrix = yuvMatrix;
+            QueryPerformanceCounter(&tEnd);
+            DbgLog((LOG_TRACE, 1, L"AssFilter::LoadExternalTrack() cache hit for %s in %.2f ms", extSub.subFile.c_str(),
+                (tEnd.QuadPart - tStart.QuadPart) * 1000.0 / freq.QuadPart));
+            return track;
+        }
+    }
+
+    // Everything below works on this single read of the file
+    std::string content;
+    if (!ReadFileContent(extSub.subFile, content))
+        return nullptr;
+
+    // A file touched without being modified still matches its cache entry
+    if (bCacheable)
+    {
+        key.contentHash = HashFNV1a(content.data(), content.size());
+
+        std::wstring yuvMatrix;
+        ASS_Track* track = m_pTrackCache->Load(m_ass.get(), key, yuvMatrix);
+        if (track)
+        {
+            if (bIsAss)
+                extSub.yuvMatrix = yuvMatrix;
+            DbgLog((LOG_TRACE, 1, L"AssFilter::LoadExternalTrack() cache hit by content for %s", extSub.subFile.c_str()));
+            return track;
+        }
+    }
+
+    std::string script;
+    ConvertExternalScript(extSub, *settings, content, script);
+
+    // Embedded fonts are extracted by libass while parsing, so those tracks always get parsed.
+    // The library keeps them once added, a track parsed again after an eviction doesn't add copies.
+    bool bHasFonts = bIsAss && script.find("[Fonts]") != std::string::npos;
+    bool bSkipFonts = bHasFonts && extSub.fontsExtracted;
+    ASS_Track* track;
+    {
+        CAutoLock fontsLock(&m_csFonts);
+        if (bSkipFonts)
+            ass_set_extract_fonts(m_ass.get(), FALSE);
+
+        track = ParseExternalScript(m_ass.get(), bIsAss, script);
+        if (bSkipFonts)
+            ass_set_extract_fonts(m_ass.get(), TRUE);
+    }
+    if (track && bHasFonts)
+        extSub.fontsExtracted = true;
+    if (pScript)
+        pScript->swap(script);
+
+    QueryPerformanceCounter(&tEnd);
+    DbgLog((LOG_TRACE, 1, L"AssFilter::LoadExternalTrack() parsed %s in %.2f ms", extSub.subFile.c_str(),
+        (tEnd.QuadPart - tStart.QuadPart) * 1000.0 / freq.QuadPart));
+
+    // The key keeps the configured code page, the UTF-8 detection happens after the lookup
+    if (bCacheable && track && !bHasFonts)
+        m_pTrackCache->Store(track, key, bIsAss ? extSub.yuvMatrix : std::wstring());
+
+    return track;
+}
+
+// Free the least recently used inactive tracks above the memory budget. They are loaded
+// again when selected, from the track cache when it has them and parsed otherwise.
+void AssFilter::EvictExternalTracks()
+{
+    ULONGLONG budget = (ULONGLONG)GetSettings()->ExtTrackBudget * 1024 * 1024;
+    ULONGLONG total = 0;
+    for (int i : m_extSubLru)
+        total += m_ExtSubFiles[i].residentSize;
+
+    // The current track is at the front and always stays loaded
+    while (total > budget && m_extSubLru.size() > 1)
+    {
+        s_ext_sub& extSub = m_ExtSubFiles[m_extSubLru.back()];
+        m_extSubLru.pop_back();
+
+        DbgLog((LOG_TRACE, 1, L"AssFilter::EvictExternalTracks() freed %s, %Iu KB", extSub.subFile.c_str(),
+            extSub.residentSize / 1024));
+
+        total -= extSub.residentSize;
+        FreeExternalTrack(extSub);
+    }
+}
+
+void AssFilter::FreeExternalTrack(s_ext_sub& extSub)
+{
+    m_extSubTrack[extSub.vecPos].reset();
+    m_freeExtSubSlots.push_back(extSub.vecPos);
+    extSub.vecPos = SIZE_MAX;
+    extSub.residentSize = 0;
+}
+
+// SRT events only carry the sizes of the font tags, scaled for the resolution of the track.
+// The other settings are on the Default style and the custom tags are added when rendering,
+// a change of those applies to the whole track without parsing it.
+void AssFilter::UpdateSrtStyle()
+{
+    auto settings = GetSettings();
+    if (settings == m_srtSettings)
+        return;
+
+    ws2s(settings->CustomTags, m_srtCustomTags);
+
+    ASS_Track* track = nullptr;
+    if (m_bExternalFile)
+    {
+        if (m_ExtSubFiles.empty())
+            return;
+
+        // The resolution follows the settings the next time the track is loaded
+        s_ext_sub& extSub = m_ExtSubFiles[m_iCurExtSubTrack];
+        if (extSub.subType == L"SRT" && extSub.vecPos != SIZE_MAX)
+            track = m_extSubTrack[extSub.vecPos].get();
+    }
+    else if (m_wsSubType == L"SRT")
+    {
+        // The header is built from the settings of the first line, with its resolution
+        if (!m_bSrtHeaderDone)
+            return;
+
+        track = m_track.get();
+    }
+
+    bool bChanged = m_srtSettings != nullptr;
+    m_srtSettings = settings;
+    if (!track)
+        return;
+
+    ApplySrtSettings(track, *settings);
+    InvalidateFrames();
+    ResetEventSplit();
+
+    // Frames already queued by the consumer show the old style
+    if (bChanged)
+        ClearConsumerAsync(0);
+}
+
+// Convert the file content to the ASS script the track is parsed from
+void AssFilter::ConvertExternalScript(s_ext_sub& extSub, const AssFSettings& settings, std::string& content, std::string& script)
+{
+    // UTF-16 files are converted, otherwise check if the file needs conversion to UTF-8
+    bool bIsUTF8 = NormalizeToUTF8(content);
+
+    if (extSub.subType == L"ASS")
+    {
+        extSub.yuvMatrix = ExtractYuvMatrix(content);
+        script.swap(content);
+    }
+    else
+    {
+        if (bIsUTF8)
+            extSub.codePage = 0;
+        script = srt_to_ass(content.data(), content.size(), settings, extSub.codePage);
+    }
+}
+
+ASS_Track* AssFilter::ParseExternalScript(ASS_Library* library, bool bIsAss, std::string& script)
+{
+    if (!bIsAss)
+    {
+        // libass copies the data
+        ASS_Track* track = ass_new_track(library);
+        if (track)
+            ass_process_data(track, &script[0], static_cast<int>(script.size()));
+        return track;
+    }
+
+    // libass copies the buffer before parsing it, the script stays intact
+    return ass_read_memory(library, &script[0], script.size(), nullptr);
+}
+
+// The watcher thread reads, converts and patches its own copy of the track, parsed from the
+// script of the current one on the first change. RequestFrame only swaps in the copy it publishes.
+void AssFilter::WatchExternalFile(std::string& currentScript)
+{
+    s_ext_sub extSub = m_ExtSubFiles[m_iCurExtSubTrack];
+    auto settings = GetSettings();
+    auto state = std::make_shared<s_watch_state>();
+    state->script.swap(currentScript);
+
+    m_pFileWatcher = std::make_unique<CFileWatcher>(extSub.subFile, [this, extSub, settings, state]() mutable {
+        std::string content, script;
+        if (!ReadFileContent(extSub.subFile, content))
+            return;
+        ConvertExternalScript(extSub, *settings, content, script);
+
+        LARGE_INTEGER freq, tStart, tEnd;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&tStart);
+
+        // Without the parsed script the first change reloads the whole track
+        bool bIsAss = extSub.subType == L"ASS";
+        if (!state->track && !state->script.empty())
+        {
+            state->track.reset(ParseExternalScript(m_watchLibrary.get(), bIsAss, state->script));
+            if (state->track)
+                state->patcher = std::make_unique<CTrackPatcher>(state->track.get(), state->script);
+            state->script.clear();
+        }
+
+        long long earliestChange = 0;
+        CTrackPatcher::PatchResult result = CTrackPatcher::PATCH_RELOAD;
+        if (state->patcher && state->track)
+            result = state->patcher->Apply(state->track.get(), script, earliestChange);
+
+        if (result == CTrackPatcher::PATCH_NONE)
+            return;
+
+        if (result == CTrackPatcher::PATCH_RELOAD)
+        {
+            state->track.reset(ParseExternalScript(m_watchLibrary.get(), bIsAss, script));
+            if (!state->track)
+                return;
+            state->patcher = std::make_unique<CTrackPatcher>(state->track.get(), script);
+            earliestChange = 0;
+        }
+
+        // libass extracts the embedded fonts into the library of the renderers while parsing
+        std::unique_ptr<ASS_Track, ASS_TrackDeleter> track;
+        if (result == CTrackPatcher::PATCH_APPLIED || !bIsAss || script.find("[Fonts]") == std::string::npos)
+        {
+            track.reset(CopyTrackHeader(m_watchLibrary.get(), state->track.get()));
+            if (!track)
+                return;
+            for (int i = 0; i < state->track->n_events; ++i)
+                CopyTrackEvent(track.get(), state->track->events[i]);
+        }
+
+        QueryPerformanceCounter(&tEnd);
+        DbgLog((LOG_TRACE, 1, L"AssFilter::WatchExternalFile() %s in %.2f ms, earliest change %I64d ms",
+            result == CTrackPatcher::PATCH_APPLIED ? L"patched" : L"reloaded",
+            (tEnd.QuadPart - tStart.QuadPart) * 1000.0 / freq.QuadPart, earliestChange));
+
+        CAutoLock pendingLock(&m_csPendingScript);
+        if (m_pendingTrack || m_bPendingScript)
+            earliestChange = (std::min)(earliestChange, m_pendingChange);
+        m_pendingChange = earliestChange;
+        m_pendingTrack = std::move(track);
+        m_bPendingScript = !m_pendingTrack;
+        if (m_bPendingScript)
+            m_pendingScript.swap(script);
+        else
+            m_pendingScript.clear();
+    });
+}
+
+void AssFilter::ApplyPendingScript()
+{
+    std::unique_ptr<ASS_Track, ASS_TrackDeleter> newTrack;
+    std::string script;
+    long long earliestChange;
+    {
+        CAutoLock pendingLock(&m_csPendingScript);
+        if (!m_pendingTrack && !m_bPendingScript)
+            return;
+        newTrack = std::move(m_pendingTrack);
+        script.swap(m_pendingScript);
+        m_bPendingScript = false;
+        earliestChange = m_pendingChange;
+    }
+
+    if (!m_bExternalFile || m_ExtSubFiles.empty())
+        return;
+
+    s_ext_sub& extSub = m_ExtSubFiles[m_iCurExtSubTrack];
+    if (!newTrack)
+    {
+        // Adds the fonts of the [Fonts] section to the library
+        CAutoLock fontsLock(&m_csFonts);
+        newTrack.reset(ParseExternalScript(m_ass.get(), extSub.subType == L"ASS", script));
+    }
+    if (!newTrack || extSub.vecPos == SIZE_MAX)
+        return;
+
+    // The previous track is freed on a worker
+    std::shared_ptr<ASS_Track> oldTrack(m_extSubTrack[extSub.vecPos].release(), ASS_TrackDeleter());
+    m_extSubTrack[extSub.vecPos] = std::move(newTrack);
+    m_scheduler->Submit([oldTrack]() mutable { oldTrack.reset(); });
+
+    extSub.residentSize = GetTrackMemorySize(m_extSubTrack[extSub.vecPos].get());
+
+    // The script has the Default style of the watcher settings
+    m_srtSettings = nullptr;
+    InvalidateFrames();
+    ResetEventSplit();
+
+    DbgLog((LOG_TRACE, 1, L"AssFilter::ApplyPendingScript() swapped the track of %s, earliest change %I64d ms",
+        extSub.subFile.c_str(), earliestChange));
+
+    // Only the frames from the first changed event on are stale
+    if (earliestChange != LLONG_MAX)
+        ClearConsumerAsync(earliestChange * 10000);
+}
+
+HRESULT AssFilter::LoadDefaults(AssFSettings& settings)
+{
+    settings.TrayIcon = FALSE;
+    settings.NativeSize = FALSE;
+    settings.ScaledBorderAndShadow = TRUE;
+    settings.DisableFontLigatures = FALSE;
+    settings.DisableAutoLoad = FALSE;
+    settings.Kerning = FALSE;
+
+    settings.FontName = L"Arial";
+    settings.FontSize = 18;
+    settings.FontScaleX = 100;
+    settings.FontScaleY = 100;
+    settings.FontSpacing = 0;
+    settings.FontBlur = 0;
+
+    settings.FontOutline = 2;
+    settings.FontShadow = 3;
+    settings.LineAlignment = 2;
+    settings.MarginLeft = 20;
+    settings.MarginRight = 20;
+    settings.MarginVertical = 10;
+    settings.ColorPrimary = 0x00FFFFFF;
+    settings.ColorSecondary = 0x00FFFF;
+    settings.ColorOutline = 0;
+    settings.ColorShadow = 0x7F000000;
+    settings.CustomRes = 0;
+    settings.SrtResX = 1920;
+    settings.SrtResY = 1080;
+    settings.TrackCacheSize = 64;
+    settings.ExtTrackBudget = 128;
+    settings.RenderAheadBudget = 64;
+    settings.StateCacheSize = 32;
+    settings.ParallelRenderers = 1;
+    settings.SchedulerWorkers = 0;
+
+    settings.CustomTags = L"";
+    settings.ExtraFontsDir = L"{FILE_DIR}";
+    settings.ExtraSubsDir = L"Subs";
 
     return S_OK;
 }
 
-HRESULT AssFilter::ReadSettings(HKEY rootKey)
+HRESULT AssFilter::ReadSettings(HKEY rootKey, AssFSettings& settings)
 {
     HRESULT hr;
     DWORD dwVal;
@@ -806,138 +1792,164 @@ HRESULT AssFilter::ReadSettings(HKEY rootKey)
     if (SUCCEEDED(hr))
     {
         bFlag = reg.ReadBOOL(L"TrayIcon", hr);
-        if (SUCCEEDED(hr)) m_settings.TrayIcon = bFlag;
+        if (SUCCEEDED(hr)) settings.TrayIcon = bFlag;
 
         bFlag = reg.ReadBOOL(L"NativeSize", hr);
-        if (SUCCEEDED(hr)) m_settings.NativeSize = bFlag;
+        if (SUCCEEDED(hr)) settings.NativeSize = bFlag;
 
         bFlag = reg.ReadBOOL(L"ScaledBorderAndShadow", hr);
-        if (SUCCEEDED(hr)) m_settings.ScaledBorderAndShadow = bFlag;
+        if (SUCCEEDED(hr)) settings.ScaledBorderAndShadow = bFlag;
 
         bFlag = reg.ReadBOOL(L"DisableFontLigatures", hr);
-        if (SUCCEEDED(hr)) m_settings.DisableFontLigatures = bFlag;
+        if (SUCCEEDED(hr)) settings.DisableFontLigatures = bFlag;
 
         bFlag = reg.ReadBOOL(L"DisableAutoLoad", hr);
-        if (SUCCEEDED(hr)) m_settings.DisableAutoLoad = bFlag;
+        if (SUCCEEDED(hr)) settings.DisableAutoLoad = bFlag;
 
         bFlag = reg.ReadBOOL(L"Kerning", hr);
-        if (SUCCEEDED(hr)) m_settings.Kerning = bFlag;
+        if (SUCCEEDED(hr)) settings.Kerning = bFlag;
 
         strVal = reg.ReadString(L"FontName", hr);
-        if (SUCCEEDED(hr)) m_settings.FontName = strVal;
+        if (SUCCEEDED(hr)) settings.FontName = strVal;
 
         dwVal = reg.ReadDWORD(L"FontSize", hr);
-        if (SUCCEEDED(hr)) m_settings.FontSize = dwVal;
+        if (SUCCEEDED(hr)) settings.FontSize = dwVal;
 
         dwVal = reg.ReadDWORD(L"FontScaleX", hr);
-        if (SUCCEEDED(hr)) m_settings.FontScaleX = dwVal;
+        if (SUCCEEDED(hr)) settings.FontScaleX = dwVal;
 
         dwVal = reg.ReadDWORD(L"FontScaleY", hr);
-        if (SUCCEEDED(hr)) m_settings.FontScaleY = dwVal;
+        if (SUCCEEDED(hr)) settings.FontScaleY = dwVal;
 
         dwVal = reg.ReadDWORD(L"FontSpacing", hr);
-        if (SUCCEEDED(hr)) m_settings.FontSpacing = dwVal;
+        if (SUCCEEDED(hr)) settings.FontSpacing = dwVal;
 
         dwVal = reg.ReadDWORD(L"FontBlur", hr);
-        if (SUCCEEDED(hr)) m_settings.FontBlur = dwVal;
+        if (SUCCEEDED(hr)) settings.FontBlur = dwVal;
 
         dwVal = reg.ReadDWORD(L"FontOutline", hr);
-        if (SUCCEEDED(hr)) m_settings.FontOutline = dwVal;
+        if (SUCCEEDED(hr)) settings.FontOutline = dwVal;
 
         dwVal = reg.ReadDWORD(L"FontShadow", hr);
-        if (SUCCEEDED(hr)) m_settings.FontShadow = dwVal;
+        if (SUCCEEDED(hr)) settings.FontShadow = dwVal;
 
         dwVal = reg.ReadDWORD(L"LineAlignment", hr);
-        if (SUCCEEDED(hr)) m_settings.LineAlignment = dwVal;
+        if (SUCCEEDED(hr)) settings.LineAlignment = dwVal;
 
         dwVal = reg.ReadDWORD(L"MarginLeft", hr);
-        if (SUCCEEDED(hr)) m_settings.MarginLeft = dwVal;
+        if (SUCCEEDED(hr)) settings.MarginLeft = dwVal;
 
         dwVal = reg.ReadDWORD(L"MarginRight", hr);
-        if (SUCCEEDED(hr)) m_settings.MarginRight = dwVal;
+        if (SUCCEEDED(hr)) settings.MarginRight = dwVal;
 
         dwVal = reg.ReadDWORD(L"MarginVertical", hr);
-        if (SUCCEEDED(hr)) m_settings.MarginVertical = dwVal;
+        if (SUCCEEDED(hr)) settings.MarginVertical = dwVal;
 
         dwVal = reg.ReadDWORD(L"ColorPrimary", hr);
-        if (SUCCEEDED(hr)) m_settings.ColorPrimary = dwVal;
+        if (SUCCEEDED(hr)) settings.ColorPrimary = dwVal;
 
         dwVal = reg.ReadDWORD(L"ColorSecondary", hr);
-        if (SUCCEEDED(hr)) m_settings.ColorSecondary = dwVal;
+        if (SUCCEEDED(hr)) settings.ColorSecondary = dwVal;
 
         dwVal = reg.ReadDWORD(L"ColorOutline", hr);
-        if (SUCCEEDED(hr)) m_settings.ColorOutline = dwVal;
+        if (SUCCEEDED(hr)) settings.ColorOutline = dwVal;
 
         dwVal = reg.ReadDWORD(L"ColorShadow", hr);
-        if (SUCCEEDED(hr)) m_settings.ColorShadow = dwVal;
+        if (SUCCEEDED(hr)) settings.ColorShadow = dwVal;
 
         dwVal = reg.ReadDWORD(L"CustomRes", hr);
-        if (SUCCEEDED(hr)) m_settings.CustomRes = dwVal;
+        if (SUCCEEDED(hr)) settings.CustomRes = dwVal;
 
         dwVal = reg.ReadDWORD(L"SrtResX", hr);
-        if (SUCCEEDED(hr)) m_settings.SrtResX = dwVal;
+        if (SUCCEEDED(hr)) settings.SrtResX = dwVal;
 
         dwVal = reg.ReadDWORD(L"SrtResY", hr);
-        if (SUCCEEDED(hr)) m_settings.SrtResY = dwVal;
+        if (SUCCEEDED(hr)) settings.SrtResY = dwVal;
+
+        dwVal = reg.ReadDWORD(L"TrackCacheSize", hr);
+        if (SUCCEEDED(hr)) settings.TrackCacheSize = dwVal;
+
+        dwVal = reg.ReadDWORD(L"ExtTrackBudget", hr);
+        if (SUCCEEDED(hr)) settings.ExtTrackBudget = dwVal;
+
+        dwVal = reg.ReadDWORD(L"RenderAheadBudget", hr);
+        if (SUCCEEDED(hr)) settings.RenderAheadBudget = dwVal;
+
+        dwVal = reg.ReadDWORD(L"StateCacheSize", hr);
+        if (SUCCEEDED(hr)) settings.StateCacheSize = dwVal;
+
+        dwVal = reg.ReadDWORD(L"ParallelRenderers", hr);
+        if (SUCCEEDED(hr)) settings.ParallelRenderers = dwVal;
+
+        dwVal = reg.ReadDWORD(L"SchedulerWorkers", hr);
+        if (SUCCEEDED(hr)) settings.SchedulerWorkers = dwVal;
 
         strVal = reg.ReadString(L"CustomTags", hr);
-        if (SUCCEEDED(hr)) m_settings.CustomTags = strVal;
+        if (SUCCEEDED(hr)) settings.CustomTags = strVal;
 
         strVal = reg.ReadString(L"ExtraFontsDir", hr);
-        if (SUCCEEDED(hr)) m_settings.ExtraFontsDir = strVal;
+        if (SUCCEEDED(hr)) settings.ExtraFontsDir = strVal;
 
         strVal = reg.ReadString(L"ExtraSubsDir", hr);
-        if (SUCCEEDED(hr)) m_settings.ExtraSubsDir = strVal;
+        if (SUCCEEDED(hr)) settings.ExtraSubsDir = strVal;
     }
     else
-        SaveSettings();
+        SaveSettings(settings);
 
     return S_OK;
 }
 
 HRESULT AssFilter::LoadSettings()
 {
-    LoadDefaults();
+    auto settings = std::make_shared<AssFSettings>();
+    LoadDefaults(*settings);
 
-    ReadSettings(HKEY_CURRENT_USER);
+    ReadSettings(HKEY_CURRENT_USER, *settings);
+    std::atomic_store(&m_settings, std::shared_ptr<const AssFSettings>(std::move(settings)));
     return S_OK;
 }
 
-HRESULT AssFilter::SaveSettings()
+HRESULT AssFilter::SaveSettings(const AssFSettings& settings)
 {
     HRESULT hr;
     CreateRegistryKey(HKEY_CURRENT_USER, ASSFILTER_REGISTRY_KEY);
     CRegistry reg = CRegistry(HKEY_CURRENT_USER, ASSFILTER_REGISTRY_KEY, hr);
     if (SUCCEEDED(hr))
     {
-        reg.WriteBOOL(L"TrayIcon", m_settings.TrayIcon);
-        reg.WriteBOOL(L"NativeSize", m_settings.NativeSize);
-        reg.WriteBOOL(L"ScaledBorderAndShadow", m_settings.ScaledBorderAndShadow);
-        reg.WriteBOOL(L"DisableFontLigatures", m_settings.DisableFontLigatures);
-        reg.WriteBOOL(L"DisableAutoLoad", m_settings.DisableAutoLoad);
-        reg.WriteBOOL(L"Kerning", m_settings.Kerning);
-        reg.WriteString(L"FontName", m_settings.FontName.c_str());
-        reg.WriteDWORD(L"FontSize", m_settings.FontSize);
-        reg.WriteDWORD(L"FontScaleX", m_settings.FontScaleX);
-        reg.WriteDWORD(L"FontScaleY", m_settings.FontScaleY);
-        reg.WriteDWORD(L"FontSpacing", m_settings.FontSpacing);
-        reg.WriteDWORD(L"FontBlur", m_settings.FontBlur);
-        reg.WriteDWORD(L"FontOutline", m_settings.FontOutline);
-        reg.WriteDWORD(L"FontShadow", m_settings.FontShadow);
-        reg.WriteDWORD(L"LineAlignment", m_settings.LineAlignment);
-        reg.WriteDWORD(L"MarginLeft", m_settings.MarginLeft);
-        reg.WriteDWORD(L"MarginRight", m_settings.MarginRight);
-        reg.WriteDWORD(L"MarginVertical", m_settings.MarginVertical);
-        reg.WriteDWORD(L"ColorPrimary", m_settings.ColorPrimary);
-        reg.WriteDWORD(L"ColorSecondary", m_settings.ColorSecondary);
-        reg.WriteDWORD(L"ColorOutline", m_settings.ColorOutline);
-        reg.WriteDWORD(L"ColorShadow", m_settings.ColorShadow);
-        reg.WriteDWORD(L"CustomRes", m_settings.CustomRes);
-        reg.WriteDWORD(L"SrtResX", m_settings.SrtResX);
-        reg.WriteDWORD(L"SrtResY", m_settings.SrtResY);
-        reg.WriteString(L"CustomTags", m_settings.CustomTags.c_str());
-        reg.WriteString(L"ExtraFontsDir", m_settings.ExtraFontsDir.c_str());
-        reg.WriteString(L"ExtraSubsDir", m_settings.ExtraSubsDir.c_str());
+        reg.WriteBOOL(L"TrayIcon", settings.TrayIcon);
+        reg.WriteBOOL(L"NativeSize", settings.NativeSize);
+        reg.WriteBOOL(L"ScaledBorderAndShadow", settings.ScaledBorderAndShadow);
+        reg.WriteBOOL(L"DisableFontLigatures", settings.DisableFontLigatures);
+        reg.WriteBOOL(L"DisableAutoLoad", settings.DisableAutoLoad);
+        reg.WriteBOOL(L"Kerning", settings.Kerning);
+        reg.WriteString(L"FontName", settings.FontName.c_str());
+        reg.WriteDWORD(L"FontSize", settings.FontSize);
+        reg.WriteDWORD(L"FontScaleX", settings.FontScaleX);
+        reg.WriteDWORD(L"FontScaleY", settings.FontScaleY);
+        reg.WriteDWORD(L"FontSpacing", settings.FontSpacing);
+        reg.WriteDWORD(L"FontBlur", settings.FontBlur);
+        reg.WriteDWORD(L"FontOutline", settings.FontOutline);
+        reg.WriteDWORD(L"FontShadow", settings.FontShadow);
+        reg.WriteDWORD(L"LineAlignment", settings.LineAlignment);
+        reg.WriteDWORD(L"MarginLeft", settings.MarginLeft);
+        reg.WriteDWORD(L"MarginRight", settings.MarginRight);
+        reg.WriteDWORD(L"MarginVertical", settings.MarginVertical);
+        reg.WriteDWORD(L"ColorPrimary", settings.ColorPrimary);
+        reg.WriteDWORD(L"ColorSecondary", settings.ColorSecondary);
+        reg.WriteDWORD(L"ColorOutline", settings.ColorOutline);
+        reg.WriteDWORD(L"ColorShadow", settings.ColorShadow);
+        reg.WriteDWORD(L"CustomRes", settings.CustomRes);
+        reg.WriteDWORD(L"SrtResX", settings.SrtResX);
+        reg.WriteDWORD(L"SrtResY", settings.SrtResY);
+        reg.WriteDWORD(L"TrackCacheSize", settings.TrackCacheSize);
+        reg.WriteDWORD(L"ExtTrackBudget", settings.ExtTrackBudget);
+        reg.WriteDWORD(L"RenderAheadBudget", settings.RenderAheadBudget);
+        reg.WriteDWORD(L"StateCacheSize", settings.StateCacheSize);
+        reg.WriteDWORD(L"ParallelRenderers", settings.ParallelRenderers);
+        reg.WriteDWORD(L"SchedulerWorkers", settings.SchedulerWorkers);
+        reg.WriteString(L"CustomTags", settings.CustomTags.c_str());
+        reg.WriteString(L"ExtraFontsDir", settings.ExtraFontsDir.c_str());
+        reg.WriteString(L"ExtraSubsDir", settings.ExtraSubsDir.c_str());
     }
 
     return S_OK;
@@ -979,6 +1991,7 @@ HRESULT AssFilter::ConnectToConsumer(IFilterGraph* pGraph)
                 LocalFree(cName);
 
                 DbgLog((LOG_TRACE, 1, L"AssFilter::ConnectToConsumer() -> Connected to consumer %s v%s", m_wsConsumerName.c_str(), m_wsConsumerVer.c_str()));
+                PublishStatus();
 
                 return S_OK;
             }
@@ -1006,19 +2019,74 @@ HRESULT AssFilter::LoadFonts(IPin* pPin)
                 if (wcscmp(mime.GetBSTR(), L"application/x-truetype-font") == 0 ||
                     wcscmp(mime.GetBSTR(), L"application/vnd.ms-opentype") == 0) // TODO: more mimes?
                 {
-                    ass_add_font(m_ass.get(), "", (char*)pData, len);
-                    // TODO: clear these fonts somewhere?
+                    // The copy of ResGet is only hashed, the store keeps one per process while
+                    // it's pending in a filter. libass copies the fonts it gets.
+                    auto font = m_fontStore->Add((const char*)pData, len);
+                    if (m_fontHashes.insert(font->hash).second)
+                    {
+                        // Without names it can't be matched with the track
+                        if (font->names.empty())
+                        {
+                            CAutoLock fontsLock(&m_csFonts);
+                            ass_add_font(m_ass.get(), "", const_cast<char*>(font->data.data()), (int)font->data.size());
+                        }
+                        else
+                            m_pendingFonts.push_back(font);
+                    }
                 }
                 CoTaskMemFree(pData);
             }
         }
     }
 
-    ass_set_fonts(m_renderer.get(), NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+    m_renderers->SetFonts();
 
     return S_OK;
 }
 
+// Gives libass the attached fonts named by the styles and \fn tags of the track, the others
+// are never copied into it. The tracks only grow between ResetEventSplit calls, the new
+// styles and events are scanned.
+void AssFilter::LoadReferencedFonts(const ASS_Track* track)
+{
+    if (m_pendingFonts.empty())
+        return;
+
+    if (track != m_fontTrack)
+    {
+        m_fontTrack = track;
+        m_fontStyles = m_fontEvents = 0;
+    }
+
+    if (!CFontStore::GetTrackNames(track, m_fontStyles, m_fontEvents, m_fontNames))
+        return;
+
+    size_t loaded = 0;
+    for (auto it = m_pendingFonts.begin(); it != m_pendingFonts.end();)
+    {
+        const CFontStore::s_font& font = **it;
+        if (CFontStore::IsReferenced(font, m_fontNames))
+        {
+            CAutoLock fontsLock(&m_csFonts);
+            ass_add_font(m_ass.get(), "", const_cast<char*>(font.data.data()), (int)font.data.size());
+            it = m_pendingFonts.erase(it);
+            ++loaded;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    // The renderers pick the fonts added to the library up at their next frame, the states
+    // kept may have been drawn with a fallback font
+    if (loaded)
+    {
+        DbgLog((LOG_TRACE, 1, L"AssFilter::LoadReferencedFonts() %Iu fonts loaded, %Iu not used", loaded, m_pendingFonts.size()));
+        m_stateCache.Clear();
+    }
+}
+
 HRESULT AssFilter::LoadExternalFile()
 {
     // Check for external subs
@@ -1044,167 +2112,47 @@ HRESULT AssFilter::LoadExternalFile()
     std::wstring mediaNameWithoutExt = extFileName.substr(0, extFileName.find_last_of(L'.') + 1);
 
     // Get all subtitle files matching the media file name in the same folder
-    std::vector<std::wstring> mediaDirSubFiles = FindMatchingSubs(mediaNameWithoutExt);
+    std::vector<s_ext_sub> mediaDirSubs = CSubDirIndex::FindMatchingSubs(mediaNameWithoutExt);
 
     // Get all subtitle files located in the extra folders
-    std::vector<std::wstring> extraDirSubFiles;
+    std::vector<s_ext_sub> extraDirSubs;
     std::vector<std::wstring> extraFolders;
-    std::wstring lcExtraSubsDir(m_settings.ExtraSubsDir);
-    std::transform(lcExtraSubsDir.begin(), lcExtraSubsDir.end(), lcExtraSubsDir.begin(), ::towlower);
-    tokenize(m_settings.ExtraSubsDir, extraFolders, std::wstring(L";"));
+    auto settings = GetSettings();
+    tokenize(settings->ExtraSubsDir, extraFolders, std::wstring(L";"));
 
     // Remove duplicates
     std::sort(extraFolders.begin(), extraFolders.end());
     extraFolders.erase(std::unique(extraFolders.begin(), extraFolders.end()), extraFolders.end());
     for (auto i = 0; i < extraFolders.size(); ++i)
     {
-        std::vector<std::wstring> possibleSubFiles;
         trim(extraFolders[i]);
         if (!extraFolders[i].empty() && extraFolders[i] != L".")
         {
             std::wstring extraSubsFolder(mediaNameWithoutExt.substr(0, mediaNameWithoutExt.find_last_of(L'\\') + 1) + extraFolders[i] + L"\\");
-            possibleSubFiles = FindMatchingSubs(extraSubsFolder);
+            std::vector<s_ext_sub> possibleSubs = CSubDirIndex::FindFolderSubs(extraSubsFolder);
+            extraDirSubs.insert(std::end(extraDirSubs), std::begin(possibleSubs), std::end(possibleSubs));
         }
-        if (!possibleSubFiles.empty())
-            extraDirSubFiles.insert(std::end(extraDirSubFiles), std::begin(possibleSubFiles), std::end(possibleSubFiles));
     }
 
     // Try to find an external subtitle file
     DbgLog((LOG_TRACE, 1, L"AssFilter::LoadExternalFile() -> System CodePage is %u", GetACP()));
-    if (!mediaDirSubFiles.empty() || !extraDirSubFiles.empty())
+    if (!mediaDirSubs.empty() || !extraDirSubs.empty())
     {
-        // Work with lowercase for the compares
-        std::wstring lcName(mediaNameWithoutExt);
-        std::transform(lcName.begin(), lcName.end(), lcName.begin(), ::towlower);
-        for (auto j = 0; j < mediaDirSubFiles.size(); ++j)
-        {
-            bool bSubFound = false;
-            std::wstring lcSubFile(mediaDirSubFiles[j]);
-            std::transform(lcSubFile.begin(), lcSubFile.end(), lcSubFile.begin(), ::towlower);
-            for (auto i = 0; i < _countof(iso639_lang); ++i)
-            {
-                if (std::wstring(lcName).append(iso639_lang[i].lang2).append(L".ass") == lcSubFile)
-                {
-                    s_ext_sub extSub;
-                    extSub.subFile = mediaDirSubFiles[j];
-                    extSub.subLang.assign(iso639_lang[i].language);
-                    extSub.subType.assign(L"ASS");
-                    extSub.yuvMatrix.assign(L"None");
-                    extSub.vecPos = SIZE_MAX;       // uninitialized
-                    m_ExtSubFiles.push_back(extSub);
-                    bSubFound = true;
-                    break;
-                }
-                else if (std::wstring(lcName).append(iso639_lang[i].lang2).append(L".srt") == lcSubFile)
-                {
-                    s_ext_sub extSub;
-                    extSub.subFile = mediaDirSubFiles[j];
-                    extSub.subLang.assign(iso639_lang[i].language);
-                    extSub.codePage = iso639_lang[i].codepage;
-                    extSub.subType.assign(L"SRT");
-                    extSub.yuvMatrix.assign(L"None");
-                    extSub.vecPos = SIZE_MAX;       // uninitialized
-                    m_ExtSubFiles.push_back(extSub);
-                    bSubFound = true;
-                    break;
-                }
-                // Try a filename without a 2 letters language code
-                if (i == _countof(iso639_lang) - 1)
-                {
-                    if (std::wstring(lcName).append(L"ass") == lcSubFile)
-                    {
-                        s_ext_sub extSub;
-                        extSub.subFile = mediaDirSubFiles[j];
-                        extSub.subLang.assign(MatchLanguage(std::wstring(L"und")));
-                        extSub.subType.assign(L"ASS");
-                        extSub.yuvMatrix.assign(L"None");
-                        extSub.vecPos = SIZE_MAX;   // uninitialized
-                        m_ExtSubFiles.push_back(extSub);
-                        bSubFound = true;
-                    }
-                    else if (std::wstring(lcName).append(L"srt") == lcSubFile)
-                    {
-                        s_ext_sub extSub;
-                        extSub.subFile = mediaDirSubFiles[j];
-                        extSub.subLang.assign(MatchLanguage(std::wstring(L"und")));
-                        extSub.subType.assign(L"SRT");
-                        extSub.yuvMatrix.assign(L"None");
-                        extSub.codePage = GetACP();
-                        extSub.vecPos = SIZE_MAX;   // uninitialized
-                        m_ExtSubFiles.push_back(extSub);
-                        bSubFound = true;
-                    }
-                }
-            }
-            // Subtitle not matching any language
-            if (!bSubFound)
-            {
-                if (EndsWith(lcSubFile, std::wstring(L".ass")))
-                {
-                    s_ext_sub extSub;
-                    extSub.subAltName = mediaDirSubFiles[j].substr(mediaNameWithoutExt.size(), mediaDirSubFiles[j].size() - mediaNameWithoutExt.size() - 4);
-                    extSub.subFile = mediaDirSubFiles[j];
-                    extSub.subLang.assign(MatchLanguage(std::wstring(L"und")));
-                    extSub.subType.assign(L"ASS");
-                    extSub.yuvMatrix.assign(L"None");
-                    extSub.vecPos = SIZE_MAX;   // uninitialized
-                    m_ExtSubFiles.push_back(extSub);
-                }
-                else
-                {
-                    s_ext_sub extSub;
-                    extSub.subAltName = mediaDirSubFiles[j].substr(mediaNameWithoutExt.size(), mediaDirSubFiles[j].size() - mediaNameWithoutExt.size() - 4);
-                    extSub.subFile = mediaDirSubFiles[j];
-                    extSub.subLang.assign(MatchLanguage(std::wstring(L"und")));
-                    extSub.subType.assign(L"SRT");
-                    extSub.yuvMatrix.assign(L"None");
-                    extSub.codePage = GetACP();
-                    extSub.vecPos = SIZE_MAX;   // uninitialized
-                    m_ExtSubFiles.push_back(extSub);
-                }
-            }
-        }
+        m_ExtSubFiles.insert(std::end(m_ExtSubFiles), std::begin(mediaDirSubs), std::end(mediaDirSubs));
+        m_ExtSubFiles.insert(std::end(m_ExtSubFiles), std::begin(extraDirSubs), std::end(extraDirSubs));
 
-        // Check external subtitles folders
-        for (auto j = 0; j < extraDirSubFiles.size(); ++j)
-        {
-            // Work with lowercase for the compares
-            std::wstring lcName(extraDirSubFiles[j]);
-            std::transform(lcName.begin(), lcName.end(), lcName.begin(), ::towlower);
-            if (EndsWith(lcName, std::wstring(L".ass")))
-            {
-                s_ext_sub extSub;
-                extSub.subAltName = extraDirSubFiles[j].substr(extraDirSubFiles[j].find_last_of(L'\\') + 1, extraDirSubFiles[j].size() - extraDirSubFiles[j].find_last_of(L'\\') - 5);
-                extSub.subFile = extraDirSubFiles[j];
-                extSub.subLang.assign(MatchLanguage(std::wstring(L"und")));
-                extSub.subType.assign(L"ASS");
-                extSub.yuvMatrix.assign(L"None");
-                extSub.vecPos = SIZE_MAX;   // uninitialized
-                m_ExtSubFiles.push_back(extSub);
-            }
-            else
-            {
-                s_ext_sub extSub;
-                extSub.subAltName = extraDirSubFiles[j].substr(extraDirSubFiles[j].find_last_of(L'\\') + 1, extraDirSubFiles[j].size() - extraDirSubFiles[j].find_last_of(L'\\') - 5);
-                extSub.subFile = extraDirSubFiles[j];
-                extSub.subLang.assign(MatchLanguage(std::wstring(L"und")));
-                extSub.subType.assign(L"SRT");
-                extSub.yuvMatrix.assign(L"None");
-                extSub.codePage = GetACP();
-                extSub.vecPos = SIZE_MAX;   // uninitialized
-                m_ExtSubFiles.push_back(extSub);
-            }
-        }
         // Install the fonts
         m_pFontInstaller = std::make_unique<CFontInstaller>();
-        std::vector<std::wstring> fonts = ListFontsInFolder(ParseFontsPath(m_settings.ExtraFontsDir, mediaNameWithoutExt));
+        std::vector<std::wstring> fonts = ListFontsInFolder(ParseFontsPath(settings->ExtraFontsDir, mediaNameWithoutExt));
         for (const auto& font : fonts)
             m_pFontInstaller->InstallFont(font);
 
-        ass_set_fonts_dir(m_ass.get(), ws2s(ParseFontsPath(m_settings.ExtraFontsDir, mediaNameWithoutExt)).c_str());
+        ass_set_fonts_dir(m_ass.get(), ws2s(ParseFontsPath(settings->ExtraFontsDir, mediaNameWithoutExt)).c_str());
         ass_set_extract_fonts(m_ass.get(), TRUE);
         SetCurExternalSub(m_iCurExtSubTrack);
-        ass_set_fonts(m_renderer.get(), NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+
+        // The installed fonts and the fonts dir are only read by a new font setup
+        m_renderers->SetFonts(true);
     }
     else
         return E_FAIL;
@@ -1217,11 +2165,6 @@ void AssFilter::ASS_LibraryDeleter::operator()(ASS_Library* p)
     if (p) ass_library_done(p);
 }
 
-void AssFilter::ASS_RendererDeleter::operator()(ASS_Renderer* p)
-{
-    if (p) ass_renderer_done(p);
-}
-
 void AssFilter::ASS_TrackDeleter::operator()(ASS_Track* p)
 {
     if (p) ass_free_track(p);
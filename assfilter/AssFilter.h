@@ -20,10 +20,24 @@
 #include <ass.h>
 #include "AssFilterSettings.h"
 #include "AssFilterTrayIcon.h"
+#include "EventSplit.h"
 #include "ExtSubStruct.h"
+#include "FileWatcher.h"
 #include "FontInstaller.h"
+#include "FontStore.h"
+#include "FrameCache.h"
+#include "LiveCaptions.h"
+#include "RendererPool.h"
+#include "RenderGovernor.h"
+#include "StateCache.h"
 #include "ISpecifyPropertyPages2.h"
+#include "ParallelRenderer.h"
+#include "SubRenderOptions.h"
+#include "TaskScheduler.h"
 #include "Tools.h"
+#include "TrackCache.h"
+#include "TrackPatcher.h"
+#include "TrickPlay.h"
 
 class AssPin;
 
@@ -84,8 +98,10 @@ public:
     STDMETHODIMP CreatePage(const GUID& guid, IPropertyPage** ppPage) override;
 
     // IAssFilterSettings
-    STDMETHODIMP GetTrackInfo(const WCHAR **pTrackName, const WCHAR **pTrackLang, const WCHAR **pSubType) override;
-    STDMETHODIMP GetConsumerInfo(const WCHAR **pName, const WCHAR **pVersion) override;
+    STDMETHODIMP GetTrackInfo(LPWSTR *pTrackName, LPWSTR *pTrackLang, LPWSTR *pSubType) override;
+    STDMETHODIMP GetConsumerInfo(LPWSTR *pName, LPWSTR *pVersion) override;
+    STDMETHODIMP ReloadSettings() override;
+    STDMETHODIMP GetRenderStats(AssFRenderStats *pStats) override;
 
     // IAFMExtSubtitles
     STDMETHODIMP_(int) GetTotalExternalSubs();
@@ -99,45 +115,142 @@ private:
         void operator()(ASS_Library* p);
     };
 
-    struct ASS_RendererDeleter
+    struct ASS_TrackDeleter
     {
-        void operator()(ASS_Renderer* p);
+        void operator()(ASS_Track* p);
     };
 
-    struct ASS_TrackDeleter
+    // Status shown by the property pages
+    struct s_filter_status
     {
-        void operator()(ASS_Track* p);
+        std::wstring trackName;
+        std::wstring trackLang;
+        std::wstring subType;
+        std::wstring consumerName;
+        std::wstring consumerVer;
     };
 
-    HRESULT LoadDefaults();
-    HRESULT ReadSettings(HKEY rootKey);
+    static HRESULT LoadDefaults(AssFSettings& settings);
+    static HRESULT ReadSettings(HKEY rootKey, AssFSettings& settings);
     HRESULT LoadSettings();
-    HRESULT SaveSettings();
+    static HRESULT SaveSettings(const AssFSettings& settings);
+
+    // Snapshots are immutable once published, readers never take the filter lock
+    std::shared_ptr<const AssFSettings> GetSettings() const { return std::atomic_load(&m_settings); }
+    std::shared_ptr<const s_filter_status> GetStatus() const { return std::atomic_load(&m_status); }
+    void PublishStatus();
 
     STDMETHODIMP CreateTrayIcon();
 
     HRESULT ConnectToConsumer(IFilterGraph* pGraph);
     HRESULT LoadFonts(IPin* pPin);
+    void LoadReferencedFonts(const ASS_Track* track);
     HRESULT LoadExternalFile();
+    ASS_Track* LoadExternalTrack(s_ext_sub& extSub, std::string* pScript = nullptr);
+    static void ConvertExternalScript(s_ext_sub& extSub, const AssFSettings& settings, std::string& content, std::string& script);
+    static ASS_Track* ParseExternalScript(ASS_Library* library, bool bIsAss, std::string& script);
+    void EvictExternalTracks();
+    void FreeExternalTrack(s_ext_sub& extSub);
+    void UpdateSrtStyle();
+    void SetStringOption(SubRenderOption option, const std::wstring& value);
+    void WatchExternalFile(std::string& currentScript);
+    void ApplyPendingScript();
+    void ClearConsumerAsync(REFERENCE_TIME clearNewerThan);
+    void InvalidateFrames();
+    void InvalidateFrames(REFERENCE_TIME tStart, REFERENCE_TIME tStop);
+    void UpdateParallelGroups(const AssFSettings& settings);
+    void ResetEventSplit();
+    // Tags put in front of the events when they're rendered, the custom tags for SRT
+    const std::string& GetEventPrefix() const;
+    // Movable subtitles get an upper and a lower bitmap, they follow subtitleTargetRect apart
+    bool SplitBitmaps() const { return m_boolOptions[SRO_IS_MOVABLE] && !m_boolOptions[SRO_COMBINE_BITMAPS]; }
+    ISubRenderFramePtr RenderFrame(ASS_Renderer* renderer, RECT videoRect, long long now);
+    ISubRenderFramePtr RenderTrack(ASS_Renderer* renderer, CEventIndex& index, RECT videoRect, long long now);
+    void PreRenderFrames(const std::vector<int64_t>& frames);
+    bool PreRenderNext();
 
+    std::shared_ptr<CTaskScheduler> m_scheduler;    // Held so the shared workers outlive the frames
     std::unique_ptr<ASS_Library, ASS_LibraryDeleter> m_ass;
-    std::unique_ptr<ASS_Renderer, ASS_RendererDeleter> m_renderer;
+    std::unique_ptr<ASS_Library, ASS_LibraryDeleter> m_watchLibrary;    // Parses on the watcher thread, outlives the tracks
+    std::unique_ptr<CRendererPool> m_renderers;
     std::unique_ptr<ASS_Track, ASS_TrackDeleter> m_track;
+    std::unique_ptr<CEventSplit> m_eventSplit;  // Static and animated events of the current track
+    std::map<const ASS_Track*, std::unique_ptr<CParallelRenderer>> m_parallel;  // Layer groups of the heavy frames, by source track
+    size_t m_parallelGroups = 1;
 
     std::unique_ptr<AssPin> m_pin;
     ISubRenderConsumer2Ptr m_consumer;
     ULONGLONG m_consumerLastId = 0;
-    std::map<std::string, std::wstring> m_stringOptions;
-    std::map<std::string, bool> m_boolOptions;
+    CRenderGovernor m_governor;
+    CTrickPlay m_trickPlay;
+    ISubRenderFramePtr m_lastFrame;     // Delivered again when the governor repeats frames
+    ISubRenderFramePtr m_baseFrame;     // Last rendered frame, moved copies of it follow subtitleTargetRect
+    REFERENCE_TIME m_baseFrameStart = 0;
+    RECT m_baseFrameRect{};
+
+    // Static events, rendered again when the interval they're shown in ends
+    ISubRenderFramePtr m_staticFrame;
+    long long m_staticBegin = 0;
+    long long m_staticEnd = 0;
+    RECT m_staticRect{};
+    std::atomic<ULONGLONG> m_framesStaticCached{0};
+
+    // Trick play, the frame is delivered again while the same events are shown
+    ISubRenderFramePtr m_trickFrame;
+    long long m_trickBegin = 0;
+    long long m_trickEnd = 0;
+    RECT m_trickRect{};
+
+    // Tasks of the scheduler reach the filter through the guard
+    struct s_prerender_guard
+    {
+        CCritSec cs;
+        AssFilter* filter;              // Null once the filter is destroyed
+        CRendererPool::RendererPtr renderer;    // Renders ahead without the filter lock
+        unsigned fontSetup = 0;         // Of the pool when the renderer was made
+    };
+    std::shared_ptr<s_prerender_guard> m_preRenderGuard;
+    CCritSec m_csFonts;                 // Held around ass_add_font and the renders made without the filter lock
+
+    // Low latency mode, frames rendered ahead of the requests that follow a Clear
+    std::deque<REFERENCE_TIME> m_preRenderQueue;
+    CFrameCache m_renderAhead;          // Encoded, within the RenderAheadBudget setting
+    RECT m_preRenderRect{};
+    bool m_bPreRendering = false;       // A task of the scheduler renders the queue
+    ULONGLONG m_framesGeneration = 0;   // Counts the invalidations, a frame rendered ahead across one is dropped
+    CLiveCaptions m_liveCaptions;
+
+    // Frames by the events shown and the local times of the animated ones, within the StateCacheSize setting
+    CStateCache m_stateCache;
+    std::vector<long long> m_stateKey;
+
+    // Frame of the last ass_render_frame call, kept while libass reports no change
+    ISubRenderFramePtr m_prevRenderFrame;
+    ASS_Renderer* m_prevRenderer = nullptr;
+    ASS_Track* m_prevTrack = nullptr;
+    size_t m_prevGroups = 0;            // Renderers used in parallel, 0 for a single one
+
+    // Window resizing
+    RECT m_renderRect{};                // Rect the frames are rendered for
+    SIZE m_pendingSize{};               // Requested size while it isn't stable
+    ULONGLONG m_pendingSince = 0;       // Tick count of the last change of m_pendingSize
+    CCritSec m_csOptions;
+    std::wstring m_stringOptions[SRO_COUNT];    // ISubRenderOptions values by SubRenderOption
+    std::atomic<bool> m_boolOptions[SRO_COUNT] = {};  // Read and written by the consumer without the filter lock
+    std::atomic<double> m_playbackRate{0.0};    // playbackRate field, set from the thread of the consumer
 
-    // Settings
-    AssFSettings    m_settings;
+    // Settings and status, swapped whole by LoadSettings and PublishStatus
+    std::shared_ptr<const AssFSettings> m_settings;
+    std::shared_ptr<const s_filter_status> m_status;
 
     bool            m_bSrtHeaderDone;   // Is the private codec data already sent?
+    std::string     m_srtCustomTags;    // Custom tags of the settings in UTF-8, see GetEventPrefix
+    std::shared_ptr<const AssFSettings> m_srtSettings;  // Settings on the style of the current SRT track
     bool            m_bNotFirstPause;   // Is it the first graph pause?
     bool            m_bNoExtFile;       // External file exists?
     bool            m_bExternalFile;    // True when there is an external sub available
     bool            m_bUnsupportedSub;  // Sub is not supported
+    // The members below are only used under the filter lock, PublishStatus copies them for the readers
     std::wstring    m_wsTrackName;      // Subtitle track name.
     std::wstring    m_wsTrackLang;      // Subtitle track language.
     std::wstring    m_wsSubType;        // Subtitle track type (ASS or SRT)
@@ -159,8 +272,35 @@ private:
 
     int m_iCurExtSubTrack;
     std::vector<std::unique_ptr<ASS_Track, ASS_TrackDeleter>> m_extSubTrack;
+    std::vector<size_t> m_freeExtSubSlots;  // Slots of m_extSubTrack freed by eviction
+    std::list<int> m_extSubLru;             // Loaded external subs, most recently used first
     std::vector<s_ext_sub> m_ExtSubFiles;
     std::unique_ptr<CAssFilterTrayIcon> m_pTrayIcon;
 
     std::unique_ptr<CFontInstaller> m_pFontInstaller;
+
+    // Fonts attached to the container, libass gets them once a track uses their names
+    std::shared_ptr<CFontStore> m_fontStore;
+    std::vector<std::shared_ptr<const CFontStore::s_font>> m_pendingFonts;     // Not given to libass yet, shared with other filters
+    std::set<uint64_t> m_fontHashes;    // Hashes of the attached fonts given to libass or pending
+    std::set<std::string> m_fontNames;  // Names used by the styles and \fn tags
+    const ASS_Track* m_fontTrack = nullptr;
+    int m_fontStyles = 0;               // Styles and events of m_fontTrack already scanned
+    int m_fontEvents = 0;
+    std::unique_ptr<CTrackCache> m_pTrackCache;
+
+    // Changes of the current external file, the watcher thread patches its own copy of the track
+    // and hands a new one to RequestFrame
+    struct s_watch_state
+    {
+        std::string script;             // Script of the current track, parsed on the first change
+        std::unique_ptr<ASS_Track, ASS_TrackDeleter> track;
+        std::unique_ptr<CTrackPatcher> patcher;
+    };
+    CCritSec m_csPendingScript;
+    std::unique_ptr<ASS_Track, ASS_TrackDeleter> m_pendingTrack;   // Built by the watcher, not applied yet
+    long long m_pendingChange = 0;      // Start time in ms of the first changed event
+    std::string m_pendingScript;        // Reloaded script with embedded fonts, parsed by RequestFrame
+    bool m_bPendingScript;
+    std::unique_ptr<CFileWatcher> m_pFileWatcher;
 };
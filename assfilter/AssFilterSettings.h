@@ -46,6 +46,12 @@ struct AssFSettings
     DWORD CustomRes;
     DWORD SrtResX;
     DWORD SrtResY;
+    DWORD TrackCacheSize;       // MB, 0 disables the track cache
+    DWORD ExtTrackBudget;       // MB of loaded external tracks, 0 keeps only the current one
+    DWORD RenderAheadBudget;    // MB of encoded frames rendered ahead, 0 disables rendering ahead
+    DWORD StateCacheSize;       // MB of frames kept by the events shown, 0 disables the state cache
+    DWORD ParallelRenderers;    // Renderers of a frame with many events, 1 renders it on one renderer
+    DWORD SchedulerWorkers;     // Threads of the task scheduler, 0 uses all the processors but one. Read when a filter is created
 
     std::wstring CustomTags;
     std::wstring ExtraFontsDir;
@@ -53,12 +59,47 @@ struct AssFSettings
 };
 
 // AssFilter Settings Interface
-interface __declspec(uuid("2E277FB7-75C0-453C-A1ED-A6B6FD6F4728"))
+// Render governor state shown by the status page
+struct AssFRenderStats
+{
+    DWORD Level;                // 0 is full quality
+    LPCWSTR LevelName;          // Static string
+    double RenderTime;          // Average render time, ms
+    double FrameBudget;         // Render time allowed per frame, ms, 0 when the frame rate is unknown
+    ULONGLONG FramesRendered;
+    ULONGLONG FramesDegraded;   // Rendered below full quality
+    ULONGLONG FramesRepeated;   // Previous frame delivered again
+    ULONGLONG FramesStaticCached;   // Static events taken from the cache instead of rendered
+    ULONGLONG LevelDowns;
+    ULONGLONG LevelUps;
+    ULONGLONG LateLines;        // Live lines received after their frames were requested
+    ULONGLONG LateLinesShown;
+    double LineLatency;         // Average time from the arrival of a late line to its first frame, ms
+    double LineLatencyMax;
+    ULONGLONG AheadFrames;      // Frames rendered ahead, held now
+    ULONGLONG AheadBytes;       // Encoded size of those frames
+    ULONGLONG AheadBudget;
+    double AheadRatio;          // Size of the pixels over the encoded size, 0 before the first frame
+    double AheadDecodeTime;     // Average time to expand a frame, ms
+    ULONGLONG StateLookups;     // Since the filter was created
+    ULONGLONG StateHits;        // Frames taken from the state cache instead of rendered
+    ULONGLONG StateFrames;      // Held now
+    ULONGLONG StateBytes;
+};
+
+// The strings are copies allocated with LocalAlloc, free them with LocalFree
+interface __declspec(uuid("5B0C7E61-3A4F-4D8E-9C2B-7F1A6E3D9B40"))
 IAssFilterSettings : public IUnknown
 {
     // Get the current subtitle track name and language
-    STDMETHOD(GetTrackInfo)(LPCWSTR *pTrackName, LPCWSTR *pTrackLang, LPCWSTR *pSubType) = 0;
+    STDMETHOD(GetTrackInfo)(LPWSTR *pTrackName, LPWSTR *pTrackLang, LPWSTR *pSubType) = 0;
 
     // Get info from the consumer
-    STDMETHOD(GetConsumerInfo)(LPCWSTR *pName, LPCWSTR *pVersion) = 0;
+    STDMETHOD(GetConsumerInfo)(LPWSTR *pName, LPWSTR *pVersion) = 0;
+
+    // Read the settings saved by the property pages, the next frames use them
+    STDMETHOD(ReloadSettings)() = 0;
+
+    // Get the state of the render governor, never waits on the rendering
+    STDMETHOD(GetRenderStats)(AssFRenderStats *pStats) = 0;
 };
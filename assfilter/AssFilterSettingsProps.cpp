@@ -317,7 +317,11 @@ HRESULT CAssFilterSettingsProp::OnApplyChanges(void)
     SendDlgItemMessage(m_Dlg, IDC_CUSTOM_TAGS, WM_GETTEXT, 1024, (LPARAM)&wsCustomBuffer);
     m_settings.CustomTags.assign(wsCustomBuffer);
 
-    return SaveSettings();
+    hr = SaveSettings();
+    if (SUCCEEDED(hr))
+        m_pAssFilterSettings->ReloadSettings();
+
+    return hr;
 }
 
 HRESULT CAssFilterSettingsProp::LoadSettings()
@@ -1099,9 +1103,9 @@ HRESULT CAssFilterStatusProp::OnActivate(void)
 
     ASSERT(m_pAssFilterSettings != nullptr);
 
-    const WCHAR *trackname = nullptr;
-    const WCHAR *tracklang = nullptr;
-    const WCHAR *subtype = nullptr;
+    LPWSTR trackname = nullptr;
+    LPWSTR tracklang = nullptr;
+    LPWSTR subtype = nullptr;
 
     hr = m_pAssFilterSettings->GetTrackInfo(&trackname, &tracklang, &subtype);
     if (SUCCEEDED(hr))
@@ -1110,9 +1114,12 @@ HRESULT CAssFilterStatusProp::OnActivate(void)
         SendDlgItemMessage(m_Dlg, IDC_TRACK_LANG, WM_SETTEXT, 0, (LPARAM)tracklang);
         SendDlgItemMessage(m_Dlg, IDC_TRACK_TYPE, WM_SETTEXT, 0, (LPARAM)subtype);
     }
+    LocalFree(trackname);
+    LocalFree(tracklang);
+    LocalFree(subtype);
 
-    const WCHAR *consumername = nullptr;
-    const WCHAR *consumerversion = nullptr;
+    LPWSTR consumername = nullptr;
+    LPWSTR consumerversion = nullptr;
 
     hr = m_pAssFilterSettings->GetConsumerInfo(&consumername, &consumerversion);
     if (SUCCEEDED(hr))
@@ -1120,10 +1127,69 @@ HRESULT CAssFilterStatusProp::OnActivate(void)
         SendDlgItemMessage(m_Dlg, IDC_CONSUMER_NAME, WM_SETTEXT, 0, (LPARAM)consumername);
         SendDlgItemMessage(m_Dlg, IDC_CONSUMER_VER, WM_SETTEXT, 0, (LPARAM)consumerversion);
     }
+    LocalFree(consumername);
+    LocalFree(consumerversion);
+
+    // The render stats change while playing
+    UpdateRenderStats();
+    SetTimer(m_Dlg, 1, 500, nullptr);
 
     return hr;
 }
 
+HRESULT CAssFilterStatusProp::OnDeactivate(void)
+{
+    KillTimer(m_Dlg, 1);
+
+    return __super::OnDeactivate();
+}
+
+void CAssFilterStatusProp::UpdateRenderStats()
+{
+    AssFRenderStats stats;
+    if (FAILED(m_pAssFilterSettings->GetRenderStats(&stats)))
+        return;
+
+    WCHAR buffer[128];
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_LEVEL, WM_SETTEXT, 0, (LPARAM)stats.LevelName);
+
+    if (stats.FrameBudget > 0)
+        swprintf_s(buffer, L"%.1f ms of %.1f ms", stats.RenderTime, stats.FrameBudget);
+    else
+        swprintf_s(buffer, L"Unknown frame rate");
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_TIME, WM_SETTEXT, 0, (LPARAM)buffer);
+
+    swprintf_s(buffer, L"%I64u rendered, %I64u reduced, %I64u repeated", stats.FramesRendered, stats.FramesDegraded,
+        stats.FramesRepeated);
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_FRAMES, WM_SETTEXT, 0, (LPARAM)buffer);
+
+    swprintf_s(buffer, L"%I64u down, %I64u up", stats.LevelDowns, stats.LevelUps);
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_CHANGES, WM_SETTEXT, 0, (LPARAM)buffer);
+
+    swprintf_s(buffer, L"%.0f%% of the frames", stats.FramesRendered ?
+        100.0 * stats.FramesStaticCached / stats.FramesRendered : 0.0);
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_STATIC, WM_SETTEXT, 0, (LPARAM)buffer);
+
+    if (stats.LateLinesShown)
+        swprintf_s(buffer, L"%.0f ms, %.0f ms max, %I64u of %I64u lines", stats.LineLatency, stats.LineLatencyMax,
+            stats.LateLinesShown, stats.LateLines);
+    else
+        swprintf_s(buffer, L"No late lines");
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_LATENCY, WM_SETTEXT, 0, (LPARAM)buffer);
+
+    if (stats.AheadRatio > 0)
+        swprintf_s(buffer, L"%I64u frames, %.1f of %I64u MB, %.1f:1, %.2f ms decode", stats.AheadFrames,
+            stats.AheadBytes / 1048576.0, stats.AheadBudget / 1048576, stats.AheadRatio, stats.AheadDecodeTime);
+    else
+        swprintf_s(buffer, L"No frames rendered ahead");
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_AHEAD, WM_SETTEXT, 0, (LPARAM)buffer);
+
+    swprintf_s(buffer, L"%.0f%% of %I64u frames, %I64u held, %.1f MB", stats.StateLookups ?
+        100.0 * stats.StateHits / stats.StateLookups : 0.0, stats.StateLookups, stats.StateFrames,
+        stats.StateBytes / 1048576.0);
+    SendDlgItemMessage(m_Dlg, IDC_RENDER_STATE, WM_SETTEXT, 0, (LPARAM)buffer);
+}
+
 HRESULT CAssFilterStatusProp::OnApplyChanges(void)
 {
     ASSERT(m_pAssFilterSettings != nullptr);
@@ -1135,6 +1201,12 @@ HRESULT CAssFilterStatusProp::OnApplyChanges(void)
 INT_PTR CAssFilterStatusProp::OnReceiveMessage(HWND hwnd,
     UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
+    if (uMsg == WM_TIMER)
+    {
+        UpdateRenderStats();
+        return TRUE;
+    }
+
       // Let the parent class handle the message.
     return __super::OnReceiveMessage(hwnd, uMsg, wParam, lParam);
 }
@@ -1324,7 +1396,11 @@ HRESULT CAssFilterGeneralProp::OnApplyChanges(void)
     SendDlgItemMessage(m_Dlg, IDC_SUBS_FOLDER, WM_GETTEXT, 1024, (LPARAM)&wsCustomBuffer);
     m_settings.ExtraSubsDir.assign(wsCustomBuffer);
 
-    return SaveSettings();
+    hr = SaveSettings();
+    if (SUCCEEDED(hr))
+        m_pAssFilterSettings->ReloadSettings();
+
+    return hr;
 }
 
 HRESULT CAssFilterGeneralProp::LoadSettings()
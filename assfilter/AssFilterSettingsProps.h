@@ -74,6 +74,8 @@ private:
         }
     }
 
+    void UpdateRenderStats();
+
 public:
     CAssFilterStatusProp(LPUNKNOWN pUnk, HRESULT *phr);
     ~CAssFilterStatusProp();
@@ -83,6 +85,7 @@ public:
     HRESULT OnConnect(IUnknown *pUnk) override;
     HRESULT OnDisconnect(void) override;
     HRESULT OnActivate(void) override;
+    HRESULT OnDeactivate(void) override;
     HRESULT OnApplyChanges(void) override;
     INT_PTR OnReceiveMessage(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) override;
 
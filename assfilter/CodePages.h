@@ -0,0 +1,35 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Table driven conversion of the single byte Windows code pages to UTF-8.
+// Doesn't depend on Windows headers so it can be built and checked anywhere.
+
+#include <cstddef>
+#include <string>
+
+// True when the code page has a built-in table (874 and 1250 to 1257)
+bool IsTableCodePage(unsigned int codePage);
+
+// Unicode code point of a byte in a table code page
+unsigned int CodePageToUnicode(unsigned int codePage, unsigned char byte);
+
+// Convert a whole buffer in one pass, returns false when the code page has no table.
+// Bytes undefined in the code page map to the same private use or C1 code points as
+// MultiByteToWideChar, so the output matches the Windows conversion.
+bool ConvertTableCodePageToUTF8(unsigned int codePage, const char* data, size_t size, std::string& out);
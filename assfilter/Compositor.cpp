@@ -0,0 +1,85 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+
+#include "Compositor.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+// Rows blended by a task, small glyphs share a band instead of making a task each
+#define COMPOSITE_BAND_ROWS 16
+
+namespace
+{
+    void BlendRows(const ASS_Image* i, int firstRow, int lastRow, int left, int top, int width, uint32_t* pixels)
+    {
+        for (int y = firstRow; y < lastRow; ++y)
+        {
+            uint32_t* row = pixels + (i->dst_y + y - top) * width + (i->dst_x - left);
+            const unsigned char* src = i->bitmap + y * i->stride;
+
+            for (int x = 0; x < i->w; ++x)
+            {
+                uint32_t& dest = row[x];
+
+                uint32_t destA = (dest & 0xff000000) >> 24;
+
+                uint32_t srcA = src[x] * (0xff - (i->color & 0x000000ff));
+                srcA >>= 8;
+
+                uint32_t compA = 0xff - srcA;
+
+                uint32_t outA = srcA + ((destA * compA) >> 8);
+
+                uint32_t outR = ((i->color & 0xff000000) >> 8) * srcA + (dest & 0x00ff0000) * compA;
+                outR >>= 8;
+
+                uint32_t outG = ((i->color & 0x00ff0000) >> 8) * srcA + (dest & 0x0000ff00) * compA;
+                outG >>= 8;
+
+                uint32_t outB = ((i->color & 0x0000ff00) >> 8) * srcA + (dest & 0x000000ff) * compA;
+                outB >>= 8;
+
+                dest = (outA << 24) + (outR & 0x00ff0000) + (outG & 0x0000ff00) + (outB & 0x000000ff);
+            }
+        }
+    }
+}
+
+void CompositeImages(const ASS_Image* const* images, size_t count, int left, int top, int width, int height,
+                     uint32_t* pixels, CTaskScheduler& scheduler)
+{
+    int bands = (height + COMPOSITE_BAND_ROWS - 1) / COMPOSITE_BAND_ROWS;
+
+    scheduler.ParallelFor(0, bands, 1, [&](int band)
+    {
+        int bandTop = top + band * COMPOSITE_BAND_ROWS;
+        int bandBottom = (std::min)(bandTop + COMPOSITE_BAND_ROWS, top + height);
+
+        for (size_t n = 0; n < count; ++n)
+        {
+            const ASS_Image* i = images[n];
+            int firstRow = (std::max)(bandTop, i->dst_y) - i->dst_y;
+            int lastRow = (std::min)(bandBottom, i->dst_y + i->h) - i->dst_y;
+            if (firstRow < lastRow)
+                BlendRows(i, firstRow, lastRow, left, top, width, pixels);
+        }
+    });
+}
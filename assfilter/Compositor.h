@@ -0,0 +1,35 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Blending of the libass images into the bitmaps handed to the consumer.
+// Doesn't depend on Windows headers.
+
+#include <ass.h>
+#include <cstddef>
+#include <cstdint>
+
+class CTaskScheduler;
+
+// Blends the images in order into pixels, a cleared premultiplied ARGB bitmap covering
+// width x height pixels of the frame from left, top. The images must lie inside it.
+// Bands of rows are blended in parallel, each with all the images crossing it, so the
+// result is the same as blending the images one after the other.
+void CompositeImages(const ASS_Image* const* images, size_t count, int left, int top, int width, int height,
+                     uint32_t* pixels, CTaskScheduler& scheduler);
@@ -0,0 +1,56 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "stdafx.h"
+#include "DebugBenchmark.h"
+
+#ifdef DEBUG
+
+CBenchmarkTimer::CBenchmarkTimer()
+{
+    QueryPerformanceFrequency(&m_freq);
+    Start();
+}
+
+void CBenchmarkTimer::Start()
+{
+    QueryPerformanceCounter(&m_start);
+}
+
+double CBenchmarkTimer::ElapsedMs() const
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    return (now.QuadPart - m_start.QuadPart) * 1000.0 / m_freq.QuadPart;
+}
+
+void ReportBenchmark(HWND hwnd, const wchar_t* name, const std::wstring& result)
+{
+    DbgLog((LOG_TRACE, 1, L"%s() %s", name, result.c_str()));
+    MessageBoxW(hwnd, result.c_str(), L"AssFilterMod", MB_OK);
+}
+
+void ReportBenchmark(HWND hwnd, const wchar_t* name, std::wstring result, const wchar_t* check, bool bSame)
+{
+    result.append(check).append(L": ").append(bSame ? L"identical" : L"DIFFERENT");
+    ReportBenchmark(hwnd, name, result);
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#pragma once
+
+// Benchmarks and checks of the debug builds, exported for rundll32:
+//     rundll32 AssFilterMod.dll,BenchmarkName [arguments]
+// Each one lives next to the code it measures, declared with DEBUG_BENCHMARK. The result is
+// written to the debug log and shown in a message box.
+
+#ifdef DEBUG
+
+#include <string>
+
+// Undecorated export of the 32-bit stdcall name, rundll32 looks for the plain name
+#ifdef _WIN64
+#define DEBUG_BENCHMARK_EXPORT(name) __pragma(comment(linker, "/EXPORT:" #name))
+#else
+#define DEBUG_BENCHMARK_EXPORT(name) __pragma(comment(linker, "/EXPORT:" #name "=_" #name "@16"))
+#endif
+
+#define DEBUG_BENCHMARK(name) \
+    DEBUG_BENCHMARK_EXPORT(name) \
+    extern "C" void CALLBACK name(HWND hwnd, HINSTANCE hinst, LPSTR lpszCmdLine, int nCmdShow)
+
+// QueryPerformanceCounter stopwatch, started when made
+class CBenchmarkTimer
+{
+public:
+
+    CBenchmarkTimer();
+
+    void Start();
+    // Time since the last Start
+    double ElapsedMs() const;
+
+private:
+
+    LARGE_INTEGER m_freq;
+    LARGE_INTEGER m_start;
+};
+
+// Logs the result and shows it, the check line ends with "identical" or "DIFFERENT"
+void ReportBenchmark(HWND hwnd, const wchar_t* name, const std::wstring& result);
+void ReportBenchmark(HWND hwnd, const wchar_t* name, std::wstring result, const wchar_t* check, bool bSame);
+
+#endif
@@ -0,0 +1,429 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "stdafx.h"
+#include "EventIndex.h"
+#include "DebugBenchmark.h"
+#include "EventSplit.h"
+#include "Tools.h"
+
+namespace
+{
+    inline ULONGLONG HashString(const char* str, ULONGLONG seed)
+    {
+        // The terminator keeps "ab","c" apart from "a","bc"
+        return str ? HashFNV1a(str, strlen(str) + 1, seed) : HashFNV1a("", 1, seed);
+    }
+
+    template <typename T>
+    inline ULONGLONG HashValue(T value, ULONGLONG seed)
+    {
+        return HashFNV1a(&value, sizeof(value), seed);
+    }
+
+    // The script info libass lays the events out with
+    ULONGLONG HashHeader(const ASS_Track& track)
+    {
+        ULONGLONG hash = HashValue(track.track_type, 14695981039346656037ULL);
+        hash = HashValue(track.PlayResX, hash);
+        hash = HashValue(track.PlayResY, hash);
+        hash = HashValue(track.Timer, hash);
+        hash = HashValue(track.WrapStyle, hash);
+        hash = HashValue(track.ScaledBorderAndShadow, hash);
+        return HashValue(track.Kerning, hash);
+    }
+
+    // Field by field, the padding of the struct isn't copied with it
+    ULONGLONG HashStyle(const ASS_Style& style, ULONGLONG seed)
+    {
+        ULONGLONG hash = HashString(style.FontName, seed);
+        hash = HashValue(style.FontSize, hash);
+        hash = HashValue(style.PrimaryColour, hash);
+        hash = HashValue(style.SecondaryColour, hash);
+        hash = HashValue(style.OutlineColour, hash);
+        hash = HashValue(style.BackColour, hash);
+        hash = HashValue(style.Bold, hash);
+        hash = HashValue(style.Italic, hash);
+        hash = HashValue(style.Underline, hash);
+        hash = HashValue(style.StrikeOut, hash);
+        hash = HashValue(style.ScaleX, hash);
+        hash = HashValue(style.ScaleY, hash);
+        hash = HashValue(style.Spacing, hash);
+        hash = HashValue(style.Angle, hash);
+        hash = HashValue(style.BorderStyle, hash);
+        hash = HashValue(style.Outline, hash);
+        hash = HashValue(style.Shadow, hash);
+        hash = HashValue(style.Alignment, hash);
+        hash = HashValue(style.MarginL, hash);
+        hash = HashValue(style.MarginR, hash);
+        hash = HashValue(style.MarginV, hash);
+        hash = HashValue(style.Encoding, hash);
+        hash = HashValue(style.treat_fontname_as_pattern, hash);
+        hash = HashValue(style.Blur, hash);
+        return HashValue(style.Justify, hash);
+    }
+
+    // The fields of the event that change its images, the style is hashed when the state is taken
+    ULONGLONG HashEvent(const ASS_Event& event)
+    {
+        ULONGLONG hash = HashValue(event.Layer, 14695981039346656037ULL);
+        hash = HashValue(event.MarginL, hash);
+        hash = HashValue(event.MarginR, hash);
+        hash = HashValue(event.MarginV, hash);
+        hash = HashString(event.Effect, hash);
+        return HashString(event.Text, hash);
+    }
+}
+
+void CEventIndex::ASS_TrackDeleter::operator()(ASS_Track* p)
+{
+    if (p) ass_free_track(p);
+}
+
+CEventIndex::CEventIndex(ASS_Library* library, ASS_Track* track, const std::string& prefix)
+    : m_library(library)
+    , m_source(track)
+    , m_prefix(prefix)
+    , m_bPrefixAnimated(CEventSplit::IsAnimated(prefix))
+{
+    Build();
+}
+
+// Rounded down for the times before 0 too
+long long CEventIndex::GetBucket(long long time)
+{
+    return time >= 0 ? time / kBucketMs : (time - kBucketMs + 1) / kBucketMs;
+}
+
+void CEventIndex::Update()
+{
+    // Flushed events or new styles for the view
+    if (m_source->n_events < m_nEvents || m_source->n_styles != m_nStyles)
+    {
+        Build();
+        return;
+    }
+
+    for (; m_nEvents < m_source->n_events; ++m_nEvents)
+    {
+        AddEvent(m_nEvents);
+
+        // Shown in the interval of the view, it needs to be made again
+        const ASS_Event& event = m_source->events[m_nEvents];
+        if (event.Start < m_viewEnd && event.Start + event.Duration > m_viewBegin)
+            m_viewEnd = m_viewBegin;
+    }
+}
+
+void CEventIndex::SetMinDuration(long long duration)
+{
+    if (duration == m_minDuration)
+        return;
+
+    m_minDuration = duration;
+    m_viewEnd = m_viewBegin;
+}
+
+void CEventIndex::GetActive(long long now, std::vector<int>& events, long long& begin, long long& end) const
+{
+    events.clear();
+    begin = LLONG_MIN;
+    end = LLONG_MAX;
+
+    auto isShown = [&](const ASS_Event& event)
+    {
+        return event.Duration >= m_minDuration && event.Start <= now && now < event.Start + event.Duration;
+    };
+    auto addBounds = [&](const ASS_Event& event)
+    {
+        if (event.Duration < m_minDuration)
+            return;
+
+        long long stop = event.Start + event.Duration;
+
+        if (event.Start <= now)
+            begin = (std::max)(begin, event.Start);
+        else
+            end = (std::min)(end, event.Start);
+
+        if (stop <= now)
+            begin = (std::max)(begin, stop);
+        else
+            end = (std::min)(end, stop);
+    };
+
+    for (int i : m_long)
+    {
+        const ASS_Event& event = m_source->events[i];
+        addBounds(event);
+        if (isShown(event))
+            events.push_back(i);
+    }
+    size_t nLong = events.size();
+
+    // Only the events of the bucket of now can be shown
+    long long bucket = GetBucket(now);
+    auto it = m_buckets.lower_bound(bucket);
+    if (it != m_buckets.end() && it->first == bucket)
+    {
+        for (int i : it->second)
+        {
+            if (isShown(m_source->events[i]))
+                events.push_back(i);
+        }
+    }
+
+    // A start or stop is in the list of the bucket it falls in, the closest ones are
+    // found from the buckets next to the one of now
+    for (auto next = it; next != m_buckets.end() && next->first * kBucketMs < end; ++next)
+    {
+        for (int i : next->second)
+            addBounds(m_source->events[i]);
+        if (end <= (next->first + 1) * kBucketMs)
+            break;
+    }
+    for (auto prev = it; prev != m_buckets.begin();)
+    {
+        --prev;
+        if ((prev->first + 1) * kBucketMs <= begin)
+            break;
+        for (int i : prev->second)
+            addBounds(m_source->events[i]);
+        if (begin >= prev->first * kBucketMs)
+            break;
+    }
+
+    std::inplace_merge(events.begin(), events.begin() + nLong, events.end());
+}
+
+ASS_Track* CEventIndex::GetView(long long now)
+{
+    if (now >= m_viewBegin && now < m_viewEnd)
+        return m_view ? m_view.get() : m_source;
+
+    std::vector<int> events;
+    GetActive(now, events, m_viewBegin, m_viewEnd);
+    if (!m_view)
+        return m_source;
+
+    // Drop the events no longer shown, the others move down
+    ASS_Track* view = m_view.get();
+    int count = 0;
+    for (int slot = 0; slot < view->n_events; ++slot)
+    {
+        if (std::binary_search(events.begin(), events.end(), m_viewEvents[slot]))
+        {
+            view->events[count] = view->events[slot];
+            m_viewEvents[count++] = m_viewEvents[slot];
+        }
+        else
+        {
+            ass_free_event(view, slot);
+        }
+    }
+    view->n_events = count;
+    m_viewEvents.resize(count);
+
+    // libass stacks the events by layer and read order, their order in the track doesn't matter
+    std::vector<int> kept(m_viewEvents);
+    std::sort(kept.begin(), kept.end());
+    for (int i : events)
+    {
+        if (std::binary_search(kept.begin(), kept.end(), i))
+            continue;
+
+        CopyTrackEvent(view, m_source->events[i], m_prefix);
+        if (view->n_events > static_cast<int>(m_viewEvents.size()))
+            m_viewEvents.push_back(i);
+    }
+
+    return view;
+}
+
+void CEventIndex::GetViewInterval(long long& begin, long long& end) const
+{
+    begin = m_viewBegin;
+    end = m_viewEnd;
+}
+
+bool CEventIndex::GetViewState(long long now, std::vector<long long>& state) const
+{
+    if (!m_view)
+        return false;
+
+    // In stacking order, the same lines at another time or in another track are the same state
+    std::vector<int> events(m_viewEvents);
+    std::sort(events.begin(), events.end(), [this](int a, int b)
+    {
+        const ASS_Event& first = m_source->events[a];
+        const ASS_Event& second = m_source->events[b];
+        return first.Layer != second.Layer ? first.Layer < second.Layer : first.ReadOrder < second.ReadOrder;
+    });
+
+    // The styles and the script info can change in place, they're hashed each time
+    state.push_back(static_cast<long long>(HashString(m_prefix.c_str(), HashHeader(*m_source))));
+    for (int i : events)
+    {
+        const ASS_Event& event = m_source->events[i];
+        ULONGLONG hash = m_hashes[i];
+        if (event.Style >= 0 && event.Style < m_source->n_styles)
+            hash = HashStyle(m_source->styles[event.Style], hash);
+
+        state.push_back(static_cast<long long>(hash));
+        state.push_back(m_animated[i] ? now - event.Start : -1);
+    }
+
+    return true;
+}
+
+void CEventIndex::Build()
+{
+    m_buckets.clear();
+    m_long.clear();
+    m_animated.clear();
+    m_hashes.clear();
+    m_nEvents = 0;
+    m_nStyles = m_source->n_styles;
+
+    // Out of memory, the views are the source track
+    m_view.reset(CopyTrackHeader(m_library, m_source));
+    m_viewEvents.clear();
+    m_viewBegin = m_viewEnd = 0;
+
+    for (; m_nEvents < m_source->n_events; ++m_nEvents)
+        AddEvent(m_nEvents);
+}
+
+void CEventIndex::AddEvent(int index)
+{
+    const ASS_Event& event = m_source->events[index];
+    m_animated.resize(index + 1);
+    m_animated[index] = m_bPrefixAnimated || CEventSplit::IsAnimated(event);
+    m_hashes.resize(index + 1);
+    m_hashes[index] = HashEvent(event);
+    if (event.Duration <= 0)
+        return;
+
+    long long first = GetBucket(event.Start);
+    long long last = GetBucket(event.Start + event.Duration - 1);
+    if (last - first >= kMaxBuckets)
+    {
+        m_long.push_back(index);
+        return;
+    }
+
+    for (long long bucket = first; bucket <= last; ++bucket)
+        m_buckets[bucket].push_back(index);
+}
+
+#ifdef DEBUG
+
+// Debug builds only: rundll32 AssFilterMod.dll,BenchmarkEventIndex
+// Renders 200 frames of tracks with 1000 to 100000 events and about 20 of them on screen,
+// from the whole track and from the view of the index, checks that the images are the same
+// and shows the times per frame.
+DEBUG_BENCHMARK(BenchmarkEventIndex)
+{
+    const int nFrames = 200;
+    const int eventCounts[] = { 1000, 10000, 100000 };
+
+    ASS_Library* library = ass_library_init();
+    ASS_Renderer* full = ass_renderer_init(library);
+    ASS_Renderer* indexed = ass_renderer_init(library);
+    for (auto renderer : { full, indexed })
+    {
+        ass_set_fonts(renderer, NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+        ass_set_frame_size(renderer, 1920, 1080);
+    }
+
+    CBenchmarkTimer timer;
+    std::wstring result;
+    bool bSame = true;
+
+    for (int nEvents : eventCounts)
+    {
+        std::string script =
+            "[Script Info]\nScriptType: v4.00+\nPlayResX: 1920\nPlayResY: 1080\nScaledBorderAndShadow: yes\n\n"
+            "[V4+ Styles]\nFormat: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, "
+            "Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, "
+            "Alignment, MarginL, MarginR, MarginV, Encoding\n"
+            "Style: Default,Arial,40,&H00FFFFFF,&H000000FF,&H00000000,&H80000000,0,0,0,0,100,100,0,0,1,3,2,2,20,20,20,1\n\n"
+            "[Events]\nFormat: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n";
+
+        // A new event every 100 ms, each shown 2 s
+        char line[256];
+        for (int i = 0; i < nEvents; ++i)
+        {
+            int start = i * 10, stop = start + 200;     // Centiseconds
+            _snprintf_s(line, _TRUNCATE, "Dialogue: 0,%d:%02d:%02d.%02d,%d:%02d:%02d.%02d,Default,,0,0,0,,{\\pos(%d,%d)}Line %d\n",
+                start / 360000, start / 6000 % 60, start / 100 % 60, start % 100,
+                stop / 360000, stop / 6000 % 60, stop / 100 % 60, stop % 100,
+                100 + (i * 37) % 1700, 80 + (i * 53) % 900, i);
+            script.append(line);
+        }
+
+        ASS_Track* track = ass_read_memory(library, &script[0], script.size(), nullptr);
+        timer.Start();
+        CEventIndex index(library, track);
+        double buildTime = timer.ElapsedMs();
+
+        // Playback from the middle of the track
+        long long begin = nEvents * 50LL;
+        double fullTime = 0.0, indexTime = 0.0;
+        for (int frame = 0; frame < nFrames; ++frame)
+        {
+            long long now = begin + frame * 1000LL / 24;
+            int change;
+
+            timer.Start();
+            ASS_Image* fullImages = ass_render_frame(full, track, now, &change);
+            fullTime += timer.ElapsedMs();
+
+            timer.Start();
+            ASS_Image* indexImages = ass_render_frame(indexed, index.GetView(now), now, &change);
+            indexTime += timer.ElapsedMs();
+
+            ASS_Image* s = fullImages;
+            ASS_Image* p = indexImages;
+            for (; s && p && bSame; s = s->next, p = p->next)
+            {
+                bSame = s->w == p->w && s->h == p->h && s->dst_x == p->dst_x && s->dst_y == p->dst_y && s->color == p->color;
+                for (int y = 0; y < p->h && bSame; ++y)
+                    bSame = !memcmp(s->bitmap + y * s->stride, p->bitmap + y * p->stride, p->w);
+            }
+            if (s || p)
+                bSame = false;
+        }
+
+        WCHAR row[128];
+        swprintf_s(row, L"%d events: whole track %.3f ms, index %.3f ms, built in %.1f ms\n",
+            nEvents, fullTime / nFrames, indexTime / nFrames, buildTime);
+        result.append(row);
+
+        ass_free_track(track);
+    }
+
+    ReportBenchmark(hwnd, L"BenchmarkEventIndex", result, L"Images", bSame);
+
+    ass_renderer_done(indexed);
+    ass_renderer_done(full);
+    ass_library_done(library);
+}
+
+#endif
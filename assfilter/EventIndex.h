@@ -0,0 +1,95 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#pragma once
+
+#include <ass.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Time index of the events of a track. libass goes through every event of the track on each
+// frame, the index finds the ones shown at a time from a timeline cut in buckets and keeps
+// them in a view track, made again only when the events shown change. Long tracks render
+// as fast as short ones with the same number of events on screen.
+class CEventIndex
+{
+public:
+
+    // Width of a bucket of the timeline, ms
+    static constexpr long long kBucketMs = 1000;
+    // Events over more buckets than this are kept apart and checked on each lookup
+    static constexpr long long kMaxBuckets = 64;
+
+    // The prefix goes in front of the text of the events of the view, see CopyTrackEvent
+    CEventIndex(ASS_Library* library, ASS_Track* track, const std::string& prefix = std::string());
+
+    ASS_Track* GetSource() const { return m_source; }
+
+    // Picks up the events added to the source track since the last call
+    void Update();
+
+    // Events shown for less than duration ms are left out, 0 keeps all of them
+    void SetMinDuration(long long duration);
+
+    // Indexes of the events of the source track shown at now in track order, begin and end
+    // get the interval in which the same events are shown
+    void GetActive(long long now, std::vector<int>& events, long long& begin, long long& end) const;
+
+    // Track with only the events shown at now, the source track when it can't be made.
+    // The events still shown keep their place, libass remembers where it moved them.
+    ASS_Track* GetView(long long now);
+    // Interval of the last view
+    void GetViewInterval(long long& begin, long long& end) const;
+    // Appends a hash of the script info and the prefix, then a hash of the content and the style of each
+    // event of the last view in stacking order, followed by its time since its start when
+    // it's animated and -1 otherwise. The same lines shown at another time, or loaded again,
+    // give the same state. False when the view is the source track.
+    bool GetViewState(long long now, std::vector<long long>& state) const;
+
+private:
+
+    struct ASS_TrackDeleter
+    {
+        void operator()(ASS_Track* p);
+    };
+
+    static long long GetBucket(long long time);
+
+    void Build();
+    void AddEvent(int index);
+
+    ASS_Library* m_library;
+    ASS_Track* m_source;
+    std::string m_prefix;
+    bool m_bPrefixAnimated;
+
+    std::map<long long, std::vector<int>> m_buckets;   // Events shown in each bucket
+    std::vector<int> m_long;                            // Events over more than kMaxBuckets
+    std::vector<bool> m_animated;                       // By source index, see CEventSplit::IsAnimated
+    std::vector<ULONGLONG> m_hashes;                    // By source index, of the fields of the event
+    int m_nEvents = 0;              // Events of the source track already indexed
+    int m_nStyles = 0;
+    long long m_minDuration = 0;
+
+    std::unique_ptr<ASS_Track, ASS_TrackDeleter> m_view;
+    std::vector<int> m_viewEvents;  // Source index of each event of the view
+    long long m_viewBegin = 0;
+    long long m_viewEnd = 0;
+};
@@ -0,0 +1,246 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "stdafx.h"
+#include "EventSplit.h"
+#include "Tools.h"
+
+void CEventSplit::ASS_TrackDeleter::operator()(ASS_Track* p)
+{
+    if (p) ass_free_track(p);
+}
+
+CEventSplit::CEventSplit(ASS_Library* library, ASS_Track* track, const std::string& prefix)
+    : m_library(library)
+    , m_source(track)
+    , m_prefix(prefix)
+    , m_bPrefixAnimated(IsAnimated(prefix))
+    , m_sourceIndex(std::make_unique<CEventIndex>(library, track, prefix))
+{
+    Build();
+}
+
+bool CEventSplit::IsAnimated(const ASS_Event& event)
+{
+    // Banner and scroll effects move the whole event
+    if (event.Effect && (!strncmp(event.Effect, "Banner;", 7) || !strncmp(event.Effect, "Scroll ", 7)))
+        return true;
+
+    if (!event.Text)
+        return false;
+
+    bool bOverride = false;
+    for (const char* p = event.Text; *p; ++p)
+    {
+        if (*p == '{')
+            bOverride = true;
+        else if (*p == '}')
+            bOverride = false;
+        else if (bOverride && *p == '\\')
+        {
+            const char* tag = p + 1;
+            while (*tag == ' ' || *tag == '\t')
+                ++tag;
+
+            // \t, the karaoke tags, \move, \fad and \fade
+            if (*tag == 't' || *tag == 'k' || *tag == 'K' ||
+                !strncmp(tag, "move", 4) || !strncmp(tag, "fad", 3))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool CEventSplit::IsAnimated(const std::string& tags)
+{
+    if (tags.empty())
+        return false;
+
+    ASS_Event event = {};
+    event.Text = const_cast<char*>(tags.c_str());
+    return IsAnimated(event);
+}
+
+CEventIndex* CEventSplit::GetStaticIndex() const
+{
+    if (m_staticIndex)
+        return m_staticIndex.get();
+
+    return m_animatedLayers.empty() ? m_sourceIndex.get() : nullptr;
+}
+
+CEventIndex* CEventSplit::GetAnimatedIndex() const
+{
+    if (m_animatedIndex)
+        return m_animatedIndex.get();
+
+    return m_staticLayers.empty() && !m_animatedLayers.empty() ? m_sourceIndex.get() : nullptr;
+}
+
+bool CEventSplit::Update()
+{
+    m_sourceIndex->Update();
+
+    // Flushed events or new styles, the codec private data of embedded tracks comes late
+    if (m_source->n_events < m_nEvents || m_source->n_styles != m_nStyles)
+    {
+        Build();
+        return true;
+    }
+
+    for (; m_nEvents < m_source->n_events; ++m_nEvents)
+    {
+        // The event changes the kind of a layer
+        if (!AddEvent(m_source->events[m_nEvents]))
+        {
+            Build();
+            return true;
+        }
+    }
+
+    if (m_staticIndex)
+    {
+        m_staticIndex->Update();
+        m_animatedIndex->Update();
+    }
+
+    return false;
+}
+
+CEventSplit::Order CEventSplit::GetOrder(long long now, long long& begin, long long& end)
+{
+    begin = LLONG_MIN;
+    end = LLONG_MAX;
+
+    // The views only have the events shown at now, or all of them when they couldn't be made
+    int staticMin = INT_MAX, staticMax = INT_MIN;
+    if (CEventIndex* index = GetStaticIndex())
+    {
+        const ASS_Track* track = index->GetView(now);
+        index->GetViewInterval(begin, end);
+        for (int i = 0; i < track->n_events; ++i)
+        {
+            const ASS_Event& event = track->events[i];
+            if (event.Start <= now && now < event.Start + event.Duration)
+            {
+                staticMin = (std::min)(staticMin, event.Layer);
+                staticMax = (std::max)(staticMax, event.Layer);
+            }
+        }
+    }
+
+    int animatedMin = INT_MAX, animatedMax = INT_MIN;
+    if (CEventIndex* index = GetAnimatedIndex())
+    {
+        const ASS_Track* track = index->GetView(now);
+        for (int i = 0; i < track->n_events; ++i)
+        {
+            const ASS_Event& event = track->events[i];
+            if (event.Start <= now && now < event.Start + event.Duration)
+            {
+                animatedMin = (std::min)(animatedMin, event.Layer);
+                animatedMax = (std::max)(animatedMax, event.Layer);
+            }
+        }
+    }
+
+    // Nothing shown of one kind or two separate stacks
+    if (staticMin == INT_MAX || animatedMin == INT_MAX || staticMax < animatedMin)
+        return ORDER_STATIC_BELOW;
+    if (animatedMax < staticMin)
+        return ORDER_STATIC_ABOVE;
+
+    return ORDER_MIXED;
+}
+
+void CEventSplit::Build()
+{
+    m_staticIndex.reset();
+    m_animatedIndex.reset();
+    m_static.reset();
+    m_animated.reset();
+    m_staticLayers.clear();
+    m_animatedLayers.clear();
+    m_nStyles = m_source->n_styles;
+
+    // A layer is animated when one of its events is
+    for (int i = 0; i < m_source->n_events; ++i)
+    {
+        const ASS_Event& event = m_source->events[i];
+        if (IsAnimatedEvent(event))
+            m_animatedLayers.insert(event.Layer);
+    }
+    for (int i = 0; i < m_source->n_events; ++i)
+    {
+        const ASS_Event& event = m_source->events[i];
+        if (!m_animatedLayers.count(event.Layer))
+            m_staticLayers.insert(event.Layer);
+    }
+
+    // With a single kind of events the source track is used as is
+    if (!m_staticLayers.empty() && !m_animatedLayers.empty())
+    {
+        m_static.reset(CopyTrackHeader(m_library, m_source));
+        m_animated.reset(CopyTrackHeader(m_library, m_source));
+        if (!m_static || !m_animated)
+        {
+            // Out of memory, render the source track every frame
+            m_static.reset();
+            m_animated.reset();
+            m_staticLayers.clear();
+            m_nEvents = m_source->n_events;
+            return;
+        }
+
+        for (int i = 0; i < m_source->n_events; ++i)
+        {
+            const ASS_Event& event = m_source->events[i];
+            CopyTrackEvent(m_animatedLayers.count(event.Layer) ? m_animated.get() : m_static.get(), event);
+        }
+
+        m_staticIndex = std::make_unique<CEventIndex>(m_library, m_static.get(), m_prefix);
+        m_animatedIndex = std::make_unique<CEventIndex>(m_library, m_animated.get(), m_prefix);
+    }
+
+    m_nEvents = m_source->n_events;
+}
+
+bool CEventSplit::AddEvent(const ASS_Event& event)
+{
+    bool bAnimated = m_animatedLayers.count(event.Layer) != 0;
+    if (IsAnimatedEvent(event))
+    {
+        if (m_staticLayers.count(event.Layer))
+            return false;
+        bAnimated = true;
+    }
+
+    std::set<int>& layers = bAnimated ? m_animatedLayers : m_staticLayers;
+    if (layers.insert(event.Layer).second && !m_static && !(bAnimated ? m_staticLayers : m_animatedLayers).empty())
+    {
+        // First event of a kind, the tracks need to be made
+        layers.erase(event.Layer);
+        return false;
+    }
+
+    if (m_static)
+        CopyTrackEvent(bAnimated ? m_animated.get() : m_static.get(), event);
+
+    return true;
+}
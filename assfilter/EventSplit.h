@@ -0,0 +1,89 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <ass.h>
+#include <set>
+#include <string>
+#include "EventIndex.h"
+
+// Splits a track by layer in the events that change while on screen, like \move, \t,
+// \fad or karaoke, and the ones that don't. A layer with one animated event is animated
+// as a whole, so the collisions between the events of a layer stay the same. The static
+// events only need to be rendered once for each interval in which the same ones are shown.
+class CEventSplit
+{
+public:
+
+    enum Order
+    {
+        ORDER_STATIC_BELOW,     // The static events shown are on layers below the animated ones
+        ORDER_STATIC_ABOVE,
+        ORDER_MIXED             // The layers interleave, render the whole track
+    };
+
+    // The prefix goes in front of the text of the events rendered, see CEventIndex
+    CEventSplit(ASS_Library* library, ASS_Track* track, const std::string& prefix = std::string());
+
+    static bool IsAnimated(const ASS_Event& event);
+    // Override tags put in front of every event
+    static bool IsAnimated(const std::string& tags);
+
+    ASS_Track* GetSource() const { return m_source; }
+    CEventIndex* GetSourceIndex() const { return m_sourceIndex.get(); }
+    // Index of the source track when its events are all of one kind, null when there are none of the kind
+    CEventIndex* GetStaticIndex() const;
+    CEventIndex* GetAnimatedIndex() const;
+
+    // Picks up the events added to the source track since the last call,
+    // true when the static and animated tracks were made again
+    bool Update();
+
+    // How the events shown at now stack, begin and end get the interval in which the
+    // same static events are shown
+    Order GetOrder(long long now, long long& begin, long long& end);
+
+private:
+
+    struct ASS_TrackDeleter
+    {
+        void operator()(ASS_Track* p);
+    };
+
+    void Build();
+    bool AddEvent(const ASS_Event& event);
+    bool IsAnimatedEvent(const ASS_Event& event) const { return m_bPrefixAnimated || IsAnimated(event); }
+
+    ASS_Library* m_library;
+    ASS_Track* m_source;
+    std::string m_prefix;
+    bool m_bPrefixAnimated;     // All the events are animated
+
+    // Both null while the source track only has one kind of events
+    std::unique_ptr<ASS_Track, ASS_TrackDeleter> m_static;
+    std::unique_ptr<ASS_Track, ASS_TrackDeleter> m_animated;
+    std::unique_ptr<CEventIndex> m_sourceIndex;
+    std::unique_ptr<CEventIndex> m_staticIndex;
+    std::unique_ptr<CEventIndex> m_animatedIndex;
+
+    std::set<int> m_staticLayers;
+    std::set<int> m_animatedLayers;
+    int m_nEvents = 0;          // Events of the source track already split
+    int m_nStyles = 0;
+};
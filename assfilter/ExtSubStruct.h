@@ -27,6 +27,9 @@ struct s_ext_sub
     std::wstring yuvMatrix;
     UINT codePage;
     size_t vecPos;
+    size_t residentSize;    // Memory used by the loaded track, 0 when not loaded
+    ULONGLONG scriptHash;   // CTrackCache::HashSettings the SRT track was built with, 0 for ASS
+    bool fontsExtracted;    // The fonts of its [Fonts] section are in the library, a reload skips them
 };
 
 // {41E2AAD5-7574-407D-9740-2596C3C4D7C9}
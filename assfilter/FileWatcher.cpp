@@ -0,0 +1,103 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#include <process.h>
+
+#include "FileWatcher.h"
+
+// Wait for the writes to settle before reading the file
+#define WATCH_SETTLE_DELAY 100
+
+CFileWatcher::CFileWatcher(const std::wstring& file, std::function<void()> onChange)
+    : m_file(file)
+    , m_onChange(onChange)
+{
+    m_hStop = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (m_hStop)
+        m_hThread = (HANDLE)_beginthreadex(nullptr, 0, InitialThreadProc, (LPVOID)this, 0, nullptr);
+}
+
+CFileWatcher::~CFileWatcher()
+{
+    if (m_hThread)
+    {
+        SetEvent(m_hStop);
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+    }
+    if (m_hStop)
+        CloseHandle(m_hStop);
+}
+
+unsigned int WINAPI CFileWatcher::InitialThreadProc(LPVOID pv)
+{
+    CFileWatcher* pWatcher = (CFileWatcher*)pv;
+    return pWatcher->WatchThread();
+}
+
+DWORD CFileWatcher::WatchThread()
+{
+    std::wstring folder(m_file.substr(0, m_file.find_last_of(L'\\') + 1));
+
+    // Editors often save to a temporary file and rename it, watch the names too
+    HANDLE hChange = FindFirstChangeNotificationW(folder.c_str(), FALSE,
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if (hChange == INVALID_HANDLE_VALUE)
+    {
+        DbgLog((LOG_TRACE, 1, L"CFileWatcher::WatchThread() can't watch %s", folder.c_str()));
+        return 1;
+    }
+
+    ULONGLONG size = 0, lastWrite = 0;
+    GetFileStamp(size, lastWrite);
+
+    HANDLE handles[] = { m_hStop, hChange };
+    while (WaitForMultipleObjects(_countof(handles), handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+    {
+        // Let the editor finish writing, the notifications of the burst are merged
+        if (WaitForSingleObject(m_hStop, WATCH_SETTLE_DELAY) == WAIT_OBJECT_0)
+            break;
+        FindNextChangeNotification(hChange);
+
+        ULONGLONG newSize, newLastWrite;
+        if (GetFileStamp(newSize, newLastWrite) && (newSize != size || newLastWrite != lastWrite))
+        {
+            size = newSize;
+            lastWrite = newLastWrite;
+            DbgLog((LOG_TRACE, 1, L"CFileWatcher::WatchThread() %s changed", m_file.c_str()));
+            m_onChange();
+        }
+    }
+
+    FindCloseChangeNotification(hChange);
+
+    return 0;
+}
+
+bool CFileWatcher::GetFileStamp(ULONGLONG& size, ULONGLONG& lastWrite) const
+{
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(m_file.c_str(), GetFileExInfoStandard, &fad))
+        return false;
+
+    size = ((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+    lastWrite = ((ULONGLONG)fad.ftLastWriteTime.dwHighDateTime << 32) | fad.ftLastWriteTime.dwLowDateTime;
+
+    return true;
+}
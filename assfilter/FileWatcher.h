@@ -0,0 +1,40 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+
+// Watch a file for changes from a worker thread.
+// The callback runs on the worker thread once the writes settle, it must not
+// wait on a lock held by whoever destroys the watcher.
+class CFileWatcher
+{
+public:
+    CFileWatcher(const std::wstring& file, std::function<void()> onChange);
+    ~CFileWatcher();
+
+private:
+    static unsigned int WINAPI InitialThreadProc(LPVOID pv);
+    DWORD WatchThread();
+    bool GetFileStamp(ULONGLONG& size, ULONGLONG& lastWrite) const;
+
+    std::wstring m_file;
+    std::function<void()> m_onChange;
+    HANDLE m_hStop = nullptr;
+    HANDLE m_hThread = nullptr;
+};
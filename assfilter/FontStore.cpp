@@ -0,0 +1,318 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+
+#include "FontStore.h"
+
+#include <cstring>
+
+namespace
+{
+    inline uint16_t ReadU16(const unsigned char* p)
+    {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    inline uint32_t ReadU32(const unsigned char* p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    void AppendUtf8(uint32_t c, std::string& out)
+    {
+        if (c < 0x80)
+        {
+            out += static_cast<char>(c >= 'A' && c <= 'Z' ? c + 32 : c);
+        }
+        else if (c < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (c >> 6));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (c >> 12));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xF0 | (c >> 18));
+            out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+
+    // The names libass matches the font names of the scripts with: family, full name,
+    // PostScript name and typographic family
+    bool IsMatchedName(uint16_t nameId)
+    {
+        return nameId == 1 || nameId == 4 || nameId == 6 || nameId == 16;
+    }
+
+    void ReadNameTable(const unsigned char* table, size_t length, std::set<std::string>& names)
+    {
+        if (length < 6)
+            return;
+
+        uint16_t count = ReadU16(table + 2);
+        size_t strings = ReadU16(table + 4);
+        if (6 + 12 * (size_t)count > length)
+            return;
+
+        for (uint16_t i = 0; i < count; ++i)
+        {
+            const unsigned char* record = table + 6 + 12 * (size_t)i;
+            uint16_t platform = ReadU16(record);
+            uint16_t encoding = ReadU16(record + 2);
+            uint16_t nameId = ReadU16(record + 6);
+            size_t size = ReadU16(record + 8);
+            size_t offset = strings + ReadU16(record + 10);
+            if (!IsMatchedName(nameId) || offset + size > length)
+                continue;
+
+            const unsigned char* p = table + offset;
+            std::string name;
+            if (platform == 0 || (platform == 3 && (encoding == 0 || encoding == 1 || encoding == 10)))
+            {
+                // UTF-16 big endian
+                for (size_t n = 0; n + 1 < size; n += 2)
+                {
+                    uint32_t c = ReadU16(p + n);
+                    if (c >= 0xD800 && c < 0xDC00 && n + 3 < size)
+                    {
+                        uint32_t low = ReadU16(p + n + 2);
+                        if (low >= 0xDC00 && low < 0xE000)
+                        {
+                            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                            n += 2;
+                        }
+                    }
+                    AppendUtf8(c, name);
+                }
+            }
+            else if (platform == 1 && encoding == 0)
+            {
+                // Mac Roman, only kept when it's ASCII
+                for (size_t n = 0; n < size && p[n] < 0x80; ++n)
+                    AppendUtf8(p[n], name);
+                if (name.size() != size)
+                    continue;
+            }
+            else
+            {
+                continue;
+            }
+
+            if (!name.empty())
+                names.insert(name);
+        }
+    }
+
+    void ReadFontNames(const unsigned char* data, size_t size, size_t offset, std::set<std::string>& names)
+    {
+        if (offset + 12 > size)
+            return;
+
+        size_t tables = ReadU16(data + offset + 4);
+        if (offset + 12 + 16 * tables > size)
+            return;
+
+        for (size_t i = 0; i < tables; ++i)
+        {
+            const unsigned char* record = data + offset + 12 + 16 * i;
+            if (memcmp(record, "name", 4) != 0)
+                continue;
+
+            size_t tableOffset = ReadU32(record + 8);
+            size_t tableLength = ReadU32(record + 12);
+            if (tableOffset <= size && tableLength <= size - tableOffset)
+                ReadNameTable(data + tableOffset, tableLength, names);
+            return;
+        }
+    }
+}
+
+std::shared_ptr<CFontStore> CFontStore::GetShared()
+{
+    static std::mutex lock;
+    static std::weak_ptr<CFontStore> shared;
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::shared_ptr<CFontStore> store = shared.lock();
+    if (!store)
+    {
+        store = std::make_shared<CFontStore>();
+        shared = store;
+    }
+
+    return store;
+}
+
+uint64_t CFontStore::Hash(const char* data, size_t size)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+std::shared_ptr<const CFontStore::s_font> CFontStore::Add(const char* data, size_t size)
+{
+    uint64_t hash = Hash(data, size);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    auto range = m_fonts.equal_range(hash);
+    for (auto it = range.first; it != range.second;)
+    {
+        std::shared_ptr<const s_font> font = it->second.lock();
+        if (!font)
+        {
+            it = m_fonts.erase(it);
+            continue;
+        }
+
+        if (font->data.size() == size && memcmp(font->data.data(), data, size) == 0)
+            return font;
+        ++it;
+    }
+
+    auto font = std::make_shared<s_font>();
+    font->hash = hash;
+    font->data.assign(data, data + size);
+    GetNames(data, size, font->names);
+    m_fonts.emplace(hash, font);
+
+    return font;
+}
+
+void CFontStore::GetNames(const char* data, size_t size, std::vector<std::string>& names)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    std::set<std::string> found;
+
+    if (size >= 12 && memcmp(p, "ttcf", 4) == 0)
+    {
+        // Collection, the names of each font
+        size_t fonts = ReadU32(p + 8);
+        for (size_t i = 0; i < fonts && 12 + 4 * (i + 1) <= size; ++i)
+            ReadFontNames(p, size, ReadU32(p + 12 + 4 * i), found);
+    }
+    else
+    {
+        ReadFontNames(p, size, 0, found);
+    }
+
+    names.assign(found.begin(), found.end());
+}
+
+bool CFontStore::AddName(const char* name, size_t length, std::set<std::string>& names)
+{
+    while (length && (*name == ' ' || *name == '\t'))
+    {
+        ++name;
+        --length;
+    }
+    while (length && (name[length - 1] == ' ' || name[length - 1] == '\t'))
+        --length;
+
+    // Vertical text uses the same font
+    if (length && *name == '@')
+    {
+        ++name;
+        --length;
+    }
+
+    if (!length)
+        return false;
+
+    std::string lower(name, length);
+    for (char& c : lower)
+    {
+        if (c >= 'A' && c <= 'Z')
+            c += 32;
+    }
+
+    return names.insert(lower).second;
+}
+
+bool CFontStore::GetTrackNames(const ASS_Track* track, int& nStyles, int& nEvents, std::set<std::string>& names)
+{
+    bool bAdded = false;
+
+    // Flushed track
+    if (nStyles > track->n_styles || nEvents > track->n_events)
+        nStyles = nEvents = 0;
+
+    for (; nStyles < track->n_styles; ++nStyles)
+    {
+        if (const char* font = track->styles[nStyles].FontName)
+            bAdded |= AddName(font, strlen(font), names);
+    }
+
+    for (; nEvents < track->n_events; ++nEvents)
+    {
+        const char* text = track->events[nEvents].Text;
+        if (!text)
+            continue;
+
+        bool bOverride = false;
+        for (const char* p = text; *p; ++p)
+        {
+            if (*p == '{')
+                bOverride = true;
+            else if (*p == '}')
+                bOverride = false;
+            else if (bOverride && *p == '\\')
+            {
+                const char* tag = p + 1;
+                while (*tag == ' ' || *tag == '\t')
+                    ++tag;
+                if (tag[0] != 'f' || tag[1] != 'n')
+                    continue;
+
+                // Up to the next tag or the end of the block
+                const char* name = tag + 2;
+                const char* end = name;
+                while (*end && *end != '\\' && *end != '}')
+                    ++end;
+                bAdded |= AddName(name, end - name, names);
+                p = end - 1;
+            }
+        }
+    }
+
+    return bAdded;
+}
+
+bool CFontStore::IsReferenced(const s_font& font, const std::set<std::string>& names)
+{
+    for (const auto& name : font.names)
+    {
+        if (names.count(name))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,69 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Fonts attached to the media files, shared by the filters of the process. The same file
+// opened by several filters, or its tracks switched, keeps one copy of each attachment,
+// found by the hash of its data. The names of the fonts tell the filters which ones the
+// track uses, libass only gets those. Doesn't depend on Windows headers.
+
+#include <ass.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class CFontStore
+{
+public:
+
+    struct s_font
+    {
+        uint64_t hash;
+        std::vector<char> data;
+        std::vector<std::string> names;     // Family, full and PostScript names in lower case, UTF-8
+    };
+
+    // Kept while a filter holds it
+    static std::shared_ptr<CFontStore> GetShared();
+
+    // The font with the same data, added when there is none. The data is copied.
+    std::shared_ptr<const s_font> Add(const char* data, size_t size);
+
+    // Names of the fonts of a TrueType or OpenType file or collection, empty when it can't be read
+    static void GetNames(const char* data, size_t size, std::vector<std::string>& names);
+
+    // Adds the font names of the styles and \fn tags of the track from nStyles and nEvents on,
+    // both get the counts of the track. Returns true when a name was added.
+    static bool GetTrackNames(const ASS_Track* track, int& nStyles, int& nEvents, std::set<std::string>& names);
+
+    // True when one of the names of the font is in names
+    static bool IsReferenced(const s_font& font, const std::set<std::string>& names);
+
+private:
+
+    static uint64_t Hash(const char* data, size_t size);
+    static bool AddName(const char* name, size_t length, std::set<std::string>& names);
+
+    std::mutex m_lock;
+    std::multimap<uint64_t, std::weak_ptr<const s_font>> m_fonts;
+};
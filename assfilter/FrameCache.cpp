@@ -0,0 +1,267 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+
+#include "FrameCache.h"
+
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FRAMECACHE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+#ifdef FRAMECACHE_SSE2
+    // The runs are a few dozen pixels, inline stores beat the calls to memset and memcpy
+    inline void FillZero(uint32_t* dst, uint32_t count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), zero);
+        for (; i < count; ++i)
+            dst[i] = 0;
+    }
+
+    inline void CopyPixels(uint32_t* dst, const uint32_t* src, uint32_t count)
+    {
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), a);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), b);
+        }
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        for (; i < count; ++i)
+            dst[i] = src[i];
+    }
+#else
+    inline void FillZero(uint32_t* dst, uint32_t count)
+    {
+        memset(dst, 0, count * sizeof(uint32_t));
+    }
+
+    inline void CopyPixels(uint32_t* dst, const uint32_t* src, uint32_t count)
+    {
+        memcpy(dst, src, count * sizeof(uint32_t));
+    }
+#endif
+}
+
+CFrameCache::CFrameCache()
+    : m_frameCount(0)
+    , m_byteCount(0)
+    , m_budgetBytes(0)
+    , m_rawAdded(0)
+    , m_encodedAdded(0)
+    , m_decodeTime(0)
+    , m_decodes(0)
+    , m_framesRejected(0)
+{
+}
+
+void CFrameCache::SetBudget(size_t bytes)
+{
+    m_budget = bytes;
+    m_budgetBytes.store(bytes, std::memory_order_relaxed);
+}
+
+// Each run is a word, the transparent pixels in the low half and the count of the pixels
+// that follow it in the high half. A row ends once its pixels are covered.
+void CFrameCache::Encode(const uint32_t* pixels, int width, int height, std::vector<uint32_t>& data)
+{
+    data.clear();
+
+    for (int y = 0; y < height; ++y)
+    {
+        const uint32_t* row = pixels + (size_t)y * width;
+        int x = 0;
+        while (x < width)
+        {
+            uint32_t skip = 0;
+            while (x < width && row[x] == 0 && skip < kMaxRun)
+            {
+                ++x;
+                ++skip;
+            }
+
+            int first = x;
+            uint32_t count = 0;
+            while (x < width && row[x] != 0 && count < kMaxRun)
+            {
+                ++x;
+                ++count;
+            }
+
+            data.push_back(skip | (count << 16));
+            data.insert(data.end(), row + first, row + x);
+        }
+    }
+}
+
+// SSE2 stores on x86, the runs of a row are filled and copied 4 pixels at a time
+void CFrameCache::Decode(const uint32_t* data, int width, int height, uint32_t* pixels)
+{
+    for (int y = 0; y < height; ++y)
+    {
+        uint32_t* row = pixels + (size_t)y * width;
+        int x = 0;
+        while (x < width)
+        {
+            uint32_t skip = *data & 0xFFFF;
+            uint32_t count = *data >> 16;
+            ++data;
+
+            FillZero(row + x, skip);
+            x += skip;
+            CopyPixels(row + x, data, count);
+            x += count;
+            data += count;
+        }
+    }
+}
+
+std::shared_ptr<const CFrameCache::s_bitmap> CFrameCache::FindBitmap(uint64_t id) const
+{
+    auto it = m_bitmaps.find(id);
+    return it != m_bitmaps.end() ? it->second.bitmap : nullptr;
+}
+
+bool CFrameCache::Add(int64_t start, s_frame&& frame)
+{
+    // The bitmaps already held for other frames take no more room
+    size_t added = 0;
+    for (const auto& bitmap : frame.bitmaps)
+    {
+        if (!m_bitmaps.count(bitmap->id))
+            added += GetSize(*bitmap);
+    }
+
+    if (m_bytes + added > m_budget)
+    {
+        m_framesRejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    auto it = m_frames.find(start);
+    if (it != m_frames.end())
+    {
+        Release(it->second);
+        m_frames.erase(it);
+    }
+
+    for (const auto& bitmap : frame.bitmaps)
+    {
+        s_shared& shared = m_bitmaps[bitmap->id];
+        if (shared.bitmap)
+        {
+            shared.frames++;
+            continue;
+        }
+
+        shared.bitmap = bitmap;
+        shared.frames = 1;
+        m_bytes += GetSize(*bitmap);
+        m_rawAdded.fetch_add((uint64_t)bitmap->width * bitmap->height * sizeof(uint32_t), std::memory_order_relaxed);
+        m_encodedAdded.fetch_add(GetSize(*bitmap), std::memory_order_relaxed);
+    }
+
+    m_frames.emplace(start, std::move(frame));
+    m_frameCount.store(m_frames.size(), std::memory_order_relaxed);
+    m_byteCount.store(m_bytes, std::memory_order_relaxed);
+    return true;
+}
+
+const CFrameCache::s_frame* CFrameCache::Find(int64_t start) const
+{
+    auto it = m_frames.find(start);
+    return it != m_frames.end() ? &it->second : nullptr;
+}
+
+void CFrameCache::EraseUpTo(int64_t start)
+{
+    auto end = m_frames.upper_bound(start);
+    for (auto it = m_frames.begin(); it != end; ++it)
+        Release(it->second);
+    m_frames.erase(m_frames.begin(), end);
+
+    m_frameCount.store(m_frames.size(), std::memory_order_relaxed);
+    m_byteCount.store(m_bytes, std::memory_order_relaxed);
+}
+
+void CFrameCache::EraseRange(int64_t first, int64_t last)
+{
+    if (last <= first)
+        return;
+
+    auto begin = m_frames.lower_bound(first);
+    auto end = m_frames.lower_bound(last);
+    for (auto it = begin; it != end; ++it)
+        Release(it->second);
+    m_frames.erase(begin, end);
+
+    m_frameCount.store(m_frames.size(), std::memory_order_relaxed);
+    m_byteCount.store(m_bytes, std::memory_order_relaxed);
+}
+
+void CFrameCache::Clear()
+{
+    m_frames.clear();
+    m_bitmaps.clear();
+    m_bytes = 0;
+
+    m_frameCount.store(0, std::memory_order_relaxed);
+    m_byteCount.store(0, std::memory_order_relaxed);
+}
+
+void CFrameCache::Release(const s_frame& frame)
+{
+    for (const auto& bitmap : frame.bitmaps)
+    {
+        auto it = m_bitmaps.find(bitmap->id);
+        if (it != m_bitmaps.end() && --it->second.frames == 0)
+        {
+            m_bytes -= GetSize(*it->second.bitmap);
+            m_bitmaps.erase(it);
+        }
+    }
+}
+
+void CFrameCache::AddDecodeTime(double ms)
+{
+    m_decodeTime.fetch_add(static_cast<uint64_t>(ms * 1000.0), std::memory_order_relaxed);
+    m_decodes.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CFrameCache::GetStats(s_stats& stats) const
+{
+    uint64_t encoded = m_encodedAdded.load(std::memory_order_relaxed);
+    uint64_t decodes = m_decodes.load(std::memory_order_relaxed);
+
+    stats.frames = m_frameCount.load(std::memory_order_relaxed);
+    stats.bytes = m_byteCount.load(std::memory_order_relaxed);
+    stats.budget = m_budgetBytes.load(std::memory_order_relaxed);
+    stats.ratio = encoded ? (double)m_rawAdded.load(std::memory_order_relaxed) / encoded : 0.0;
+    stats.decodeTime = decodes ? m_decodeTime.load(std::memory_order_relaxed) / 1000.0 / decodes : 0.0;
+    stats.framesRejected = m_framesRejected.load(std::memory_order_relaxed);
+}
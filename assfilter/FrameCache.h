@@ -0,0 +1,118 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Frames rendered ahead of the requests, kept run-length encoded within a byte budget.
+// Subtitle bitmaps are mostly transparent, each row is stored as runs of transparent
+// pixels followed by the premultiplied pixels up to the next run. The frames are expanded
+// when delivered. Doesn't depend on Windows headers.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+class CFrameCache
+{
+public:
+
+    struct s_bitmap
+    {
+        int32_t left, top, width, height;
+        uint64_t id;
+        bool bottom;                    // Moved by the lower offset of the frame
+        std::vector<uint32_t> data;     // Encoded rows
+    };
+
+    struct s_frame
+    {
+        int32_t rect[4];                // Left, top, right, bottom
+        int32_t clipRect[4];
+        int32_t offsets[2];
+        // Frames rendered one after the other share the bitmaps of the static events
+        std::vector<std::shared_ptr<const s_bitmap>> bitmaps;
+    };
+
+    struct s_stats
+    {
+        uint64_t frames;            // Held now
+        uint64_t bytes;             // Held now, encoded
+        uint64_t budget;
+        double ratio;               // Size of the pixels over the size encoded, of the frames added
+        double decodeTime;          // Average, ms
+        uint64_t framesRejected;    // Not added, over the budget
+    };
+
+    // Longest run of either kind, longer ones are split
+    static constexpr uint32_t kMaxRun = 0xFFFF;
+
+    CFrameCache();
+
+    void SetBudget(size_t bytes);
+    bool HasRoom() const { return m_bytes < m_budget; }
+
+    // Encodes width x height pixels, rows of width pixels
+    static void Encode(const uint32_t* pixels, int width, int height, std::vector<uint32_t>& data);
+    static void Decode(const uint32_t* data, int width, int height, uint32_t* pixels);
+
+    // Bitmap already encoded for a frame held, frames keep the ids of the bitmaps they share
+    std::shared_ptr<const s_bitmap> FindBitmap(uint64_t id) const;
+
+    // False when the frame doesn't fit in the budget, it's dropped
+    bool Add(int64_t start, s_frame&& frame);
+    const s_frame* Find(int64_t start) const;
+    // Drops the frames up to start, the consumer requests them in order
+    void EraseUpTo(int64_t start);
+    // Drops the frames starting in [first, last), the events shown on them changed
+    void EraseRange(int64_t first, int64_t last);
+    void Clear();
+
+    void AddDecodeTime(double ms);
+
+    // Can be called from any thread
+    void GetStats(s_stats& stats) const;
+
+private:
+
+    struct s_shared
+    {
+        std::shared_ptr<const s_bitmap> bitmap;
+        int frames;
+    };
+
+    static size_t GetSize(const s_bitmap& bitmap) { return bitmap.data.size() * sizeof(uint32_t); }
+    void Release(const s_frame& frame);
+
+    // Only used under the lock of the filter
+    std::map<int64_t, s_frame> m_frames;
+    std::map<uint64_t, s_shared> m_bitmaps;     // By id, counted once however many frames share them
+    size_t m_bytes = 0;
+    size_t m_budget = 0;
+
+    // Read by the status page
+    std::atomic<uint64_t> m_frameCount;
+    std::atomic<uint64_t> m_byteCount;
+    std::atomic<uint64_t> m_budgetBytes;
+    std::atomic<uint64_t> m_rawAdded;
+    std::atomic<uint64_t> m_encodedAdded;
+    std::atomic<uint64_t> m_decodeTime;         // us
+    std::atomic<uint64_t> m_decodes;
+    std::atomic<uint64_t> m_framesRejected;
+};
@@ -0,0 +1,107 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+
+#include "LiveCaptions.h"
+
+CLiveCaptions::CLiveCaptions()
+    : m_lateLines(0)
+    , m_linesShown(0)
+    , m_latencySum(0)
+    , m_latencyMax(0)
+{
+}
+
+void CLiveCaptions::AddFrame(int64_t start, int64_t stop, double clock)
+{
+    // Back in time after a Clear or a seek, the consumer dropped the frames from there on
+    if (!m_frames.empty() && start < m_frames.back())
+    {
+        while (!m_frames.empty() && m_frames.back() >= start)
+            m_frames.pop_back();
+        m_horizon = stop;
+    }
+
+    if (m_frames.empty() || start != m_frames.back())
+    {
+        m_frames.push_back(start);
+        if (m_frames.size() > kMaxFrames)
+            m_frames.pop_front();
+    }
+    if (stop > m_horizon)
+        m_horizon = stop;
+
+    // The first frame of the time of a late line shows it
+    for (auto it = m_lines.begin(); it != m_lines.end();)
+    {
+        if (start >= it->stop || clock - it->received > kMaxLatency)
+        {
+            // The frames went by or the consumer went elsewhere
+            it = m_lines.erase(it);
+        }
+        else if (start >= it->start)
+        {
+            uint64_t latency = clock > it->received ? static_cast<uint64_t>((clock - it->received) * 1000.0) : 0;
+            m_latencySum.fetch_add(latency, std::memory_order_relaxed);
+            if (latency > m_latencyMax.load(std::memory_order_relaxed))
+                m_latencyMax.store(latency, std::memory_order_relaxed);
+            m_linesShown.fetch_add(1, std::memory_order_relaxed);
+            it = m_lines.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+bool CLiveCaptions::AddLine(int64_t start, int64_t stop, double clock, std::vector<int64_t>& frames)
+{
+    frames.clear();
+    if (start >= m_horizon || stop <= start)
+        return false;
+
+    for (int64_t frame : m_frames)
+    {
+        if (frame >= start)
+            frames.push_back(frame);
+    }
+
+    m_lateLines.fetch_add(1, std::memory_order_relaxed);
+    m_lines.push_back({ start, stop, clock });
+    if (m_lines.size() > kMaxLines)
+        m_lines.pop_front();
+
+    return true;
+}
+
+void CLiveCaptions::Reset()
+{
+    m_frames.clear();
+    m_horizon = INT64_MIN;
+    m_lines.clear();
+}
+
+void CLiveCaptions::GetStats(s_stats& stats) const
+{
+    stats.lateLines = m_lateLines.load(std::memory_order_relaxed);
+    stats.linesShown = m_linesShown.load(std::memory_order_relaxed);
+    stats.averageLatency = stats.linesShown ?
+        m_latencySum.load(std::memory_order_relaxed) / 1000.0 / stats.linesShown : 0.0;
+    stats.maxLatency = m_latencyMax.load(std::memory_order_relaxed) / 1000.0;
+}
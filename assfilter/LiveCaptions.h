@@ -0,0 +1,81 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Follows the frames the consumer requested and the lines received late for them. A line
+// that starts before the last requested frame is late, the consumer already queued frames
+// without it. Measures the time from the arrival of late lines to the first frame delivered
+// with them. Doesn't depend on Windows headers.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class CLiveCaptions
+{
+public:
+
+    struct s_stats
+    {
+        uint64_t lateLines;         // Received after frames of their time were requested
+        uint64_t linesShown;        // Late lines delivered since
+        double averageLatency;      // ms
+        double maxLatency;          // ms
+    };
+
+    // Requested frames remembered, consumers queue fewer
+    static constexpr size_t kMaxFrames = 32;
+    // Late lines waiting to be delivered, and for how long at most, ms
+    static constexpr size_t kMaxLines = 64;
+    static constexpr double kMaxLatency = 10000.0;
+
+    CLiveCaptions();
+
+    // Frame delivered to the consumer, times in 100ns units, clock in ms
+    void AddFrame(int64_t start, int64_t stop, double clock);
+    // Line received, frames gets the starts of the requested frames from its start on.
+    // Returns true when the line is late.
+    bool AddLine(int64_t start, int64_t stop, double clock, std::vector<int64_t>& frames);
+    // The consumer requests the frames anew, after a seek or a new track
+    void Reset();
+
+    // Can be called from any thread
+    void GetStats(s_stats& stats) const;
+
+private:
+
+    struct s_line
+    {
+        int64_t start;
+        int64_t stop;
+        double received;
+    };
+
+    // Only used under the lock of the filter
+    std::deque<int64_t> m_frames;   // Starts of the last requested frames, oldest first
+    int64_t m_horizon = INT64_MIN;  // End of the last requested frame
+    std::deque<s_line> m_lines;
+
+    // Read by the status page
+    std::atomic<uint64_t> m_lateLines;
+    std::atomic<uint64_t> m_linesShown;
+    std::atomic<uint64_t> m_latencySum;     // us
+    std::atomic<uint64_t> m_latencyMax;     // us
+};
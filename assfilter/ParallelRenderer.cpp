@@ -0,0 +1,298 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "stdafx.h"
+#include "ParallelRenderer.h"
+#include "DebugBenchmark.h"
+#include "TaskScheduler.h"
+#include "Tools.h"
+
+void CParallelRenderer::ASS_TrackDeleter::operator()(ASS_Track* p)
+{
+    if (p) ass_free_track(p);
+}
+
+CParallelRenderer::CParallelRenderer(ASS_Library* library, ASS_Track* track, size_t groups, CTaskScheduler& scheduler,
+    const std::string& prefix)
+    : m_library(library)
+    , m_scheduler(scheduler)
+    , m_source(track)
+    , m_maxGroups(groups ? groups : 1)
+    , m_prefix(prefix)
+    , m_bPrefixPositioned(IsPositioned(prefix.c_str()))
+{
+    Build();
+}
+
+bool CParallelRenderer::IsPositioned(const char* text)
+{
+    if (!text)
+        return false;
+
+    bool bOverride = false;
+    for (const char* p = text; *p; ++p)
+    {
+        if (*p == '{')
+            bOverride = true;
+        else if (*p == '}')
+            bOverride = false;
+        else if (bOverride && *p == '\\')
+        {
+            const char* tag = p + 1;
+            while (*tag == ' ' || *tag == '\t')
+                ++tag;
+
+            if (!strncmp(tag, "pos", 3) || !strncmp(tag, "move", 4))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// Order in which libass stacks the events
+long long CParallelRenderer::GetKey(int layer, int readOrder)
+{
+    return (long long)layer * 0x100000000LL + ((long long)readOrder - INT_MIN);
+}
+
+void CParallelRenderer::Update()
+{
+    if (m_source->n_events < m_nEvents || m_source->n_styles != m_nStyles)
+    {
+        Build();
+        return;
+    }
+
+    for (; m_nEvents < m_source->n_events; ++m_nEvents)
+    {
+        // An event that may collide in a layer split between groups
+        if (!AddEvent(m_source->events[m_nEvents]))
+        {
+            Build();
+            return;
+        }
+    }
+
+    for (auto& group : m_groups)
+        group.index->Update();
+}
+
+bool CParallelRenderer::Render(ASS_Renderer* const* renderers, long long now, std::vector<ASS_Image*>& images, int& frameChange)
+{
+    if (m_groups.empty())
+        return false;
+
+    // Each group has its own track and renderer, libass keeps no state between them
+    std::vector<int> changes(m_groups.size(), 0);
+    images.assign(m_groups.size(), nullptr);
+    m_scheduler.ParallelFor(0, static_cast<int>(m_groups.size()), 1, [&](int i)
+    {
+        images[i] = ass_render_frame(renderers[i], m_groups[i].index->GetView(now), now, &changes[i]);
+    });
+
+    frameChange = *std::max_element(changes.begin(), changes.end());
+    return true;
+}
+
+void CParallelRenderer::Build()
+{
+    m_groups.clear();
+    m_splitLayers.clear();
+    m_nEvents = m_source->n_events;
+    m_nStyles = m_source->n_styles;
+
+    // Layers with only positioned events can be cut between any two events
+    std::map<int, bool> positioned;
+    std::vector<std::pair<int, int>> order;
+    order.reserve(m_source->n_events);
+    for (int i = 0; i < m_source->n_events; ++i)
+    {
+        const ASS_Event& event = m_source->events[i];
+        auto it = positioned.emplace(event.Layer, true).first;
+        if (!IsPositioned(event))
+            it->second = false;
+        order.emplace_back(event.Layer, event.ReadOrder);
+    }
+    std::sort(order.begin(), order.end());
+
+    // Groups of about the same number of events
+    size_t groups = (std::min)(m_maxGroups, (std::max)(order.size(), size_t(1)));
+    size_t target = (order.size() + groups - 1) / groups;
+    std::vector<long long> firstKeys(1, LLONG_MIN);
+    size_t count = 0;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        int layer = order[i].first;
+        bool bLayerStart = i == 0 || order[i - 1].first != layer;
+        if (count >= target && firstKeys.size() < groups && (bLayerStart || positioned[layer]))
+        {
+            if (bLayerStart)
+            {
+                firstKeys.push_back(GetKey(layer, INT_MIN));
+            }
+            else
+            {
+                firstKeys.push_back(GetKey(layer, order[i].second));
+                m_splitLayers.insert(layer);
+            }
+            count = 0;
+        }
+        count++;
+    }
+
+    for (long long firstKey : firstKeys)
+    {
+        s_group group;
+        group.firstKey = firstKey;
+        group.track.reset(CopyTrackHeader(m_library, m_source));
+        if (!group.track)
+        {
+            // Out of memory, Render fails and the frames are rendered on one renderer
+            m_groups.clear();
+            m_splitLayers.clear();
+            return;
+        }
+        m_groups.push_back(std::move(group));
+    }
+
+    for (int i = 0; i < m_source->n_events; ++i)
+        AddEvent(m_source->events[i]);
+
+    for (auto& group : m_groups)
+        group.index = std::make_unique<CEventIndex>(m_library, group.track.get(), m_prefix);
+}
+
+bool CParallelRenderer::AddEvent(const ASS_Event& event)
+{
+    if (m_groups.empty())
+        return true;
+
+    if (m_splitLayers.count(event.Layer) && !IsPositioned(event))
+        return false;
+
+    long long key = GetKey(event.Layer, event.ReadOrder);
+    size_t group = m_groups.size() - 1;
+    while (group > 0 && m_groups[group].firstKey > key)
+        group--;
+
+    CopyTrackEvent(m_groups[group].track.get(), event);
+    return true;
+}
+
+#ifdef DEBUG
+
+// Debug builds only: rundll32 AssFilterMod.dll,BenchmarkParallelRender
+// Renders a synthetic frame of 500 events on one renderer and in parallel, with cold caches,
+// checks that the images are the same and shows the times.
+#define PARALLEL_BENCHMARK_GROUPS 4
+
+DEBUG_BENCHMARK(BenchmarkParallelRender)
+{
+    const int nEvents = 500;
+    const int nRuns = 10;
+
+    std::string script =
+        "[Script Info]\nScriptType: v4.00+\nPlayResX: 1920\nPlayResY: 1080\nScaledBorderAndShadow: yes\n\n"
+        "[V4+ Styles]\nFormat: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, "
+        "Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, "
+        "Alignment, MarginL, MarginR, MarginV, Encoding\n"
+        "Style: Default,Arial,48,&H00FFFFFF,&H000000FF,&H00000000,&H80000000,0,0,0,0,100,100,0,0,1,3,2,2,20,20,20,1\n\n"
+        "[Events]\nFormat: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n";
+
+    // Signs on 10 layers and dialogue lines that collide on the top layer
+    char line[256];
+    for (int i = 0; i < nEvents; ++i)
+    {
+        if (i % 50 == 49)
+            _snprintf_s(line, _TRUNCATE, "Dialogue: 10,0:00:00.00,0:00:10.00,Default,,0,0,0,,Dialogue line %d\n", i);
+        else
+            _snprintf_s(line, _TRUNCATE, "Dialogue: %d,0:00:00.00,0:00:10.00,Default,,0,0,0,,{\\pos(%d,%d)\\blur2\\frz%d\\bord4}Sign %d\n",
+                i % 10, 100 + (i * 37) % 1700, 80 + (i * 53) % 900, i % 30, i);
+        script.append(line);
+    }
+
+    ASS_Library* library = ass_library_init();
+    ASS_Track* track = ass_read_memory(library, &script[0], script.size(), nullptr);
+    ASS_Renderer* serial = ass_renderer_init(library);
+    ass_set_fonts(serial, NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+
+    CTaskScheduler scheduler(PARALLEL_BENCHMARK_GROUPS - 1);
+    CParallelRenderer parallel(library, track, PARALLEL_BENCHMARK_GROUPS, scheduler);
+    std::vector<ASS_Renderer*> renderers;
+    for (size_t i = 0; i < parallel.GetGroupCount(); ++i)
+    {
+        renderers.push_back(ass_renderer_init(library));
+        ass_set_fonts(renderers.back(), NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+    }
+
+    CBenchmarkTimer timer;
+    double serialTime = 0.0, parallelTime = 0.0;
+    bool bSame = true;
+
+    for (int run = 0; run < nRuns; ++run)
+    {
+        // A new frame size drops the caches, like the first frame after a seek
+        int width = 1920 + (run & 1);
+
+        ass_set_frame_size(serial, width, 1080);
+        timer.Start();
+        int change;
+        ASS_Image* serialImages = ass_render_frame(serial, track, 5000, &change);
+        serialTime += timer.ElapsedMs();
+
+        for (auto renderer : renderers)
+            ass_set_frame_size(renderer, width, 1080);
+        std::vector<ASS_Image*> images;
+        timer.Start();
+        parallel.Render(renderers.data(), 5000, images, change);
+        parallelTime += timer.ElapsedMs();
+
+        // The same images in the same order
+        ASS_Image* s = serialImages;
+        for (auto groupImages : images)
+        {
+            for (ASS_Image* p = groupImages; p; p = p->next, s = s ? s->next : nullptr)
+            {
+                if (!s || s->w != p->w || s->h != p->h || s->dst_x != p->dst_x || s->dst_y != p->dst_y ||
+                    s->color != p->color)
+                {
+                    bSame = false;
+                    break;
+                }
+                for (int y = 0; y < p->h && bSame; ++y)
+                    bSame = !memcmp(s->bitmap + y * s->stride, p->bitmap + y * p->stride, p->w);
+            }
+        }
+        if (s)
+            bSame = false;
+    }
+
+    WCHAR result[256];
+    swprintf_s(result, L"%d events, %Iu groups\nSerial: %.2f ms\nParallel: %.2f ms\n",
+        nEvents, parallel.GetGroupCount(), serialTime / nRuns, parallelTime / nRuns);
+    ReportBenchmark(hwnd, L"BenchmarkParallelRender", result, L"Images", bSame);
+
+    for (auto renderer : renderers)
+        ass_renderer_done(renderer);
+    ass_renderer_done(serial);
+    ass_free_track(track);
+    ass_library_done(library);
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <ass.h>
+#include <set>
+#include "EventIndex.h"
+
+class CTaskScheduler;
+
+// Renders frames with many events on several renderers at once. The events of the track are
+// split in groups of consecutive layers, each group rendered from its own copy of its events.
+// libass stacks the events by layer and read order and only moves colliding events of the
+// same layer, so the images of the groups one after the other are the images of a single
+// renderer. A layer with only \pos and \move events can be split, its events never collide.
+class CParallelRenderer
+{
+public:
+
+    // The groups are rendered on the scheduler of the filter, the prefix goes in front of
+    // the text of the events rendered, see CEventIndex
+    CParallelRenderer(ASS_Library* library, ASS_Track* track, size_t groups, CTaskScheduler& scheduler,
+        const std::string& prefix = std::string());
+
+    ASS_Track* GetSource() const { return m_source; }
+    size_t GetGroupCount() const { return m_groups.size(); }
+
+    // Picks up the events added to the source track since the last call
+    void Update();
+
+    // Renders the groups in parallel with one renderer each. images gets the images of the
+    // groups in stacking order, frameChange the biggest change reported by libass.
+    bool Render(ASS_Renderer* const* renderers, long long now, std::vector<ASS_Image*>& images, int& frameChange);
+
+private:
+
+    struct ASS_TrackDeleter
+    {
+        void operator()(ASS_Track* p);
+    };
+
+    struct s_group
+    {
+        long long firstKey;         // Stacking key of the first event of the group
+        std::unique_ptr<ASS_Track, ASS_TrackDeleter> track;
+        std::unique_ptr<CEventIndex> index;     // Events of the group shown at a time
+    };
+
+    static bool IsPositioned(const char* text);
+    bool IsPositioned(const ASS_Event& event) const { return m_bPrefixPositioned || IsPositioned(event.Text); }
+    static long long GetKey(int layer, int readOrder);
+
+    void Build();
+    bool AddEvent(const ASS_Event& event);
+
+    ASS_Library* m_library;
+    CTaskScheduler& m_scheduler;
+    ASS_Track* m_source;
+    size_t m_maxGroups;
+    std::string m_prefix;
+    bool m_bPrefixPositioned;   // All the events are positioned
+
+    std::vector<s_group> m_groups;
+    std::set<int> m_splitLayers;    // Layers with events in more than one group
+    int m_nEvents = 0;              // Events of the source track already copied
+    int m_nStyles = 0;
+};
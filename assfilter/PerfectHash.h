@@ -0,0 +1,114 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Case insensitive perfect hash lookups in constant tables.
+// A first hash picks a bucket, the seed of the bucket picks the slot of the key.
+// The seeds and slots are generated by PerfectHashGen.py and CheckPerfectHash
+// verifies them at compile time. Kept to C++11 constexpr for VS2015.
+
+#include <cstddef>
+#include <cstdint>
+
+struct s_perfect_hash
+{
+    const uint16_t* seeds;      // Seed of each bucket
+    size_t buckets;
+    const uint8_t* slots;       // Table index of each slot, 0xFF when empty
+    size_t size;
+};
+
+namespace PerfectHash
+{
+    constexpr uint32_t CharValue(char c)
+    {
+        return static_cast<unsigned char>(c);
+    }
+
+    constexpr uint32_t CharValue(wchar_t c)
+    {
+        return static_cast<uint32_t>(c);
+    }
+
+    template <typename CharT>
+    constexpr uint32_t ToLowerAscii(CharT c)
+    {
+        return CharValue(c) >= 'A' && CharValue(c) <= 'Z' ? CharValue(c) + 32 : CharValue(c);
+    }
+
+    // FNV-1a on the lowercase characters
+    template <typename CharT>
+    constexpr uint32_t HashNoCase(const CharT* str, size_t len, uint32_t hash)
+    {
+        return len == 0 ? hash : HashNoCase(str + 1, len - 1, (hash ^ ToLowerAscii(*str)) * 16777619u);
+    }
+
+    constexpr uint32_t Shift16(uint32_t h)
+    {
+        return h ^ (h >> 16);
+    }
+
+    constexpr uint32_t Mix(uint32_t h)
+    {
+        return Shift16(Shift16(h) * 0x045D9F3Bu);
+    }
+
+    constexpr uint32_t Basis(uint32_t seed)
+    {
+        return 2166136261u ^ (seed * 0x9E3779B9u);
+    }
+
+    template <typename CharT>
+    constexpr size_t ConstLength(const CharT* str)
+    {
+        return *str ? 1 + ConstLength(str + 1) : 0;
+    }
+}
+
+template <typename CharT>
+constexpr size_t PerfectHashSlot(const s_perfect_hash& ph, const CharT* str, size_t len)
+{
+    using namespace PerfectHash;
+    return Mix(HashNoCase(str, len, Basis(ph.seeds[Mix(HashNoCase(str, len, Basis(0))) % ph.buckets] + 1u))) % ph.size;
+}
+
+// Every key must land on the slot of its own index, so no two keys share a slot
+template <typename Entry, typename CharT, size_t N>
+constexpr bool CheckPerfectHash(const s_perfect_hash& ph, const Entry (&entries)[N], const CharT* Entry::*key, size_t i = 0)
+{
+    return i == N || (ph.slots[PerfectHashSlot(ph, entries[i].*key, PerfectHash::ConstLength(entries[i].*key))] == i &&
+        CheckPerfectHash(ph, entries, key, i + 1));
+}
+
+// Index of the entry whose key matches str ignoring the ASCII case, -1 when there is none
+template <typename Entry, typename CharT, size_t N>
+int PerfectHashFind(const s_perfect_hash& ph, const Entry (&entries)[N], const CharT* Entry::*key, const CharT* str, size_t len)
+{
+    size_t index = ph.slots[PerfectHashSlot(ph, str, len)];
+    if (index >= N)
+        return -1;
+
+    const CharT* entryKey = entries[index].*key;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (!entryKey[i] || PerfectHash::ToLowerAscii(entryKey[i]) != PerfectHash::ToLowerAscii(str[i]))
+            return -1;
+    }
+
+    return entryKey[len] ? -1 : static_cast<int>(index);
+}
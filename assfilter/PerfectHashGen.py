@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+#   Copyright(C) 2017 Blitzker
+#
+#   This program is free software : you can redistribute it and / or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+# Generate PerfectHashTables.h from the color and language tables of Tools.h
+# and the field table of SubRenderOptions.h. Run it again after changing those
+# tables, the static_asserts of Tools.cpp fail until the tables match.
+# Uses the hash functions of PerfectHash.h.
+#
+#   python PerfectHashGen.py > PerfectHashTables.h
+
+import os
+import re
+import sys
+
+M32 = 0xFFFFFFFF
+
+
+def hash_nocase(key, h):
+    for c in key:
+        c = ord(c)
+        if ord('A') <= c <= ord('Z'):
+            c += 32
+        h = ((h ^ c) * 16777619) & M32
+    return h
+
+
+def mix(h):
+    h ^= h >> 16
+    h = (h * 0x045D9F3B) & M32
+    return h ^ (h >> 16)
+
+
+def basis(seed):
+    return 2166136261 ^ ((seed * 0x9E3779B9) & M32)
+
+
+def build(keys, buckets, size):
+    """Hash and displace: place the biggest buckets first, try seeds until all their keys land on free slots."""
+    if len(set(k.lower() for k in keys)) != len(keys):
+        sys.exit('duplicate keys')
+
+    groups = [[] for _ in range(buckets)]
+    for i, key in enumerate(keys):
+        groups[mix(hash_nocase(key, basis(0))) % buckets].append(i)
+
+    seeds = [0] * buckets
+    slots = [0xFF] * size
+    for b in sorted(range(buckets), key=lambda b: -len(groups[b])):
+        if not groups[b]:
+            continue
+        for seed in range(0x10000):
+            taken = [mix(hash_nocase(keys[i], basis(seed + 1))) % size for i in groups[b]]
+            if len(set(taken)) == len(taken) and all(slots[s] == 0xFF for s in taken):
+                for i, s in zip(groups[b], taken):
+                    slots[s] = i
+                seeds[b] = seed
+                break
+        else:
+            return None
+
+    return seeds, slots
+
+
+def emit(name, keys):
+    # Smallest tables the search still solves quickly
+    for size in range(len(keys), 2 * len(keys) + 1):
+        result = build(keys, max(1, (len(keys) + 2) // 3), size)
+        if result:
+            break
+    seeds, slots = result
+
+    def rows(values, fmt):
+        out = []
+        for i in range(0, len(values), 12):
+            out.append('    ' + ' '.join(fmt % v + ',' for v in values[i:i + 12]))
+        return '\n'.join(out)
+
+    print('static constexpr uint16_t %s_seeds[] = {\n%s\n};\n' % (name, rows(seeds, '%5d')))
+    print('static constexpr uint8_t %s_slots[] = {\n%s\n};\n' % (name, rows(slots, '0x%02X')))
+    print('static constexpr s_perfect_hash %s_hash = {\n    %s_seeds, %d, %s_slots, %d\n};\n'
+          % (name, name, len(seeds), name, len(slots)))
+
+
+def main():
+    folder = os.path.dirname(os.path.abspath(__file__))
+    tools = open(os.path.join(folder, 'Tools.h')).read()
+    options = open(os.path.join(folder, 'SubRenderOptions.h')).read()
+    colors = re.findall(r'\{ "(\w+)",\s+"[0-9A-F]{6}" \}', tools)
+    langs = re.findall(r'\{ L"[^"]+",\s+L"(\w+)", L"(\w+)",\s+\d+ \}', tools)
+    fields = re.findall(r'\{ "(\w+)",\s+SRO_TYPE_\w+,', options)
+
+    print('// Generated by PerfectHashGen.py from the tables of Tools.h and SubRenderOptions.h, do not edit\n')
+    print('#pragma once\n')
+    print('#include "PerfectHash.h"\n')
+    emit('color_tag', colors)
+    emit('iso639_lang3', [l[0] for l in langs])
+    emit('iso639_lang2', [l[1] for l in langs])
+    emit('subrender_option', fields)
+
+
+if __name__ == '__main__':
+    main()
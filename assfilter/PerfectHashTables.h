@@ -0,0 +1,80 @@
+// Generated by PerfectHashGen.py from the tables of Tools.h and SubRenderOptions.h, do not edit
+
+#pragma once
+
+#include "PerfectHash.h"
+
+static constexpr uint16_t color_tag_seeds[] = {
+        3,     0,     7,    13,     0,     3,    10,     8,     3,     4,    20,    27,
+        2,    14,    11,     0,    17,    21,    42,     7,    23,     0,     7,     7,
+        3,     8,     1,    34,    32,    42,     8,     5,    68,   193,     6,    25,
+       79,     0,     3,    12,   134,   154,    28,    11,   438,     0,   121,   299,
+       66,     0,
+};
+
+static constexpr uint8_t color_tag_slots[] = {
+    0x65, 0x4C, 0x5F, 0x1D, 0x6A, 0x3C, 0x6F, 0x66, 0x88, 0x2A, 0x45, 0x4D,
+    0x5B, 0x50, 0x8F, 0x1E, 0x06, 0x34, 0x7A, 0x4B, 0x4A, 0x87, 0x31, 0x73,
+    0x71, 0x04, 0x21, 0x70, 0x3B, 0x32, 0x25, 0x00, 0x93, 0x58, 0x78, 0x6E,
+    0x53, 0x76, 0x6B, 0x39, 0x8E, 0x68, 0x2C, 0x92, 0x4E, 0x8D, 0x28, 0x02,
+    0x49, 0x1F, 0x85, 0x79, 0x8A, 0x23, 0x2D, 0x60, 0x6D, 0x51, 0x7D, 0x20,
+    0x33, 0x5E, 0x19, 0x7E, 0x64, 0x8B, 0x83, 0x63, 0x2E, 0x44, 0x57, 0x74,
+    0x4F, 0x61, 0x77, 0x43, 0x24, 0x38, 0x80, 0x15, 0x5A, 0x10, 0x75, 0x46,
+    0x81, 0x62, 0x26, 0x91, 0x41, 0x1A, 0x3F, 0x11, 0x37, 0x07, 0x05, 0x27,
+    0x42, 0x84, 0x89, 0x8C, 0x2F, 0x0C, 0x56, 0x47, 0x7F, 0x0B, 0x90, 0x6C,
+    0x0E, 0x3D, 0x54, 0x09, 0x1B, 0x67, 0x22, 0x2B, 0x48, 0x01, 0x0A, 0x3E,
+    0x52, 0x35, 0x7B, 0x29, 0x14, 0x08, 0x55, 0x03, 0x7C, 0x82, 0x5D, 0x0D,
+    0x40, 0x12, 0x0F, 0x13, 0x16, 0x36, 0x3A, 0x18, 0x17, 0x86, 0x69, 0x5C,
+    0x72, 0x1C, 0x30, 0x59,
+};
+
+static constexpr s_perfect_hash color_tag_hash = {
+    color_tag_seeds, 50, color_tag_slots, 148
+};
+
+static constexpr uint16_t iso639_lang3_seeds[] = {
+        3,    11,     1,     4,    58,    10,     0,   127,    16,    23,    10,     0,
+        0,    17,     0,   113,   226,     0,     0,
+};
+
+static constexpr uint8_t iso639_lang3_slots[] = {
+    0x01, 0x23, 0x15, 0x1E, 0x11, 0x36, 0x00, 0x30, 0x1F, 0x0E, 0x19, 0x22,
+    0x29, 0x21, 0x33, 0x06, 0x0C, 0x0B, 0x28, 0x31, 0x27, 0x25, 0x1A, 0x2B,
+    0x2A, 0x2E, 0x12, 0x13, 0x10, 0x35, 0x0A, 0x05, 0x17, 0x09, 0x0F, 0x26,
+    0x04, 0x07, 0x14, 0x16, 0x1B, 0x02, 0x34, 0x20, 0x2F, 0x2C, 0x1C, 0x2D,
+    0x1D, 0x0D, 0x32, 0x03, 0x18, 0x24, 0x08,
+};
+
+static constexpr s_perfect_hash iso639_lang3_hash = {
+    iso639_lang3_seeds, 19, iso639_lang3_slots, 55
+};
+
+static constexpr uint16_t iso639_lang2_seeds[] = {
+        6,     4,     1,     1,    13,   172,     7,     0,     0,     1,     1,     0,
+       10,     0,   155,    34,    17,    76,   371,
+};
+
+static constexpr uint8_t iso639_lang2_slots[] = {
+    0x05, 0x18, 0x26, 0x07, 0x00, 0x21, 0x01, 0x31, 0x09, 0x29, 0x0C, 0x0A,
+    0x02, 0x27, 0x14, 0x23, 0x33, 0x28, 0x2D, 0x34, 0x2E, 0x24, 0x11, 0x1E,
+    0x25, 0x08, 0x0F, 0x1A, 0x03, 0x20, 0x2C, 0x15, 0x1F, 0x36, 0x1D, 0x06,
+    0x19, 0x17, 0x12, 0x13, 0x0D, 0x2A, 0x2B, 0x04, 0x35, 0x2F, 0x0E, 0x10,
+    0x22, 0x30, 0x16, 0x1B, 0x1C, 0x0B, 0x32,
+};
+
+static constexpr s_perfect_hash iso639_lang2_hash = {
+    iso639_lang2_seeds, 19, iso639_lang2_slots, 55
+};
+
+static constexpr uint16_t subrender_option_seeds[] = {
+        1,    86,     5,
+};
+
+static constexpr uint8_t subrender_option_slots[] = {
+    0x02, 0x05, 0x01, 0x03, 0x08, 0x07, 0x00, 0x06, 0x04,
+};
+
+static constexpr s_perfect_hash subrender_option_hash = {
+    subrender_option_seeds, 3, subrender_option_slots, 9
+};
+
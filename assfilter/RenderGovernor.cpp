@@ -0,0 +1,183 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+
+#include "RenderGovernor.h"
+
+CRenderGovernor::CRenderGovernor()
+    : m_level(LEVEL_FULL)
+    , m_renderTime(0)
+    , m_frameBudget(0)
+    , m_framesRendered(0)
+    , m_framesDegraded(0)
+    , m_framesRepeated(0)
+    , m_levelDowns(0)
+    , m_levelUps(0)
+{
+    Reset();
+}
+
+void CRenderGovernor::SetFrameDuration(int64_t duration)
+{
+    if (duration == m_frameDuration)
+        return;
+
+    m_frameDuration = duration > 0 ? duration : 0;
+    m_frameBudget.store(static_cast<uint32_t>(m_frameDuration / 10 * kBudgetShare), std::memory_order_relaxed);
+
+    // Without a frame rate there is nothing to measure against
+    if (!m_frameDuration)
+        Reset();
+}
+
+// Back to full quality, the counters are kept
+void CRenderGovernor::Reset()
+{
+    m_average = 0.0;
+    m_overrun = 0;
+    m_headroom = 0;
+    m_settle = kSettleFrames;
+    m_repeatCount = 0;
+    m_level.store(LEVEL_FULL, std::memory_order_relaxed);
+    m_renderTime.store(0, std::memory_order_relaxed);
+}
+
+double CRenderGovernor::GetScale() const
+{
+    switch (GetLevel())
+    {
+    case LEVEL_FULL:
+        return 1.0;
+    case LEVEL_SCALED:
+        return 0.75;
+    default:
+        return 0.5;
+    }
+}
+
+bool CRenderGovernor::ShouldRender()
+{
+    if (GetLevel() != LEVEL_REPEAT)
+        return true;
+
+    // Some frames still get rendered to know when to step back up
+    if (++m_repeatCount % kProbeInterval == 0)
+        return true;
+
+    m_framesRepeated.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void CRenderGovernor::CancelRepeat()
+{
+    m_framesRepeated.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool CRenderGovernor::AddRenderTime(double ms)
+{
+    Level level = GetLevel();
+
+    m_framesRendered.fetch_add(1, std::memory_order_relaxed);
+    if (level != LEVEL_FULL)
+        m_framesDegraded.fetch_add(1, std::memory_order_relaxed);
+
+    if (!m_frameDuration)
+        return false;
+
+    // The average restarts from the frames after the settling ones
+    if (m_settle > 0)
+    {
+        m_settle--;
+        m_average = ms;
+        return false;
+    }
+
+    m_average = m_average > 0.0 ? m_average + (ms - m_average) * kAverageWeight : ms;
+    m_renderTime.store(static_cast<uint32_t>(m_average * 1000.0), std::memory_order_relaxed);
+
+    // A single slow frame, after a seek for example, is not an overrun
+    double budget = m_frameDuration / 10000.0 * kBudgetShare;
+    if (ms > budget && m_average > budget)
+    {
+        m_headroom = 0;
+        if (++m_overrun >= kOverrunFrames && level < LEVEL_REPEAT)
+        {
+            SetLevel(static_cast<Level>(level + 1));
+            m_levelDowns.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    else
+    {
+        m_overrun = 0;
+        if (m_average >= budget * kHeadroomShare)
+        {
+            m_headroom = 0;
+        }
+        // Only the probe frames are measured when repeating
+        else if (++m_headroom >= (level == LEVEL_REPEAT ? kHeadroomFrames / kProbeInterval : kHeadroomFrames) &&
+                 level > LEVEL_FULL)
+        {
+            SetLevel(static_cast<Level>(level - 1));
+            m_levelUps.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void CRenderGovernor::SetLevel(Level level)
+{
+    m_level.store(level, std::memory_order_relaxed);
+    m_overrun = 0;
+    m_headroom = 0;
+    m_repeatCount = 0;
+    m_settle = kSettleFrames;
+}
+
+void CRenderGovernor::GetStats(s_stats& stats) const
+{
+    stats.level = GetLevel();
+    stats.renderTime = m_renderTime.load(std::memory_order_relaxed) / 1000.0;
+    stats.frameBudget = m_frameBudget.load(std::memory_order_relaxed) / 1000.0;
+    stats.framesRendered = m_framesRendered.load(std::memory_order_relaxed);
+    stats.framesDegraded = m_framesDegraded.load(std::memory_order_relaxed);
+    stats.framesRepeated = m_framesRepeated.load(std::memory_order_relaxed);
+    stats.levelDowns = m_levelDowns.load(std::memory_order_relaxed);
+    stats.levelUps = m_levelUps.load(std::memory_order_relaxed);
+}
+
+const wchar_t* CRenderGovernor::GetLevelName(Level level)
+{
+    switch (level)
+    {
+    case LEVEL_FULL:
+        return L"Full quality";
+    case LEVEL_SCALED:
+        return L"3/4 resolution";
+    case LEVEL_HALF:
+        return L"1/2 resolution";
+    case LEVEL_SIMPLE:
+        return L"1/2 resolution, simple shaping";
+    case LEVEL_REPEAT:
+        return L"Repeating frames";
+    default:
+        return L"";
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Keeps the subtitle rendering inside the frame time of the video.
+// RequestFrame reports the render and flatten time of each frame, under sustained
+// overrun the governor lowers the quality one level at a time and raises it again
+// once there is headroom. Doesn't depend on Windows headers.
+
+#include <atomic>
+#include <cstdint>
+
+class CRenderGovernor
+{
+public:
+
+    enum Level
+    {
+        LEVEL_FULL,         // Render at the requested size
+        LEVEL_SCALED,       // Render at 3/4 of the size, the consumer scales the bitmap up
+        LEVEL_HALF,         // Render at half the size
+        LEVEL_SIMPLE,       // Half the size and the simple shaper
+        LEVEL_REPEAT,       // Deliver the previous frame, render one frame in kProbeInterval
+        LEVEL_COUNT
+    };
+
+    struct s_stats
+    {
+        Level level;
+        double renderTime;          // Average render and flatten time, ms
+        double frameBudget;         // Time allowed per frame, ms, 0 when the frame rate is unknown
+        uint64_t framesRendered;
+        uint64_t framesDegraded;    // Rendered below LEVEL_FULL
+        uint64_t framesRepeated;
+        uint64_t levelDowns;
+        uint64_t levelUps;
+    };
+
+    // Share of the frame time the subtitles may use, the consumer needs the rest
+    static constexpr double kBudgetShare = 0.5;
+    // Weight of the last frame in the average
+    static constexpr double kAverageWeight = 0.2;
+    // Consecutive frames over the budget before stepping down
+    static constexpr int kOverrunFrames = 8;
+    // Frames below kHeadroomShare of the budget before stepping up
+    static constexpr int kHeadroomFrames = 90;
+    static constexpr double kHeadroomShare = 0.5;
+    // Frames ignored at the start and after a level change, libass rebuilds its caches at a new size
+    static constexpr int kSettleFrames = 4;
+    static constexpr int kProbeInterval = 8;
+
+    CRenderGovernor();
+
+    // Duration of a video frame in 100ns units, 0 disables the governor
+    void SetFrameDuration(int64_t duration);
+    void Reset();
+
+    Level GetLevel() const { return m_level.load(std::memory_order_relaxed); }
+    double GetScale() const;
+    bool UseSimpleShaper() const { return GetLevel() >= LEVEL_SIMPLE; }
+
+    // False when the previous frame should be delivered again
+    bool ShouldRender();
+    // Render and flatten time of a frame, returns true when the level changed
+    bool AddRenderTime(double ms);
+    // The previous frame couldn't be delivered again, the frame got rendered anyway
+    void CancelRepeat();
+
+    // Can be called from any thread
+    void GetStats(s_stats& stats) const;
+
+    static const wchar_t* GetLevelName(Level level);
+
+private:
+
+    void SetLevel(Level level);
+
+    // Only used by the thread of RequestFrame
+    int64_t m_frameDuration = 0;
+    double m_average = 0.0;
+    int m_overrun = 0;
+    int m_headroom = 0;
+    int m_settle = 0;
+    int m_repeatCount = 0;
+
+    // Read by the status page
+    std::atomic<Level> m_level;
+    std::atomic<uint32_t> m_renderTime;     // us
+    std::atomic<uint32_t> m_frameBudget;    // us
+    std::atomic<uint64_t> m_framesRendered;
+    std::atomic<uint64_t> m_framesDegraded;
+    std::atomic<uint64_t> m_framesRepeated;
+    std::atomic<uint64_t> m_levelDowns;
+    std::atomic<uint64_t> m_levelUps;
+};
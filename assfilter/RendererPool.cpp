@@ -0,0 +1,220 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+#include "RendererPool.h"
+
+CRendererPool::CRendererPool(ASS_Library* library, size_t maxSizes, size_t cacheSizeMB)
+    : m_library(library)
+    , m_maxSizes(maxSizes ? maxSizes : 1)
+    , m_cacheSizeMB(cacheSizeMB)
+{
+}
+
+ASS_Renderer* CRendererPool::Get(int width, int height)
+{
+    for (auto it = m_renderers.begin(); it != m_renderers.end(); ++it)
+    {
+        if (it->width == width && it->height == height)
+        {
+            m_renderers.splice(m_renderers.begin(), m_renderers, it);
+            return it->renderers.front().get();
+        }
+    }
+
+    if (m_renderers.size() < m_maxSizes)
+    {
+        s_sized_renderer entry{ width, height };
+        if (!AddRenderers(entry, m_workerCount) && entry.renderers.empty())
+            return nullptr;
+
+        m_renderers.push_front(std::move(entry));
+        UpdateCacheLimits();
+    }
+    else
+    {
+        m_renderers.splice(m_renderers.begin(), m_renderers, std::prev(m_renderers.end()));
+    }
+
+    DbgLog((LOG_TRACE, 1, L"CRendererPool::Get() new size %dx%d, %Iu renderers", width, height, m_renderers.size()));
+
+    s_sized_renderer& entry = m_renderers.front();
+    entry.width = width;
+    entry.height = height;
+    for (const auto& renderer : entry.renderers)
+        ass_set_frame_size(renderer.get(), width, height);
+
+    return entry.renderers.front().get();
+}
+
+bool CRendererPool::Contains(int width, int height) const
+{
+    for (const auto& entry : m_renderers)
+    {
+        if (entry.width == width && entry.height == height)
+            return true;
+    }
+
+    return false;
+}
+
+bool CRendererPool::GetWorkers(size_t count, std::vector<ASS_Renderer*>& renderers)
+{
+    renderers.clear();
+    if (m_renderers.empty())
+        return false;
+
+    s_sized_renderer& entry = m_renderers.front();
+    if (entry.renderers.size() < count)
+    {
+        bool bAdded = AddRenderers(entry, count);
+        UpdateCacheLimits();
+        if (!bAdded)
+            return false;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        renderers.push_back(entry.renderers[i].get());
+
+    return true;
+}
+
+void CRendererPool::SetWorkerCount(size_t count)
+{
+    m_workerCount = count ? count : 1;
+    for (auto& entry : m_renderers)
+    {
+        if (entry.renderers.size() > m_workerCount)
+            entry.renderers.resize(m_workerCount);
+        else
+            AddRenderers(entry, m_workerCount);
+    }
+
+    UpdateCacheLimits();
+}
+
+void CRendererPool::SetFonts(bool bFontsDirChanged)
+{
+    if (m_bFonts && !bFontsDirChanged)
+        return;
+
+    m_bFonts = true;
+    m_fontSetup++;
+    for (const auto& entry : m_renderers)
+    {
+        for (const auto& renderer : entry.renderers)
+            ass_set_fonts(renderer.get(), NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+    }
+}
+
+void CRendererPool::SetFontLigatures(bool disable)
+{
+    m_bDisableLigatures = disable;
+    for (const auto& entry : m_renderers)
+    {
+        for (const auto& renderer : entry.renderers)
+            ass_set_font_ligatures(renderer.get(), disable);
+    }
+}
+
+void CRendererPool::SetShaper(ASS_ShapingLevel level)
+{
+    m_shaper = level;
+    for (const auto& entry : m_renderers)
+    {
+        for (const auto& renderer : entry.renderers)
+            ass_set_shaper(renderer.get(), level);
+    }
+}
+
+CRendererPool::RendererPtr CRendererPool::NewDetached()
+{
+    RendererPtr renderer(NewRenderer());
+    if (!renderer)
+        return nullptr;
+
+    if (!m_bFonts)
+        ass_set_fonts(renderer.get(), NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+
+    m_detached++;
+    UpdateCacheLimits();
+    if (m_cacheSizeMB)
+        ass_set_cache_limits(renderer.get(), 0, GetCacheLimit());
+
+    return renderer;
+}
+
+// New renderer with the settings of the pool
+ASS_Renderer* CRendererPool::NewRenderer() const
+{
+    ASS_Renderer* renderer = ass_renderer_init(m_library);
+    if (!renderer)
+        return nullptr;
+
+    if (m_bFonts)
+        ass_set_fonts(renderer, NULL, NULL, ASS_FONTPROVIDER_DIRECTWRITE, NULL, NULL);
+    ass_set_font_ligatures(renderer, m_bDisableLigatures);
+    ass_set_shaper(renderer, m_shaper);
+
+    return renderer;
+}
+
+// Renderers for the size of the entry up to count
+bool CRendererPool::AddRenderers(s_sized_renderer& entry, size_t count)
+{
+    while (entry.renderers.size() < count)
+    {
+        ASS_Renderer* renderer = NewRenderer();
+        if (!renderer)
+            return false;
+
+        ass_set_frame_size(renderer, entry.width, entry.height);
+        entry.renderers.emplace_back(renderer);
+    }
+
+    return true;
+}
+
+// Split the budget between the renderers, libass bounds the bitmap and the composite caches
+// of a renderer by the same size
+void CRendererPool::UpdateCacheLimits()
+{
+    if (!m_cacheSizeMB)
+        return;
+
+    int limit = GetCacheLimit();
+    for (const auto& entry : m_renderers)
+    {
+        for (const auto& renderer : entry.renderers)
+            ass_set_cache_limits(renderer.get(), 0, limit);
+    }
+}
+
+// MB of each cache of a renderer
+int CRendererPool::GetCacheLimit() const
+{
+    size_t count = m_detached;
+    for (const auto& entry : m_renderers)
+        count += entry.renderers.size();
+
+    return static_cast<int>((std::max)(m_cacheSizeMB / (2 * (std::max)(count, static_cast<size_t>(1))), static_cast<size_t>(1)));
+}
+
+void CRendererPool::ASS_RendererDeleter::operator()(ASS_Renderer* p)
+{
+    if (p) ass_renderer_done(p);
+}
@@ -0,0 +1,86 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ass.h>
+
+// libass renderers by frame size. libass drops its caches when the frame size
+// changes, one renderer per recent size keeps them for each size so going
+// fullscreen and back doesn't lay out and rasterize everything again.
+// The caches of all the renderers share one memory budget.
+class CRendererPool
+{
+public:
+    struct ASS_RendererDeleter
+    {
+        void operator()(ASS_Renderer* p);
+    };
+    typedef std::unique_ptr<ASS_Renderer, ASS_RendererDeleter> RendererPtr;
+
+    CRendererPool(ASS_Library* library, size_t maxSizes, size_t cacheSizeMB);
+
+    // Renderer for the frame size, the least recently used size gets recycled
+    ASS_Renderer* Get(int width, int height);
+    bool Contains(int width, int height) const;
+
+    // count renderers of the size last passed to Get, the first one is the renderer Get returned.
+    // The others are kept with the size.
+    bool GetWorkers(size_t count, std::vector<ASS_Renderer*>& renderers);
+
+    // Renderers kept for each size, made up front so the first heavy frame doesn't set up their fonts
+    void SetWorkerCount(size_t count);
+
+    // Applied to the renderers of the pool and the ones created later.
+    // libass can't share a font setup between renderers, each one enumerates the system fonts
+    // on its own. They get it once, the fonts added to the library later reach them at the next
+    // frame, only a new fonts dir needs a new setup.
+    void SetFonts(bool bFontsDirChanged = false);
+    void SetFontLigatures(bool disable);
+    void SetShaper(ASS_ShapingLevel level);
+
+    // Renderer outside the pool for another thread, with the settings and the fonts of the pool.
+    // Its caches take a share of the budget for as long as the pool lives.
+    RendererPtr NewDetached();
+    // Changes when the font setup of the renderers is made again, detached ones need a new one
+    unsigned GetFontSetup() const { return m_fontSetup; }
+
+private:
+    struct s_sized_renderer
+    {
+        int width;
+        int height;
+        std::vector<RendererPtr> renderers;     // Main one and workers
+    };
+
+    ASS_Renderer* NewRenderer() const;
+    bool AddRenderers(s_sized_renderer& entry, size_t count);
+    void UpdateCacheLimits();
+    int GetCacheLimit() const;
+
+    ASS_Library* m_library;
+    size_t m_maxSizes;
+    size_t m_cacheSizeMB;
+    size_t m_workerCount = 1;
+    size_t m_detached = 0;
+    std::list<s_sized_renderer> m_renderers;    // Most recently used first
+
+    bool m_bFonts = false;
+    unsigned m_fontSetup = 0;
+    bool m_bDisableLigatures = false;
+    ASS_ShapingLevel m_shaper = ASS_SHAPING_COMPLEX;
+};
@@ -0,0 +1,107 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+#include "StateCache.h"
+
+CStateCache::CStateCache()
+    : m_lookups(0)
+    , m_hits(0)
+    , m_frameCount(0)
+    , m_byteCount(0)
+    , m_budgetBytes(0)
+{
+}
+
+size_t CStateCache::s_key_hash::operator()(const std::vector<long long>& key) const
+{
+    // FNV-1a over the words
+    uint64_t h = 14695981039346656037ULL;
+    for (long long word : key)
+    {
+        h ^= static_cast<uint64_t>(word);
+        h *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+
+void CStateCache::SetBudget(size_t bytes)
+{
+    if (bytes == m_budget)
+        return;
+
+    m_budget = bytes;
+    m_budgetBytes.store(bytes, std::memory_order_relaxed);
+    Trim();
+}
+
+ISubRenderFramePtr CStateCache::Find(const std::vector<long long>& key)
+{
+    m_lookups.fetch_add(1, std::memory_order_relaxed);
+
+    auto it = m_keys.find(key);
+    if (it == m_keys.end())
+        return nullptr;
+
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return it->second->frame;
+}
+
+void CStateCache::Add(const std::vector<long long>& key, const ISubRenderFramePtr& frame, size_t bytes)
+{
+    // Bigger than the whole budget, it would only push the others out
+    if (!frame || bytes > m_budget || m_keys.count(key))
+        return;
+
+    m_entries.push_front({ key, frame, bytes });
+    m_keys.emplace(key, m_entries.begin());
+    m_bytes += bytes;
+    Trim();
+}
+
+void CStateCache::Clear()
+{
+    m_keys.clear();
+    m_entries.clear();
+    m_bytes = 0;
+
+    m_frameCount.store(0, std::memory_order_relaxed);
+    m_byteCount.store(0, std::memory_order_relaxed);
+}
+
+void CStateCache::Trim()
+{
+    while (m_bytes > m_budget && !m_entries.empty())
+    {
+        m_bytes -= m_entries.back().bytes;
+        m_keys.erase(m_entries.back().key);
+        m_entries.pop_back();
+    }
+
+    m_frameCount.store(m_entries.size(), std::memory_order_relaxed);
+    m_byteCount.store(m_bytes, std::memory_order_relaxed);
+}
+
+void CStateCache::GetStats(s_stats& stats) const
+{
+    stats.lookups = m_lookups.load(std::memory_order_relaxed);
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.frames = m_frameCount.load(std::memory_order_relaxed);
+    stats.bytes = m_byteCount.load(std::memory_order_relaxed);
+    stats.budget = m_budgetBytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,83 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <unordered_map>
+
+// Frames rendered for a state of a track, the events shown with the local times of the
+// animated ones at a render size. Openings, signs that come back and seeks back show the
+// same states again, the frame and the ids of its bitmaps are reused instead of rendered
+// again. The least recently used frames are dropped past the byte budget.
+class CStateCache
+{
+public:
+
+    struct s_stats
+    {
+        uint64_t lookups;
+        uint64_t hits;
+        uint64_t frames;        // Held now
+        uint64_t bytes;         // Pixels of the frames held
+        uint64_t budget;
+    };
+
+    CStateCache();
+
+    // 0 disables the cache
+    void SetBudget(size_t bytes);
+    bool IsEnabled() const { return m_budget > 0; }
+
+    // key is the render settings followed by the state of CEventIndex::GetViewState
+    ISubRenderFramePtr Find(const std::vector<long long>& key);
+    void Add(const std::vector<long long>& key, const ISubRenderFramePtr& frame, size_t bytes);
+    void Clear();
+
+    // Can be called from any thread
+    void GetStats(s_stats& stats) const;
+
+private:
+
+    struct s_key_hash
+    {
+        size_t operator()(const std::vector<long long>& key) const;
+    };
+
+    struct s_entry
+    {
+        std::vector<long long> key;
+        ISubRenderFramePtr frame;
+        size_t bytes;
+    };
+
+    void Trim();
+
+    // Only used under the lock of the filter
+    std::list<s_entry> m_entries;       // Most recently used first
+    std::unordered_map<std::vector<long long>, std::list<s_entry>::iterator, s_key_hash> m_keys;
+    size_t m_bytes = 0;
+    size_t m_budget = 0;
+
+    // Read by the status page
+    std::atomic<uint64_t> m_lookups;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_frameCount;
+    std::atomic<uint64_t> m_byteCount;
+    std::atomic<uint64_t> m_budgetBytes;
+};
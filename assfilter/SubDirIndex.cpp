@@ -0,0 +1,183 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#include "SubDirIndex.h"
+#include "Tools.h"
+
+CCritSec CSubDirIndex::s_lock;
+std::unordered_map<std::wstring, std::shared_ptr<const CSubDirIndex::s_dir>> CSubDirIndex::s_dirs;
+
+namespace
+{
+    inline void ToLower(std::wstring& str)
+    {
+        std::transform(str.begin(), str.end(), str.begin(), ::towlower);
+    }
+}
+
+std::vector<s_ext_sub> CSubDirIndex::FindMatchingSubs(const std::wstring& mediaNameWithoutExt)
+{
+    std::vector<s_ext_sub> subs;
+    size_t slash = mediaNameWithoutExt.find_last_of(L'\\');
+    std::wstring folder(mediaNameWithoutExt.substr(0, slash + 1));
+    std::wstring lcPrefix(mediaNameWithoutExt.substr(slash + 1));
+    ToLower(lcPrefix);
+
+    auto dir = GetDir(folder);
+    if (!dir)
+        return subs;
+
+    // Keep the folder order
+    std::vector<size_t> matches;
+    auto range = dir->prefixes.equal_range(lcPrefix);
+    for (auto it = range.first; it != range.second; ++it)
+        matches.push_back(it->second);
+    std::sort(matches.begin(), matches.end());
+
+    for (auto i : matches)
+    {
+        const s_entry& entry = dir->entries[i];
+
+        // The media name followed by the extension, or by a language code and the extension
+        if (entry.name.size() < lcPrefix.size())
+            subs.push_back(MakeExtSub(entry, std::wstring(), -1));
+        else if (entry.langIndex >= 0 && entry.name.size() == lcPrefix.size() + 2)
+            subs.push_back(MakeExtSub(entry, std::wstring(), entry.langIndex));
+        else
+            subs.push_back(MakeExtSub(entry, entry.name.substr(lcPrefix.size()), -1));
+    }
+
+    return subs;
+}
+
+std::vector<s_ext_sub> CSubDirIndex::FindFolderSubs(const std::wstring& folder)
+{
+    std::vector<s_ext_sub> subs;
+
+    auto dir = GetDir(folder);
+    if (!dir)
+        return subs;
+
+    for (const auto& entry : dir->entries)
+        subs.push_back(MakeExtSub(entry, entry.name, -1));
+
+    return subs;
+}
+
+std::shared_ptr<const CSubDirIndex::s_dir> CSubDirIndex::GetDir(const std::wstring& folder)
+{
+    std::wstring dirPath(folder);
+    if (!dirPath.empty() && dirPath.back() == L'\\')
+        dirPath.pop_back();
+
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (dirPath.empty() || !GetFileAttributesExW(dirPath.c_str(), GetFileExInfoStandard, &fad) ||
+        !(fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return nullptr;
+
+    // Adding, removing or renaming a file updates the folder modification time
+    ULONGLONG lastWrite = ((ULONGLONG)fad.ftLastWriteTime.dwHighDateTime << 32) | fad.ftLastWriteTime.dwLowDateTime;
+    std::wstring key(dirPath);
+    ToLower(key);
+
+    {
+        CAutoLock lock(&s_lock);
+        auto it = s_dirs.find(key);
+        if (it != s_dirs.end() && it->second->lastWrite == lastWrite)
+            return it->second;
+    }
+
+    // Scan outside the lock, another filter can use the other folders meanwhile
+    auto dir = ScanDir(dirPath + L"\\", lastWrite);
+
+    CAutoLock lock(&s_lock);
+    s_dirs[key] = dir;
+
+    return dir;
+}
+
+std::shared_ptr<const CSubDirIndex::s_dir> CSubDirIndex::ScanDir(const std::wstring& folder, ULONGLONG lastWrite)
+{
+    auto dir = std::make_shared<s_dir>();
+    dir->lastWrite = lastWrite;
+
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind = FindFirstFileExW((folder + L"*").c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return dir;
+
+    do
+    {
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            continue;
+
+        // Parse the name once from the end: extension, then language code
+        s_entry entry;
+        entry.lcFileName.assign(fd.cFileName);
+        ToLower(entry.lcFileName);
+
+        size_t extPos = entry.lcFileName.find_last_of(L'.');
+        if (extPos == std::wstring::npos)
+            continue;
+
+        const wchar_t* ext = entry.lcFileName.c_str() + extPos;
+        if (wcscmp(ext, L".ass") == 0)
+            entry.isAss = true;
+        else if (wcscmp(ext, L".srt") == 0)
+            entry.isAss = false;
+        else
+            continue;
+
+        entry.file = folder + fd.cFileName;
+        entry.name.assign(fd.cFileName, extPos);
+        entry.langIndex = -1;
+
+        size_t langPos = extPos >= 3 ? extPos - 3 : std::wstring::npos;
+        if (langPos != std::wstring::npos && entry.lcFileName[langPos] == L'.')
+            entry.langIndex = FindLanguage(entry.lcFileName.c_str() + langPos + 1, 2, true);
+
+        size_t index = dir->entries.size();
+        for (size_t pos = entry.lcFileName.find(L'.'); pos != std::wstring::npos; pos = entry.lcFileName.find(L'.', pos + 1))
+            dir->prefixes.emplace(entry.lcFileName.substr(0, pos + 1), index);
+
+        dir->entries.push_back(std::move(entry));
+    } while (FindNextFileW(hFind, &fd));
+    FindClose(hFind);
+
+    DbgLog((LOG_TRACE, 1, L"CSubDirIndex::ScanDir() %s -> %u subtitles", folder.c_str(), (UINT)dir->entries.size()));
+
+    return dir;
+}
+
+s_ext_sub CSubDirIndex::MakeExtSub(const s_entry& entry, const std::wstring& altName, int langIndex)
+{
+    s_ext_sub extSub;
+    extSub.subAltName = altName;
+    extSub.subFile = entry.file;
+    extSub.subLang.assign(langIndex >= 0 ? iso639_lang[langIndex].language : MatchLanguage(L"und"));
+    extSub.subType.assign(entry.isAss ? L"ASS" : L"SRT");
+    extSub.yuvMatrix.assign(L"None");
+    extSub.codePage = entry.isAss ? 0 : langIndex >= 0 ? iso639_lang[langIndex].codepage : GetACP();
+    extSub.vecPos = SIZE_MAX;   // uninitialized
+    extSub.residentSize = 0;
+    extSub.scriptHash = 0;
+    extSub.fontsExtracted = false;
+
+    return extSub;
+}
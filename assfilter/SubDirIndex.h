@@ -0,0 +1,60 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include "ExtSubStruct.h"
+
+// Index of the subtitle files of a folder.
+// Each folder is scanned once per process and rescanned only when its
+// modification time changes, so opening the next episode of a folder
+// doesn't list it again.
+class CSubDirIndex
+{
+public:
+    // Subtitles named after the media file, mediaNameWithoutExt includes the trailing dot
+    static std::vector<s_ext_sub> FindMatchingSubs(const std::wstring& mediaNameWithoutExt);
+
+    // All the subtitles of a folder
+    static std::vector<s_ext_sub> FindFolderSubs(const std::wstring& folder);
+
+private:
+    struct s_entry
+    {
+        std::wstring file;          // Full path
+        std::wstring name;          // File name without the extension
+        std::wstring lcFileName;    // Lowercase file name
+        int langIndex;              // Index in iso639_lang of the language suffix, -1 if none
+        bool isAss;
+    };
+
+    struct s_dir
+    {
+        ULONGLONG lastWrite;
+        std::vector<s_entry> entries;
+        // Every lowercase file name prefix ending with a dot, to the entries
+        std::unordered_multimap<std::wstring, size_t> prefixes;
+    };
+
+    static std::shared_ptr<const s_dir> GetDir(const std::wstring& folder);
+    static std::shared_ptr<const s_dir> ScanDir(const std::wstring& folder, ULONGLONG lastWrite);
+    static s_ext_sub MakeExtSub(const s_entry& entry, const std::wstring& altName, int langIndex);
+
+    static CCritSec s_lock;
+    static std::unordered_map<std::wstring, std::shared_ptr<const s_dir>> s_dirs;
+};
@@ -18,6 +18,9 @@
 #pragma once
 
 #include <ass.h>
+#include "FrameCache.h"
+
+class CTaskScheduler;
 
 class SubFrame final
     : public CUnknown
@@ -25,7 +28,29 @@ class SubFrame final
 {
 public:
 
-    SubFrame(RECT rect, ULONGLONG id, ASS_Image* image);
+    // The images are flattened into one bitmap in libass order. With splitHalves the images of
+    // the upper and lower half get a bitmap each, for movable subtitles that follow the target.
+    // The bitmaps are blended on the scheduler of the filter.
+    SubFrame(RECT rect, ULONGLONG id, ASS_Image* image, bool splitHalves, CTaskScheduler& scheduler);
+    // Image lists drawn one after the other, from the renderers of a CParallelRenderer
+    SubFrame(RECT rect, ULONGLONG id, const std::vector<ASS_Image*>& images, bool splitHalves, CTaskScheduler& scheduler);
+
+    // Shares the bitmaps of frame, the upper and lower ones moved vertically by the offsets.
+    // The bitmaps keep their ids so the consumer can reuse them.
+    SubFrame(const SubFrame& frame, RECT clipRect, LONG topOffset, LONG bottomOffset);
+
+    // The bitmaps of both frames, the ones of above drawn last
+    SubFrame(const SubFrame& below, const SubFrame& above);
+
+    // Expands a frame of the render-ahead cache, the bitmaps keep their ids
+    SubFrame(const CFrameCache::s_frame& frame);
+
+    // Bytes of the pixels of the bitmaps
+    size_t GetSize() const;
+
+    // Encodes the frame for the cache, the bitmaps it already holds are shared.
+    // Without a cache all the bitmaps are encoded.
+    void Pack(const CFrameCache* cache, CFrameCache::s_frame& frame) const;
 
     DECLARE_IUNKNOWN;
 
@@ -40,11 +65,21 @@ public:
 
 private:
 
-    void Flatten(ASS_Image* image);
+    struct s_bitmap
+    {
+        RECT rect;
+        ULONGLONG id;
+        bool bottom;        // Made of images of the lower half
+        std::unique_ptr<uint32_t[]> pixels;
+    };
+
+    static bool IsBottomImage(const ASS_Image* image, LONG middle);
+    void Flatten(const std::vector<ASS_Image*>& images, bool bottom, LONG middle, ULONGLONG id, CTaskScheduler& scheduler);
 
     const RECT m_rect;
-    const ULONGLONG m_id;
+    const RECT m_clipRect;
+    LONG m_offsets[2] = {};             // Vertical moves of the upper and lower bitmaps
 
-    std::unique_ptr<uint32_t[]> m_pixels;
-    RECT m_pixelsRect;
+    // Shared by the moved and combined copies
+    std::vector<std::shared_ptr<const s_bitmap>> m_bitmaps;
 };
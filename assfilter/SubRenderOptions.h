@@ -0,0 +1,72 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// ISubRenderOptions fields of the provider, see SubRenderIntf.h
+
+#include "PerfectHash.h"
+
+enum SubRenderOption
+{
+    SRO_NAME,
+    SRO_VERSION,
+    SRO_YUV_MATRIX,
+    SRO_COMBINE_BITMAPS,
+    SRO_OUTPUT_LEVELS,
+    SRO_IS_BITMAP,
+    SRO_IS_MOVABLE,
+    SRO_PLAYBACK_RATE,
+    SRO_LOW_LATENCY,
+    SRO_COUNT
+};
+
+enum SubRenderOptionType
+{
+    SRO_TYPE_BOOL,
+    SRO_TYPE_INT,
+    SRO_TYPE_SIZE,
+    SRO_TYPE_RECT,
+    SRO_TYPE_ULONGLONG,
+    SRO_TYPE_DOUBLE,
+    SRO_TYPE_STRING,
+    SRO_TYPE_BIN
+};
+
+// In SubRenderOption order, PerfectHashGen.py hashes the names
+static constexpr struct s_subrender_option {
+    const char *name;
+    SubRenderOptionType type;
+    bool writable;
+} subrender_option[] = {
+    { "name",               SRO_TYPE_STRING,    false },
+    { "version",            SRO_TYPE_STRING,    false },
+    { "yuvMatrix",          SRO_TYPE_STRING,    false },
+    { "combineBitmaps",     SRO_TYPE_BOOL,      true  },
+    { "outputLevels",       SRO_TYPE_STRING,    false },
+    { "isBitmap",           SRO_TYPE_BOOL,      false },
+    { "isMovable",          SRO_TYPE_BOOL,      false },
+    // Rate of fast forward or rewind set by the consumer, 0 detects it from the requests
+    { "playbackRate",       SRO_TYPE_DOUBLE,    true  },
+    // Live captions, lines received late clear the frames queued by the consumer
+    { "lowLatency",         SRO_TYPE_BOOL,      true  },
+};
+
+static_assert(sizeof(subrender_option) / sizeof(subrender_option[0]) == SRO_COUNT, "subrender_option must list every SubRenderOption");
+
+// Field names are case insensitive, returns -1 for unknown fields and other types
+int FindSubRenderOption(const char* field, SubRenderOptionType type);
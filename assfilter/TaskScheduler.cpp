@@ -0,0 +1,249 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+// but for the thread priority
+
+#include "TaskScheduler.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Worker running the current thread, to queue its tasks on its own queue
+    thread_local CTaskScheduler* t_scheduler = nullptr;
+    thread_local size_t t_worker = 0;
+}
+
+struct CTaskScheduler::s_loop
+{
+    int begin;
+    int end;
+    int grain;
+    int chunks;
+    std::atomic<int> next;
+    std::atomic<int> remaining;
+    const std::function<void(int, int)>* body;
+
+    std::mutex lock;
+    std::condition_variable done;
+};
+
+CTaskScheduler::CTaskScheduler(size_t workers, Priority priority)
+    : m_queued(0)
+    , m_nextWorker(0)
+{
+    if (!workers)
+        workers = GetDefaultWorkers();
+
+    for (size_t i = 0; i < workers; ++i)
+        m_workers.push_back(std::make_unique<s_worker>());
+
+    for (size_t i = 0; i < workers; ++i)
+        m_workers[i]->thread = std::thread(&CTaskScheduler::WorkerThread, this, i, priority);
+}
+
+CTaskScheduler::~CTaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+        m_bStop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& worker : m_workers)
+        worker->thread.join();
+}
+
+std::shared_ptr<CTaskScheduler> CTaskScheduler::GetShared(size_t workers)
+{
+    // Not a static scheduler, its threads can't be joined while the DLL unloads
+    static std::mutex lock;
+    static std::weak_ptr<CTaskScheduler> shared;
+
+    if (!workers)
+        workers = GetDefaultWorkers();
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::shared_ptr<CTaskScheduler> scheduler = shared.lock();
+    if (!scheduler || scheduler->GetWorkerCount() != workers)
+    {
+        scheduler = std::make_shared<CTaskScheduler>(workers);
+        shared = scheduler;
+    }
+
+    return scheduler;
+}
+
+void CTaskScheduler::Submit(std::function<void()> task)
+{
+    size_t index = t_scheduler == this ? t_worker : m_nextWorker++ % m_workers.size();
+    {
+        std::lock_guard<std::mutex> lock(m_workers[index]->lock);
+        m_workers[index]->tasks.push_back(std::move(task));
+    }
+    m_queued++;
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+    }
+    m_wake.notify_one();
+}
+
+void CTaskScheduler::RunLoop(int begin, int end, int grain, const std::function<void(int, int)>& body)
+{
+    if (grain < 1)
+        grain = 1;
+    if (end <= begin)
+        return;
+
+    int chunks = (end - begin + grain - 1) / grain;
+    if (chunks == 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    // Shared with the helper tasks, the ones starting late find no chunk left
+    auto loop = std::make_shared<s_loop>();
+    loop->begin = begin;
+    loop->end = end;
+    loop->grain = grain;
+    loop->chunks = chunks;
+    loop->next = 0;
+    loop->remaining = chunks;
+    loop->body = &body;
+
+    size_t helpers = (std::min)(m_workers.size(), static_cast<size_t>(chunks - 1));
+    for (size_t i = 0; i < helpers; ++i)
+        Submit([loop] { RunChunks(*loop); });
+
+    RunChunks(*loop);
+
+    // The chunks left are running on the workers
+    std::unique_lock<std::mutex> lock(loop->lock);
+    loop->done.wait(lock, [&loop] { return loop->remaining == 0; });
+}
+
+void CTaskScheduler::RunChunks(s_loop& loop)
+{
+    int chunk;
+    while ((chunk = loop.next++) < loop.chunks)
+    {
+        int first = loop.begin + chunk * loop.grain;
+        int last = (std::min)(first + loop.grain, loop.end);
+        (*loop.body)(first, last);
+
+        if (--loop.remaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(loop.lock);
+            loop.done.notify_all();
+        }
+    }
+}
+
+bool CTaskScheduler::RunTask(size_t index)
+{
+    std::function<void()> task;
+
+    // Newest task of the own queue, its data is still in the cache
+    {
+        s_worker& worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.lock);
+        if (!worker.tasks.empty())
+        {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+    }
+
+    // Oldest task of another queue
+    for (size_t i = 1; !task && i < m_workers.size(); ++i)
+    {
+        s_worker& victim = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+
+    if (!task)
+        return false;
+
+    m_queued--;
+    task();
+    return true;
+}
+
+void CTaskScheduler::WorkerThread(size_t index, Priority priority)
+{
+    t_scheduler = this;
+    t_worker = index;
+    ApplyPriority(priority);
+
+    for (;;)
+    {
+        if (RunTask(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_sleepLock);
+        m_wake.wait(lock, [this] { return m_bStop || m_queued > 0; });
+        if (m_bStop && m_queued == 0)
+            return;
+    }
+}
+
+void CTaskScheduler::ApplyPriority(Priority priority)
+{
+#if defined(_WIN32)
+    int value = THREAD_PRIORITY_NORMAL;
+    if (priority == PRIORITY_BELOW_NORMAL)
+        value = THREAD_PRIORITY_BELOW_NORMAL;
+    else if (priority == PRIORITY_LOWEST)
+        value = THREAD_PRIORITY_LOWEST;
+    SetThreadPriority(GetCurrentThread(), value);
+#elif defined(__linux__)
+    // The nice value of a Linux thread only applies to that thread
+    int value = 0;
+    if (priority == PRIORITY_BELOW_NORMAL)
+        value = 5;
+    else if (priority == PRIORITY_LOWEST)
+        value = 10;
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), value);
+#else
+    (void)priority;
+#endif
+}
+
+size_t CTaskScheduler::GetDefaultWorkers()
+{
+    unsigned processors = std::thread::hardware_concurrency();
+    return processors > 1 ? processors - 1 : 1;
+}
@@ -0,0 +1,100 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Work-stealing thread pool of the filter, kept apart from the pools of the video renderer.
+// Each worker has its own queue, it runs its newest task first and takes the oldest task of
+// another worker when its queue is empty. The workers run below the priority of the threads
+// presenting the video. Doesn't depend on Windows headers.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CTaskScheduler
+{
+public:
+
+    enum Priority
+    {
+        PRIORITY_NORMAL,
+        PRIORITY_BELOW_NORMAL,
+        PRIORITY_LOWEST
+    };
+
+    // 0 workers keeps a processor free for the presentation thread
+    explicit CTaskScheduler(size_t workers = 0, Priority priority = PRIORITY_BELOW_NORMAL);
+    ~CTaskScheduler();
+
+    CTaskScheduler(const CTaskScheduler&) = delete;
+    CTaskScheduler& operator=(const CTaskScheduler&) = delete;
+
+    // Scheduler of the filters of the process with that many workers, 0 for the default. It lives
+    // while one of them holds it. A filter asking for another count gets a new scheduler, the
+    // filters holding the previous one keep it until they go away.
+    static std::shared_ptr<CTaskScheduler> GetShared(size_t workers = 0);
+
+    size_t GetWorkerCount() const { return m_workers.size(); }
+
+    // Runs the task on a worker, for the work nobody waits for
+    void Submit(std::function<void()> task);
+
+    // Calls body(i) for i in [begin, end) and returns once all the calls are done. The calling
+    // thread takes part. Free threads take grain indexes at a time, so uneven work balances.
+    template <typename Body>
+    void ParallelFor(int begin, int end, int grain, const Body& body)
+    {
+        RunLoop(begin, end, grain, [&body](int first, int last)
+        {
+            for (int i = first; i < last; ++i)
+                body(i);
+        });
+    }
+
+private:
+
+    struct s_worker
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+    };
+
+    struct s_loop;
+
+    void RunLoop(int begin, int end, int grain, const std::function<void(int, int)>& body);
+    static void RunChunks(s_loop& loop);
+    bool RunTask(size_t index);
+    void WorkerThread(size_t index, Priority priority);
+    static void ApplyPriority(Priority priority);
+    static size_t GetDefaultWorkers();
+
+    std::vector<std::unique_ptr<s_worker>> m_workers;
+    std::atomic<size_t> m_queued;           // Tasks waiting in the queues
+    std::atomic<size_t> m_nextWorker;       // Queue of the next task submitted from outside
+
+    std::mutex m_sleepLock;
+    std::condition_variable m_wake;
+    bool m_bStop = false;
+};
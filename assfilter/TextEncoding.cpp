@@ -0,0 +1,546 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+
+#include "TextEncoding.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define TEXTENC_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TEXTENC_AVX2
+#else
+#include <cpuid.h>
+#define TEXTENC_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+    // Length of the sequence starting at p, 0 when invalid
+    inline size_t DecodeLength(const uint8_t* p, size_t avail)
+    {
+        uint8_t c = p[0];
+
+        if (c < 0x80)
+            return 1;
+        if (c < 0xC2)
+            return 0;   // Continuation byte or overlong 2 bytes lead
+
+        size_t len = c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF5 ? 4 : 0;
+        if (len == 0 || avail < len)
+            return 0;
+
+        // Restricted ranges for the second byte
+        uint8_t lo = 0x80, hi = 0xBF;
+        switch (c)
+        {
+        case 0xE0: lo = 0xA0; break;    // Overlong
+        case 0xED: hi = 0x9F; break;    // Surrogates
+        case 0xF0: lo = 0x90; break;    // Overlong
+        case 0xF4: hi = 0x8F; break;    // Above U+10FFFF
+        }
+
+        if (p[1] < lo || p[1] > hi)
+            return 0;
+        for (size_t i = 2; i < len; ++i)
+        {
+            if ((p[i] & 0xC0) != 0x80)
+                return 0;
+        }
+
+        return len;
+    }
+
+    // Move back from pos to the start of the sequence containing it
+    inline size_t FindSequenceStart(const uint8_t* p, size_t pos)
+    {
+        for (size_t i = 0; i < 3 && pos > 0 && (p[pos] & 0xC0) == 0x80; ++i)
+            --pos;
+
+        return pos;
+    }
+
+    // Encode the units from i to end as UTF-8, a surrogate pair may read one unit past end.
+    // i is moved past the last unit read, returns the number of bytes written.
+    inline size_t EncodeUTF16(const char16_t* data, size_t& i, size_t end, size_t count, char* out)
+    {
+        char* dst = out;
+
+        while (i < end)
+        {
+            uint32_t cp = data[i++];
+
+            if (cp < 0x80)
+            {
+                *dst++ = static_cast<char>(cp);
+                continue;
+            }
+
+            if (cp >= 0xD800 && cp <= 0xDBFF && i < count && data[i] >= 0xDC00 && data[i] <= 0xDFFF)
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (data[i++] - 0xDC00);
+            else if (cp >= 0xD800 && cp <= 0xDFFF)
+                cp = 0xFFFD;
+
+            if (cp < 0x800)
+            {
+                *dst++ = static_cast<char>(0xC0 | (cp >> 6));
+                *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+                *dst++ = static_cast<char>(0xE0 | (cp >> 12));
+                *dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                *dst++ = static_cast<char>(0xF0 | (cp >> 18));
+                *dst++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                *dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+            }
+        }
+
+        return dst - out;
+    }
+
+#ifdef TEXTENC_X86
+    bool HasAVX2()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+        if (!(ecx & (1u << 27)) || !(ecx & (1u << 28)))
+            return false;
+
+        unsigned int xcr0lo, xcr0hi;
+        __asm__("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+        if ((xcr0lo & 6) != 6)
+            return false;
+
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
+        return (ebx & (1u << 5)) != 0;
+#endif
+    }
+
+    const bool g_bHasAVX2 = HasAVX2();
+
+    // Skip the leading ASCII run 16 bytes at a time
+    inline size_t SkipASCII(const uint8_t* p, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+            if (mask)
+            {
+#ifdef _MSC_VER
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                return i + bit;
+#else
+                return i + __builtin_ctz(mask);
+#endif
+            }
+        }
+
+        while (i < size && p[i] < 0x80)
+            ++i;
+
+        return i;
+    }
+
+    // Classification bits of the lookup validator (Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte")
+    const uint8_t TOO_SHORT = 1 << 0;
+    const uint8_t TOO_LONG = 1 << 1;
+    const uint8_t OVERLONG_3 = 1 << 2;
+    const uint8_t TOO_LARGE = 1 << 3;
+    const uint8_t SURROGATE = 1 << 4;
+    const uint8_t OVERLONG_2 = 1 << 5;
+    const uint8_t TOO_LARGE_1000 = 1 << 6;
+    const uint8_t OVERLONG_4 = 1 << 6;
+    const uint8_t TWO_CONTS = 1 << 7;
+    const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    TEXTENC_AVX2 inline __m256i Lookup16(__m256i index, const uint8_t (&table)[16])
+    {
+        __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table));
+        return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(t), index);
+    }
+
+    TEXTENC_AVX2 inline __m256i HighNibble(__m256i v)
+    {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    }
+
+    // Bytes of input shifted by N with the last bytes of prev in front
+    template <int N>
+    TEXTENC_AVX2 inline __m256i Prev(__m256i input, __m256i prev)
+    {
+        return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+    }
+
+    TEXTENC_AVX2 __m256i CheckBlock(__m256i input, __m256i prev)
+    {
+        static const uint8_t byte1High[16] = {
+            // 0_______ ASCII
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            // 10______ continuation
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            // 1100____
+            TOO_SHORT | OVERLONG_2,
+            // 1101____
+            TOO_SHORT,
+            // 1110____
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            // 1111____
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+        };
+        static const uint8_t byte1Low[16] = {
+            // ____0000
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            // ____0001
+            CARRY | OVERLONG_2,
+            // ____001_
+            CARRY,
+            CARRY,
+            // ____0100
+            CARRY | TOO_LARGE,
+            // ____0101 and above
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            // ____1101
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000
+        };
+        static const uint8_t byte2High[16] = {
+            // 0_______ ASCII
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            // 1000____
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+            // 1001____
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            // 101_____
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            // 11______
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+        };
+
+        __m256i prev1 = Prev<1>(input, prev);
+        __m256i special = _mm256_and_si256(
+            _mm256_and_si256(Lookup16(HighNibble(prev1), byte1High),
+                             Lookup16(_mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)), byte1Low)),
+            Lookup16(HighNibble(input), byte2High));
+
+        // Third and fourth bytes of 3 and 4 bytes sequences must be continuations
+        __m256i prev2 = Prev<2>(input, prev);
+        __m256i prev3 = Prev<3>(input, prev);
+        __m256i isThird = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+        __m256i isFourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+        __m256i must23 = _mm256_and_si256(_mm256_or_si256(isThird, isFourth), _mm256_set1_epi8((char)0x80));
+
+        return _mm256_xor_si256(must23, special);
+    }
+
+    // Non zero when the block ends inside a sequence
+    TEXTENC_AVX2 inline __m256i IsIncomplete(__m256i input)
+    {
+        const __m256i maxValue = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+
+        return _mm256_subs_epu8(input, maxValue);
+    }
+
+    // Offset of the first 32 bytes block containing an error, size when valid.
+    // The reported block is only a hint, the exact offset is found by the scalar code.
+    TEXTENC_AVX2 size_t FindErrorBlockAVX2(const uint8_t* p, size_t size)
+    {
+        __m256i prev = _mm256_setzero_si256();
+        __m256i prevIncomplete = _mm256_setzero_si256();
+        size_t i = 0;
+
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+
+            if (_mm256_movemask_epi8(input) == 0)
+            {
+                // ASCII block, only a sequence left open by the previous block is an error
+                if (!_mm256_testz_si256(prevIncomplete, prevIncomplete))
+                    return i;
+            }
+            else
+            {
+                __m256i error = CheckBlock(input, prev);
+                if (!_mm256_testz_si256(error, error))
+                    return i;
+                prevIncomplete = IsIncomplete(input);
+            }
+
+            prev = input;
+        }
+
+        return i;
+    }
+#endif
+}
+
+TextBOM DetectBOM(const char* data, size_t size, size_t& bomSize)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+
+    if (size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF)
+    {
+        bomSize = 3;
+        return BOM_UTF8;
+    }
+    if (size >= 2 && p[0] == 0xFF && p[1] == 0xFE)
+    {
+        bomSize = 2;
+        return BOM_UTF16LE;
+    }
+    if (size >= 2 && p[0] == 0xFE && p[1] == 0xFF)
+    {
+        bomSize = 2;
+        return BOM_UTF16BE;
+    }
+
+    bomSize = 0;
+    return BOM_NONE;
+}
+
+bool ValidateUTF8Scalar(const char* data, size_t size, size_t* pErrorOffset)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    size_t i = 0;
+
+    while (i < size)
+    {
+        if (p[i] < 0x80)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t len = DecodeLength(p + i, size - i);
+        if (len == 0)
+        {
+            if (pErrorOffset)
+                *pErrorOffset = i;
+            return false;
+        }
+        i += len;
+    }
+
+    return true;
+}
+
+bool ValidateUTF8(const char* data, size_t size, size_t* pErrorOffset)
+{
+#ifdef TEXTENC_X86
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    size_t start = 0;
+
+    if (g_bHasAVX2)
+    {
+        // Everything before the reported block is valid, except a sequence
+        // crossing into it which the scalar code checks again from its lead byte
+        size_t block = FindErrorBlockAVX2(p, size);
+        start = block ? FindSequenceStart(p, block - 1) : 0;
+    }
+    else
+    {
+        // Validate byte by byte only where the text isn't ASCII
+        size_t i = 0;
+        while (i < size)
+        {
+            i += SkipASCII(p + i, size - i);
+            if (i >= size)
+                return true;
+
+            size_t len = DecodeLength(p + i, size - i);
+            if (len == 0)
+            {
+                if (pErrorOffset)
+                    *pErrorOffset = i;
+                return false;
+            }
+            i += len;
+        }
+        return true;
+    }
+
+    size_t offset = 0;
+    if (ValidateUTF8Scalar(data + start, size - start, &offset))
+        return true;
+    if (pErrorOffset)
+        *pErrorOffset = start + offset;
+    return false;
+#else
+    return ValidateUTF8Scalar(data, size, pErrorOffset);
+#endif
+}
+
+size_t ConvertUTF8ToUTF16(const char* data, size_t size, char16_t* out)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    char16_t* dst = out;
+    size_t i = 0;
+
+    while (i < size)
+    {
+#ifdef TEXTENC_X86
+        // Widen the ASCII runs 16 bytes at a time
+        const __m128i zero = _mm_setzero_si128();
+        while (i + 16 <= size)
+        {
+            __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            if (_mm_movemask_epi8(input))
+                break;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(input, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpackhi_epi8(input, zero));
+            i += 16;
+            dst += 16;
+        }
+        if (i >= size)
+            break;
+#endif
+        uint8_t c = p[i];
+        if (c < 0x80)
+        {
+            *dst++ = c;
+            ++i;
+            continue;
+        }
+
+        size_t len = DecodeLength(p + i, size - i);
+        if (len == 0)
+        {
+            *dst++ = 0xFFFD;
+            ++i;
+            continue;
+        }
+
+        uint32_t cp = c & (0x7F >> len);
+        for (size_t j = 1; j < len; ++j)
+            cp = (cp << 6) | (p[i + j] & 0x3F);
+        i += len;
+
+        if (cp < 0x10000)
+            *dst++ = static_cast<char16_t>(cp);
+        else
+        {
+            cp -= 0x10000;
+            *dst++ = static_cast<char16_t>(0xD800 | (cp >> 10));
+            *dst++ = static_cast<char16_t>(0xDC00 | (cp & 0x3FF));
+        }
+    }
+
+    return dst - out;
+}
+
+size_t ConvertUTF16ToUTF8(const char16_t* data, size_t count, char* out)
+{
+    size_t i = 0;
+    size_t n = 0;
+
+#ifdef TEXTENC_X86
+    // Narrow the ASCII runs 16 units at a time
+    const __m128i highMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+    while (i + 16 <= count)
+    {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 8));
+        __m128i high = _mm_and_si128(_mm_or_si128(lo, hi), highMask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF)
+        {
+            // Encode this block and look for ASCII again after it
+            n += EncodeUTF16(data, i, i + 16, count, out + n);
+            continue;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + n), _mm_packus_epi16(lo, hi));
+        i += 16;
+        n += 16;
+    }
+#endif
+
+    n += EncodeUTF16(data, i, count, count, out + n);
+
+    return n;
+}
+
+void ConvertUTF16ToUTF8(const char* data, size_t size, bool bigEndian, std::string& out)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    size_t count = size / 2;
+
+    // The units of the file buffer may be unaligned or big endian
+    std::u16string units(count, 0);
+    for (size_t i = 0; i < count; ++i)
+        units[i] = static_cast<char16_t>(bigEndian ? (p[2 * i] << 8) | p[2 * i + 1] : p[2 * i] | (p[2 * i + 1] << 8));
+
+    out.resize(count * 3);
+    out.resize(ConvertUTF16ToUTF8(units.data(), count, &out[0]));
+}
+
+bool NormalizeToUTF8(std::string& content)
+{
+    size_t bomSize;
+    TextBOM bom = DetectBOM(content.data(), content.size(), bomSize);
+
+    if (bom == BOM_UTF16LE || bom == BOM_UTF16BE)
+    {
+        std::string converted;
+        ConvertUTF16ToUTF8(content.data() + bomSize, content.size() - bomSize, bom == BOM_UTF16BE, converted);
+        content.swap(converted);
+        return true;
+    }
+
+    return ValidateUTF8(content.data() + bomSize, content.size() - bomSize);
+}
@@ -0,0 +1,56 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Encoding detection and validation of subtitle file buffers.
+// Doesn't depend on Windows headers so it can be built and checked anywhere.
+
+#include <cstddef>
+#include <string>
+
+enum TextBOM
+{
+    BOM_NONE,
+    BOM_UTF8,
+    BOM_UTF16LE,
+    BOM_UTF16BE
+};
+
+// Detect the byte order mark at the start of the buffer, bomSize receives its length
+TextBOM DetectBOM(const char* data, size_t size, size_t& bomSize);
+
+// Validate UTF-8, uses AVX2 when available with an SSE2 fast path for ASCII runs.
+// On failure pErrorOffset receives the offset of the first invalid sequence.
+bool ValidateUTF8(const char* data, size_t size, size_t* pErrorOffset = nullptr);
+
+// Plain byte by byte validation, used for the tails and as a reference
+bool ValidateUTF8Scalar(const char* data, size_t size, size_t* pErrorOffset = nullptr);
+
+// Convert a UTF-16 buffer without its BOM to UTF-8, invalid surrogates become U+FFFD
+void ConvertUTF16ToUTF8(const char* data, size_t size, bool bigEndian, std::string& out);
+
+// Conversions into caller buffers with SSE2 fast paths for ASCII runs, nothing is allocated.
+// Invalid sequences become U+FFFD. Both return the number of units written.
+// out must hold size UTF-16 units
+size_t ConvertUTF8ToUTF16(const char* data, size_t size, char16_t* out);
+// out must hold 3 * count bytes
+size_t ConvertUTF16ToUTF8(const char16_t* data, size_t count, char* out);
+
+// Make the buffer UTF-8: UTF-16 files are converted and the UTF-16 BOM dropped.
+// Returns true when the resulting content is valid UTF-8.
+bool NormalizeToUTF8(std::string& content);
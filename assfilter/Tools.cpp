@@ -17,9 +17,20 @@
 
 #include "stdafx.h"
 
-#include <Shlwapi.h>
+#include <cerrno>
 
 #include "Tools.h"
+#include "CodePages.h"
+#include "DebugBenchmark.h"
+#include "PerfectHashTables.h"
+#include "SubRenderOptions.h"
+#include "TextEncoding.h"
+#include "utf8.h"
+
+static_assert(CheckPerfectHash(color_tag_hash, color_tag, &s_color_tag::color), "Run PerfectHashGen.py after changing color_tag");
+static_assert(CheckPerfectHash(iso639_lang3_hash, iso639_lang, &s_iso639_lang::lang3), "Run PerfectHashGen.py after changing iso639_lang");
+static_assert(CheckPerfectHash(iso639_lang2_hash, iso639_lang, &s_iso639_lang::lang2), "Run PerfectHashGen.py after changing iso639_lang");
+static_assert(CheckPerfectHash(subrender_option_hash, subrender_option, &s_subrender_option::name), "Run PerfectHashGen.py after changing subrender_option");
 
 // Find(oldString) and replace(newString) in a string(line)
 template <typename T>
@@ -70,24 +81,64 @@ void tokenize(const std::wstring& str, std::vector<std::wstring>& tokens, const
     }
 }
 
+static_assert(sizeof(wchar_t) == sizeof(char16_t), "std::wstring must hold UTF-16");
+
 std::wstring s2ws(const std::string& str)
 {
-    using convert_typeX = std::codecvt_utf8<wchar_t>;
-    std::wstring_convert<convert_typeX, wchar_t> converterX;
-
-    return converterX.from_bytes(str);
+    std::wstring wstr;
+    s2ws(str, wstr);
+    return wstr;
 }
 
 std::string ws2s(const std::wstring& wstr)
 {
-    using convert_typeX = std::codecvt_utf8<wchar_t>;
-    std::wstring_convert<convert_typeX, wchar_t> converterX;
+    std::string str;
+    AppendUTF8(str, wstr);
+    return str;
+}
+
+void s2ws(const std::string& str, std::wstring& out)
+{
+    out.resize(str.size());
+    if (!str.empty())
+        out.resize(ConvertUTF8ToUTF16(str.data(), str.size(), reinterpret_cast<char16_t*>(&out[0])));
+}
+
+void ws2s(const std::wstring& wstr, std::string& out)
+{
+    out.clear();
+    AppendUTF8(out, wstr);
+}
+
+void AppendUTF8(std::string& out, const std::wstring& wstr)
+{
+    if (wstr.empty())
+        return;
+
+    size_t pos = out.size();
+    out.resize(pos + wstr.size() * 3);
+    out.resize(pos + ConvertUTF16ToUTF8(reinterpret_cast<const char16_t*>(wstr.data()), wstr.size(), &out[pos]));
+}
 
-    return converterX.to_bytes(wstr);
+// Copy for the callers that free the string with LocalFree, nullptr when out of memory
+LPWSTR LocalAllocString(const std::wstring& str)
+{
+    LPWSTR copy = (LPWSTR)LocalAlloc(0, (str.length() + 1) * sizeof(WCHAR));
+    if (copy)
+        memcpy(copy, str.c_str(), (str.length() + 1) * sizeof(WCHAR));
+    return copy;
 }
 
 void ConvertCPToUTF8(UINT CP, std::string& codepage_str)
 {
+    // Single byte code pages are converted directly
+    std::string utf8_str;
+    if (ConvertTableCodePageToUTF8(CP, codepage_str.data(), codepage_str.size(), utf8_str))
+    {
+        codepage_str.swap(utf8_str);
+        return;
+    }
+
     int size = MultiByteToWideChar(CP, MB_PRECOMPOSED, codepage_str.c_str(),
         (int)codepage_str.length(), nullptr, 0);
 
@@ -99,40 +150,54 @@ void ConvertCPToUTF8(UINT CP, std::string& codepage_str)
         (int)utf16_str.length(), nullptr, 0,
         nullptr, nullptr);
 
-    std::string utf8_str(utf8_size, '\0');
+    utf8_str.assign(utf8_size, '\0');
     WideCharToMultiByte(CP_UTF8, 0, utf16_str.c_str(),
         (int)utf16_str.length(), &utf8_str[0], utf8_size,
         nullptr, nullptr);
-    codepage_str.assign(utf8_str);
+    codepage_str.swap(utf8_str);
 }
 
 UINT GetLanguageCP(const std::wstring& langCode, bool isCode2Chars)
 {
-    for (auto i = 0; i < _countof(iso639_lang); ++i)
-    {
-        if (wcscmp(langCode.c_str(), isCode2Chars ? iso639_lang[i].lang2 : iso639_lang[i].lang3) == 0)
-            return iso639_lang[i].codepage;
+    int index = FindLanguage(langCode.c_str(), langCode.size(), isCode2Chars);
 
-        // Language unknown
-        if (i == _countof(iso639_lang) - 1)
-            return 0;
-    }
+    // Language unknown
+    return index >= 0 ? iso639_lang[index].codepage : 0;
+}
+
+bool ReadFileContent(const std::wstring& file, std::string& content)
+{
+    std::ifstream f(file, std::ios::in | std::ios::binary);
+    if (!f.good())
+        return false;
+
+    f.seekg(0, std::ios::end);
+    std::streamoff size = f.tellg();
+    if (size < 0)
+        return false;
+    f.seekg(0, std::ios::beg);
+
+    content.resize(static_cast<size_t>(size));
+    if (size > 0)
+        f.read(&content[0], size);
 
-    return 0;
+    return !f.bad();
 }
 
-std::wstring ExtractYuvMatrix(const std::wstring& file)
+std::wstring ExtractYuvMatrix(const std::string& content)
 {
     std::string lineIn;
-    char inBuffer[BUFSIZ];
-    std::ifstream f(file, std::ios::in);
+    size_t pos = 0;
     size_t line = 0;
 
     // Don't scan more than the first 30 lines
-    while (!f.eof() && line < 30)
+    while (pos < content.size() && line < 30)
     {
-        f.getline(inBuffer, sizeof(inBuffer) - 1);
-        lineIn.assign(inBuffer);
+        size_t eol = content.find('\n', pos);
+        if (eol == std::string::npos)
+            eol = content.size();
+        lineIn.assign(content, pos, eol - pos);
+        pos = eol + 1;
         ++line;
 
         if (lineIn.empty())
@@ -152,285 +217,257 @@ std::wstring ExtractYuvMatrix(const std::wstring& file)
     return s2ws(lineIn);
 }
 
-std::string ConsumeAttribute(const char** ppsz_subtitle, std::string& attribute_value)
+static inline bool IsAsciiAlpha(char c)
 {
-    const char* psz_subtitle = *ppsz_subtitle;
-    char psz_attribute_name[BUFSIZ];
-    char psz_attribute_value[BUFSIZ];
-
-    while (*psz_subtitle == ' ')
-        psz_subtitle++;
-
-    size_t attr_len = 0;
-    char delimiter;
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
 
-    while (*psz_subtitle && isalpha(*psz_subtitle))
-    {
-        psz_subtitle++;
-        attr_len++;
-    }
+static inline bool IsAsciiAlnum(char c)
+{
+    return IsAsciiAlpha(c) || (c >= '0' && c <= '9');
+}
 
-    if (!*psz_subtitle || attr_len == 0)
-        return std::string();
+static inline bool IsAsciiSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
 
-    strncpy_s(psz_attribute_name, psz_subtitle - attr_len, attr_len);
-    psz_attribute_name[attr_len] = 0;
+// Length of the tag name starting at psz, 0 when it isn't a valid tag
+static size_t GetTagLength(const char* psz)
+{
+    if (!IsAsciiAlpha(*psz))
+        return 0;
 
-    // Skip over to the attribute value
-    while (*psz_subtitle && *psz_subtitle != '=')
-        psz_subtitle++;
+    size_t len = 1;
+    while (IsAsciiAlnum(psz[len]) || psz[len] == '_')
+        len++;
 
-    // Skip the '=' sign
-    psz_subtitle++;
+    return len;
+}
 
-    // Aknowledge the delimiter if any
-    while (*psz_subtitle && isspace(*psz_subtitle))
-        psz_subtitle++;
+static inline bool IsTag(const char* psz, size_t len, const char* name, size_t nameLen)
+{
+    return len == nameLen && _strnicmp(psz, name, len) == 0;
+}
 
-    if (*psz_subtitle == '\'' || *psz_subtitle == '"')
+#define SRT_TAG(name) name, sizeof(name) - 1
+
+// HTML tags with a fixed translation, font is handled apart for its attributes
+static const struct s_srt_tag {
+    const char* name;
+    size_t nameLen;
+    const char* open;
+    size_t openLen;
+    const char* close;
+    size_t closeLen;
+} srt_tag[] = {
+    { SRT_TAG("b"),     SRT_TAG("{\\b1}"),  SRT_TAG("{\\b0}") },
+    { SRT_TAG("i"),     SRT_TAG("{\\i1}"),  SRT_TAG("{\\i0}") },
+    { SRT_TAG("u"),     SRT_TAG("{\\u1}"),  SRT_TAG("{\\u0}") },
+    { SRT_TAG("s"),     SRT_TAG("{\\s1}"),  SRT_TAG("{\\s0}") },
+    { SRT_TAG("br"),    SRT_TAG("\\N"),     SRT_TAG("") },
+};
+
+static const s_srt_tag* FindSrtTag(const char* psz, size_t len)
+{
+    for (const auto& tag : srt_tag)
     {
-        // Save the delimiter and skip it
-        delimiter = *psz_subtitle;
-        psz_subtitle++;
+        if (IsTag(psz, len, tag.name, tag.nameLen))
+            return &tag;
     }
-    else
-        delimiter = 0;
-
-    // Skip spaces, just in case
-    while (*psz_subtitle && isspace(*psz_subtitle))
-        psz_subtitle++;
 
-    // Skip the first #
-    if (*psz_subtitle == '#')
-        psz_subtitle++;
+    return nullptr;
+}
 
-    attr_len = 0;
-    while (*psz_subtitle && ((delimiter != 0 && *psz_subtitle != delimiter) ||
-        (delimiter == 0 && (isalnum(*psz_subtitle) || *psz_subtitle == '#'))))
-    {
-        psz_subtitle++;
-        attr_len++;
-    }
+// Read the next attribute of a font tag, ppsz is left untouched when there is none
+static bool ConsumeAttribute(const char** ppsz, const char** pName, size_t* pNameLen, std::string& value)
+{
+    const char* psz = *ppsz;
 
-    strncpy_s(psz_attribute_value, psz_subtitle - attr_len, attr_len);
-    psz_attribute_value[attr_len] = 0;
-    attribute_value.assign(psz_attribute_value);
+    while (*psz == ' ')
+        psz++;
 
-    // Finally, skip over the final delimiter
-    if (delimiter != 0 && *psz_subtitle)
-        psz_subtitle++;
+    const char* name = psz;
+    while (IsAsciiAlpha(*psz))
+        psz++;
 
-    *ppsz_subtitle = psz_subtitle;
+    if (!*psz || psz == name)
+        return false;
 
-    return std::string(psz_attribute_name);
-}
+    // Skip over to the attribute value
+    const char* nameEnd = psz;
+    while (*psz && *psz != '=')
+        psz++;
 
-std::string GetTag(const char** line, bool b_closing)
-{
-    const char* psz_subtitle = *line;
+    if (!*psz)
+        return false;
+    psz++;
 
-    if (*psz_subtitle != '<')
-        return std::string();
+    while (IsAsciiSpace(*psz))
+        psz++;
 
-    // Skip the '<'
-    psz_subtitle++;
+    // Acknowledge the delimiter if any
+    char delimiter = 0;
+    if (*psz == '\'' || *psz == '"')
+        delimiter = *psz++;
 
-    if (b_closing && *psz_subtitle == '/')
-        psz_subtitle++;
+    while (IsAsciiSpace(*psz))
+        psz++;
 
-    // Skip potential spaces
-    while (*psz_subtitle == ' ')
-        psz_subtitle++;
+    // Skip the first #
+    if (*psz == '#')
+        psz++;
 
-    // Now we need to verify if what comes next is a valid tag:
-    if (!isalpha(*psz_subtitle))
-        return std::string();
+    const char* valueStart = psz;
+    if (delimiter)
+    {
+        while (*psz && *psz != delimiter)
+            psz++;
+    }
+    else
+    {
+        while (IsAsciiAlnum(*psz) || *psz == '#')
+            psz++;
+    }
+    value.assign(valueStart, psz - valueStart);
 
-    size_t tag_size = 1;
-    while (isalnum(psz_subtitle[tag_size]) || psz_subtitle[tag_size] == '_')
-        tag_size++;
+    // Skip over the final delimiter
+    if (delimiter && *psz)
+        psz++;
 
-    char psz_tagname[BUFSIZ];
-    strncpy_s(psz_tagname, psz_subtitle, tag_size);
-    psz_tagname[tag_size] = 0;
-    psz_subtitle += tag_size;
-    *line = psz_subtitle;
+    *ppsz = psz;
+    *pName = name;
+    *pNameLen = nameEnd - name;
 
-    return std::string(psz_tagname);
+    return true;
 }
 
-bool IsClosed(const char* psz_subtitle, const char* psz_tagname)
+static inline void AppendFontSize(std::string& output, int fontSize)
 {
-    const char* psz_tagpos = StrStrIA(psz_subtitle, psz_tagname);
-
-    if (!psz_tagpos)
-        return false;
-
-    // Search for '</' and '>' immediatly before & after (minding the potential spaces)
-    const char* psz_endtag = psz_tagpos + strlen(psz_tagname);
+    char buffer[16];
+    int len = _snprintf_s(buffer, _TRUNCATE, "{\\fs%d}", fontSize);
+    if (len > 0)
+        output.append(buffer, len);
+}
 
-    while (*psz_endtag == ' ')
-        psz_endtag++;
+// Same parsing as std::stod without the exceptions
+static bool ParseDouble(const std::string& str, double& val)
+{
+    const char* psz = str.c_str();
+    char* end;
 
-    if (*psz_endtag != '>')
-        return false;
+    errno = 0;
+    val = strtod(psz, &end);
 
-    // Skip back before the tag itself
-    psz_tagpos--;
-    while (*psz_tagpos == ' ' && psz_tagpos > psz_subtitle)
-        psz_tagpos--;
+    return end != psz && errno != ERANGE;
+}
 
-    if (*psz_tagpos-- != '/')
-        return false;
+static void AppendFontAttribute(std::string& output, const char* name, size_t nameLen, std::string& value, const AssFSettings& settings)
+{
+    if (IsTag(name, nameLen, "face", 4))
+    {
+        output.append("{\\fn").append(value).push_back('}');
+    }
+    else if (IsTag(name, nameLen, "size", 4))
+    {
+        double size;
+        if (ParseDouble(value, size))
+        {
+            double resy = settings.SrtResY / 288.0;
+            AppendFontSize(output, (int)std::round(size * resy));
+        }
+    }
+    else if (IsTag(name, nameLen, "color", 5))
+    {
+        MatchColorSrt(value);
 
-    if (*psz_tagpos != '<')
-        return false;
+        // If color is invalid, use WHITE
+        if ((strtoul(value.c_str(), NULL, 16) == 0) && (value != "000000"))
+            value.assign("FFFFFF");
 
-    return true;
+        // HTML is RGB and we need BGR for libass
+        if (value.size() >= 6)
+            swapRGBtoBGR(value);
+        output.append("{\\c&H").append(value).append("&}");
+    }
 }
 
+// Convert the HTML and MicroDVD tags of a SRT line to ASS override tags in a single pass
 void ParseSrtLine(std::string& srtLine, const AssFSettings& settings)
 {
-    const char *psz_subtitle = srtLine.data();
-    std::string subtitle_output;
+    const char* psz = srtLine.c_str();
+    std::string output;
+    std::string value;
+    const double resy = settings.SrtResY / 288.0;
 
-    while (*psz_subtitle)
+    // Most tags translate to about the same length
+    output.reserve(srtLine.size() + srtLine.size() / 2 + 16);
+
+    while (*psz)
     {
         /* HTML extensions */
-        if (*psz_subtitle == '<')
+        if (*psz == '<')
         {
-            std::string tagname = GetTag(&psz_subtitle, false);
-            if (!tagname.empty())
+            const char* tag = psz + 1;
+            bool closing = *tag == '/';
+            if (closing)
+                tag++;
+            while (*tag == ' ')
+                tag++;
+
+            size_t tagLen = GetTagLength(tag);
+            if (!tagLen)
             {
-                // Convert tagname to lowercase
-                std::transform(tagname.begin(), tagname.end(), tagname.begin(), ::tolower);
-                if (tagname == "br")
-                {
-                    subtitle_output.append("\\N");
-                }
-                else if (tagname == "b")
-                {
-                    subtitle_output.append("{\\b1}");
-                }
-                else if (tagname == "i")
-                {
-                    subtitle_output.append("{\\i1}");
-                }
-                else if (tagname == "u")
-                {
-                    subtitle_output.append("{\\u1}");
-                }
-                else if (tagname == "s")
-                {
-                    subtitle_output.append("{\\s1}");
-                }
-                else if (tagname == "font")
-                {
-                    std::string attribute_name;
-                    std::string attribute_value;
-
-                    attribute_name = ConsumeAttribute(&psz_subtitle, attribute_value);
-                    while (!attribute_name.empty())
-                    {
-                        // Convert attribute_name to lowercase
-                        std::transform(attribute_name.begin(), attribute_name.end(), attribute_name.begin(), ::tolower);
-                        if (attribute_name == "face")
-                        {
-                            subtitle_output.append("{\\fn" + attribute_value + "}");
-                        }
-                        else if (attribute_name == "family")
-                        {
-                        }
-                        if (attribute_name == "size")
-                        {
-                            double resy = settings.SrtResY / 288.0;
-                            int font_size = (int)std::round(std::stod(attribute_value) * resy);
-                            subtitle_output.append("{\\fs" + std::to_string(font_size) + "}");
-                        }
-                        else if (attribute_name == "color")
-                        {
-                            MatchColorSrt(attribute_value);
+                // Not a tag, keep the '<' and move on
+                output.push_back('<');
+                psz++;
+                continue;
+            }
 
-                            // If color is invalid, use WHITE
-                            if ((strtoul(attribute_value.c_str(), NULL, 16) == 0) && (attribute_value != "000000"))
-                                attribute_value.assign("FFFFFF");
+            const char* tagEnd = tag + tagLen;
+            const s_srt_tag* srtTag = FindSrtTag(tag, tagLen);
+            bool font = !srtTag && IsTag(tag, tagLen, "font", 4);
 
-                            // HTML is RGB and we need BGR for libass
-                            swapRGBtoBGR(attribute_value);
-                            subtitle_output.append("{\\c&H" + attribute_value + "&}");
-                        }
-                        attribute_name = ConsumeAttribute(&psz_subtitle, attribute_value);
-                    }
+            if (!closing)
+            {
+                psz = tagEnd;
+                if (srtTag)
+                {
+                    output.append(srtTag->open, srtTag->openLen);
                 }
-                else
+                else if (font)
                 {
-                    // This is an unknown tag. We need to hide it if it's properly closed, and display it otherwise
-                    if (!IsClosed(psz_subtitle, tagname.c_str()))
-                    {
-                        //subtitle_output.append("<" + tagname + ">");
-                    }
-                    else
-                    {
-                    }
-                    // In any case, fall through and skip to the closing tag.
+                    const char* name;
+                    size_t nameLen;
+                    while (ConsumeAttribute(&psz, &name, &nameLen, value))
+                        AppendFontAttribute(output, name, nameLen, value, settings);
                 }
-                // Skip potential spaces & end tag
-                while (*psz_subtitle && *psz_subtitle != '>')
-                    psz_subtitle++;
-                if (*psz_subtitle == '>')
-                    psz_subtitle++;
+                // Unknown tags are hidden
 
+                // Skip to the end of the tag
+                while (*psz && *psz != '>')
+                    psz++;
             }
-            else if (!strncmp(psz_subtitle, "</", 2))
+            else
             {
-                std::string tagname = GetTag(&psz_subtitle, true);
-                if (!tagname.empty())
+                psz = tagEnd;
+                if (srtTag)
                 {
-                    std::transform(tagname.begin(), tagname.end(), tagname.begin(), ::tolower);
-                    if (tagname == "b")
-                    {
-                        subtitle_output.append("{\\b0}");
-                    }
-                    else if (tagname == "i")
-                    {
-                        subtitle_output.append("{\\i0}");
-                    }
-                    else if (tagname == "u")
-                    {
-                        subtitle_output.append("{\\u0}");
-                    }
-                    else if (tagname == "s")
-                    {
-                        subtitle_output.append("{\\s0}");
-                    }
-                    else if (tagname == "font")
-                    {
-                        double resy = settings.SrtResY / 288.0;
-                        int font_size = (int)std::round(settings.FontSize * resy);
-                        subtitle_output.append("{\\c}");
-                        subtitle_output.append("{\\fn" + ws2s(settings.FontName) + "}");
-                        subtitle_output.append("{\\fs" + std::to_string(font_size) + "}");
-                    }
-                    else
-                    {
-                        // Unknown closing tag. If it is closing an unknown tag, ignore it. Otherwise, display it
-                        //subtitle_output.append("</" + tagname + ">");
-                    }
-                    while (*psz_subtitle == ' ')
-                        psz_subtitle++;
-                    if (*psz_subtitle == '>')
-                        psz_subtitle++;
+                    output.append(srtTag->close, srtTag->closeLen);
                 }
+                else if (font)
+                {
+                    // Back to the style font, the style carries the font settings
+                    output.append("{\\c}{\\fn}{\\fs}");
+                }
+                // Unknown closing tags are hidden
+
+                while (*psz == ' ')
+                    psz++;
             }
-            else
-            {
-                /* We have an unknown tag, just append it, and move on.
-                * The rest of the string won't be recognized as a tag, and
-                * we will ignore unknown closing tag
-                */
-                subtitle_output.push_back('<');
-                psz_subtitle++;
-            }
+
+            if (*psz == '>')
+                psz++;
         }
         /* MicroDVD extensions */
         /* FIXME:
@@ -439,121 +476,168 @@ void ParseSrtLine(std::string& srtLine, const AssFSettings& settings)
         *  - We don't support Position and Coordinates
         *  - We don't support the DEFAULT flag (HEADER)
         */
-        else if (psz_subtitle[0] == '{' && psz_subtitle[2] == ':' && strchr(&psz_subtitle[2], '}'))
+        else if (*psz == '{' && psz[1] && psz[2] == ':' && strchr(&psz[2], '}'))
         {
-            const char *psz_tag_end = strchr(&psz_subtitle[2], '}');
-            size_t i_len = psz_tag_end - &psz_subtitle[3];
+            const char* tagEnd = strchr(&psz[2], '}');
+            const char* arg = &psz[3];
+            size_t argLen = tagEnd - arg;
 
-            if (psz_subtitle[1] == 'Y' || psz_subtitle[1] == 'y')
+            switch (psz[1])
             {
-                if (psz_subtitle[3] == 'i')
+            case 'Y':
+            case 'y':
+                // Only in this order, each flag found shifts the next check by one
+                if (*arg == 'i')
                 {
-                    subtitle_output.append("{\\i1}");
-                    psz_subtitle++;
-                }
-                if (psz_subtitle[3] == 'b')
-                {
-                    subtitle_output.append("{\\b1}");
-                    psz_subtitle++;
+                    output.append("{\\i1}");
+                    arg++;
                 }
-                if (psz_subtitle[3] == 'u')
+                if (*arg == 'b')
                 {
-                    subtitle_output.append("{\\u1}");
-                    psz_subtitle++;
+                    output.append("{\\b1}");
+                    arg++;
                 }
-            }
-            else if ((psz_subtitle[1] == 'C' || psz_subtitle[1] == 'c')
-                && psz_subtitle[3] == '$' && i_len >= 7)
-            {
+                if (*arg == 'u')
+                    output.append("{\\u1}");
+                break;
+            case 'C':
+            case 'c':
                 /* Yes, they use BBGGRR */
-                char psz_color[7];
-                psz_color[0] = psz_subtitle[4]; psz_color[1] = psz_subtitle[5];
-                psz_color[2] = psz_subtitle[6]; psz_color[3] = psz_subtitle[7];
-                psz_color[4] = psz_subtitle[8]; psz_color[5] = psz_subtitle[9];
-                psz_color[6] = '\0';
-                subtitle_output.append("{\\c&H").append(psz_color).append("&}");
-            }
-            else if (psz_subtitle[1] == 'F' || psz_subtitle[1] == 'f')
+                if (*arg == '$' && argLen >= 7)
+                    output.append("{\\c&H").append(arg + 1, 6).append("&}");
+                break;
+            case 'F':
+            case 'f':
+                output.append("{\\fn").append(arg, argLen).push_back('}');
+                break;
+            case 'S':
+            case 's':
             {
-                std::string font_name(&psz_subtitle[3], i_len);
-                subtitle_output.append("{\\fn" + font_name + "}");
-            }
-            else if (psz_subtitle[1] == 'S' || psz_subtitle[1] == 's')
-            {
-                int size = atoi(&psz_subtitle[3]);
+                int size = atoi(arg);
                 if (size)
-                {
-                    double resy = settings.SrtResY / 288.0;
-                    int font_size = (int)std::round(size * resy);
-                    subtitle_output.append("{\\fs" + std::to_string(font_size) + "}");
-                }
+                    AppendFontSize(output, (int)std::round(size * resy));
+                break;
+            }
             }
             // Hide other {x:y} atrocities, notably {o:x}
-            psz_subtitle = psz_tag_end + 1;
+            psz = tagEnd + 1;
+        }
+        else if (*psz == '\n')
+        {
+            output.append("\\N");
+            psz++;
+        }
+        else if (*psz == '\\' && (psz[1] == 'n' || psz[1] == 'N'))
+        {
+            output.append("\\N");
+            psz += 2;
+        }
+        else if (*psz == '\r')
+        {
+            psz++;
         }
         else
         {
-            if (*psz_subtitle == '\n' || !_strnicmp(psz_subtitle, "\\n", 2))
-            {
-                subtitle_output.append("\\N");
-
-                if (*psz_subtitle == '\n')
-                    psz_subtitle++;
-                else
-                    psz_subtitle += 2;
-            }
-            else if (*psz_subtitle == '\r')
-            {
-                psz_subtitle++;
-            }
-            else
-            {
-                subtitle_output.push_back(*psz_subtitle);
-                psz_subtitle++;
-            }
+            // Copy the plain text up to the next special character at once
+            const char* text = psz++;
+            while (*psz && *psz != '<' && *psz != '{' && *psz != '\n' && *psz != '\r' && *psz != '\\')
+                psz++;
+            output.append(text, psz - text);
         }
     }
-    srtLine.assign(subtitle_output);
+
+    srtLine.swap(output);
 }
 
 // Match color name to its hex counterpart
 void MatchColorSrt(std::string& fntColor)
 {
-    for (auto i = 0; i < _countof(color_tag); ++i)
-    {
-        if (strcmp(fntColor.c_str(), color_tag[i].color) == 0)
-        {
-            fntColor.assign(color_tag[i].hex);
-            break;
-        }
-    }
+    int index = FindColorTag(fntColor.data(), fntColor.size());
+    if (index >= 0)
+        fntColor.assign(color_tag[index].hex);
 }
 
 std::wstring MatchLanguage(const std::wstring& langCode, bool isCode2Chars)
 {
-    for (auto i = 0; i < _countof(iso639_lang); ++i)
-    {
-        if (wcscmp(langCode.c_str(), isCode2Chars ? iso639_lang[i].lang2 : iso639_lang[i].lang3) == 0)
-            return std::wstring(iso639_lang[i].language);
+    int index = FindLanguage(langCode.c_str(), langCode.size(), isCode2Chars);
 
-        // Language unknown
-        if (i == _countof(iso639_lang) - 1)
-            return std::wstring(L"Unknown");
-    }
+    // Language unknown
+    return std::wstring(index >= 0 ? iso639_lang[index].language : L"Unknown");
+}
+
+int FindColorTag(const char* name, size_t len)
+{
+    return PerfectHashFind(color_tag_hash, color_tag, &s_color_tag::color, name, len);
+}
+
+int FindSubRenderOption(const char* field, SubRenderOptionType type)
+{
+    if (!field)
+        return -1;
+
+    int index = PerfectHashFind(subrender_option_hash, subrender_option, &s_subrender_option::name, field, strlen(field));
+
+    return index >= 0 && subrender_option[index].type == type ? index : -1;
+}
+
+int FindLanguage(const wchar_t* code, size_t len, bool isCode2Chars)
+{
+    if (isCode2Chars)
+        return PerfectHashFind(iso639_lang2_hash, iso639_lang, &s_iso639_lang::lang2, code, len);
 
-    return std::wstring(L"ERROR!!!");
+    return PerfectHashFind(iso639_lang3_hash, iso639_lang, &s_iso639_lang::lang3, code, len);
 }
 
 ASS_Track* srt_read_file(ASS_Library* library, const std::wstring& fname, const AssFSettings& settings, const UINT codePage)
 {
+    std::string content;
+    if (!ReadFileContent(fname, content))
+        return nullptr;
+
+    return srt_read_memory(library, content.data(), content.size(), settings, codePage);
+}
+
+// Get the next line of the buffer without its line break
+static bool GetBufferLine(const char* data, size_t size, size_t& pos, std::string& line)
+{
+    if (pos >= size)
+    {
+        line.clear();
+        return false;
+    }
+
+    const char* start = data + pos;
+    const char* eol = static_cast<const char*>(memchr(start, '\n', size - pos));
+    size_t len = eol ? eol - start : size - pos;
+    pos += eol ? len + 1 : len;
+
+    if (len && start[len - 1] == '\r')
+        --len;
+    line.assign(start, len);
+
+    return true;
+}
+
+std::string srt_to_ass(const char* data, size_t size, const AssFSettings& settings, const UINT codePage)
+{
+    // Convert the whole file to UTF-8 before splitting it in lines
+    std::string utf8Data;
+    if (codePage != 0)
+    {
+        utf8Data.assign(data, size);
+        ConvertCPToUTF8(codePage, utf8Data);
+        data = utf8Data.data();
+        size = utf8Data.size();
+    }
+
     // Convert SRT to ASS
-    std::ifstream srtFile(fname, std::ios::in);
+    size_t pos = 0;
     std::string lineIn;
     std::string lineOut;
-    char inBuffer[1024];
     char outBuffer[1024];
     int start[4], end[4];
-    ASS_Track* track = ass_new_track(library);
+    std::string script;
+    script.reserve(size + size / 2);
     double resx = settings.SrtResX / 384.0;
     double resy = settings.SrtResY / 288.0;
 
@@ -582,49 +666,116 @@ ASS_Track* srt_read_file(ASS_Library* library, const std::wstring& fname, const
         settings.FontScaleX, settings.FontScaleY, settings.FontSpacing, settings.FontOutline,
         settings.FontShadow, settings.LineAlignment, (int)std::round(settings.MarginLeft * resx),
         (int)std::round(settings.MarginRight * resx), (int)std::round(settings.MarginVertical * resy));
-    ass_process_data(track, outBuffer, static_cast<int>(strnlen_s(outBuffer, sizeof(outBuffer))));
+    script.append(outBuffer);
 
-    while (!srtFile.eof())
+    while (GetBufferLine(data, size, pos, lineIn))
     {
-        srtFile.getline(inBuffer, sizeof(inBuffer) - 1);
-        lineIn.assign(inBuffer);
         if (lineIn.empty())
             continue;
 
         // Read the timecodes
-        if (sscanf_s(inBuffer, "%d:%2d:%2d%*1[,.]%3d --> %d:%2d:%2d%*1[,.]%3d", &start[0], &start[1],
+        if (sscanf_s(lineIn.c_str(), "%d:%2d:%2d%*1[,.]%3d --> %d:%2d:%2d%*1[,.]%3d", &start[0], &start[1],
             &start[2], &start[3], &end[0], &end[1], &end[2], &end[3]) == 8)
         {
             lineOut.clear();
-            srtFile.getline(inBuffer, sizeof(inBuffer) - 1);
-            lineIn.assign(inBuffer);
+            GetBufferLine(data, size, pos, lineIn);
             while (!lineIn.empty())
             {
                 lineOut.append(lineIn);
-                srtFile.getline(inBuffer, sizeof(inBuffer) - 1);
-                lineIn.assign(inBuffer);
+                GetBufferLine(data, size, pos, lineIn);
                 if (!lineIn.empty())
                     lineOut.append("\\N");
             }
             //lineOut.append("\n");
 
-            // Convert to UTF-8
-            if (codePage != 0)
-                ConvertCPToUTF8(codePage, lineOut);
-
             ParseSrtLine(lineOut, settings);
 
             _snprintf_s(outBuffer, _TRUNCATE, "Dialogue: 0,%d:%02d:%02d.%02d,%d:%02d:%02d.%02d,"
-                "Default,,0,0,0,,{\\blur%u}%s%s",
+                "Default,,0,0,0,,%s",
                 start[0], start[1], start[2],
                 (int)floor((double)start[3] / 10.0), end[0], end[1],
-                end[2], (int)floor((double)end[3] / 10.0), settings.FontBlur, ws2s(settings.CustomTags).c_str(), lineOut.c_str());
-            ass_process_data(track, outBuffer, static_cast<int>(strnlen_s(outBuffer, sizeof(outBuffer))));
+                end[2], (int)floor((double)end[3] / 10.0), lineOut.c_str());
+            script.append(outBuffer).append("\n");
         }
     }
+    return script;
+}
+
+ASS_Track* srt_read_memory(ASS_Library* library, const char* data, size_t size, const AssFSettings& settings, const UINT codePage)
+{
+    std::string script = srt_to_ass(data, size, settings, codePage);
+
+    ASS_Track* track = ass_new_track(library);
+    if (track)
+    {
+        ass_process_data(track, &script[0], static_cast<int>(script.size()));
+        ApplySrtSettings(track, settings);
+    }
+
     return track;
 }
 
+// ASS numpad alignment to the libass one
+static int NumpadToAlign(DWORD numpad)
+{
+    if (numpad < 1 || numpad > 9)
+        numpad = 2;
+
+    int align = (numpad - 1) % 3 + HALIGN_LEFT;
+    if (numpad >= 7)
+        align |= VALIGN_TOP;
+    else if (numpad >= 4)
+        align |= VALIGN_CENTER;
+    else
+        align |= VALIGN_SUB;
+
+    return align;
+}
+
+// Same values as the Default style of the srt_to_ass header, libass keeps the colors as RGBA.
+// The resolution stays the one of the load, the font sizes of the tags in the events are
+// scaled for it.
+void ApplySrtSettings(ASS_Track* track, const AssFSettings& settings)
+{
+    double resx = track->PlayResX / 384.0;
+    double resy = track->PlayResY / 288.0;
+    std::string fontName = ws2s(settings.FontName);
+
+    track->ScaledBorderAndShadow = settings.ScaledBorderAndShadow ? 1 : 0;
+    track->Kerning = settings.Kerning ? 1 : 0;
+
+    // libass adds its own Default style before the one of the header
+    for (int i = 0; i < track->n_styles; ++i)
+    {
+        ASS_Style& style = track->styles[i];
+        if (!style.Name || strcmp(style.Name, "Default") != 0)
+            continue;
+
+        char* name = _strdup(fontName.c_str());
+        if (name)
+        {
+            free(style.FontName);
+            style.FontName = name;
+        }
+
+        style.FontSize = std::round(settings.FontSize * resy);
+        style.PrimaryColour = _byteswap_ulong(settings.ColorPrimary);
+        style.SecondaryColour = _byteswap_ulong(settings.ColorSecondary);
+        style.OutlineColour = _byteswap_ulong(settings.ColorOutline);
+        style.BackColour = _byteswap_ulong(settings.ColorShadow);
+        style.ScaleX = settings.FontScaleX / 100.0;
+        style.ScaleY = settings.FontScaleY / 100.0;
+        style.Spacing = settings.FontSpacing;
+        style.Outline = settings.FontOutline;
+        style.Shadow = settings.FontShadow;
+        style.Blur = settings.FontBlur;
+        style.Alignment = NumpadToAlign(settings.LineAlignment);
+        style.MarginL = (int)std::round(settings.MarginLeft * resx);
+        style.MarginR = (int)std::round(settings.MarginRight * resx);
+        style.MarginV = (int)std::round(settings.MarginVertical * resy);
+    }
+}
+
 std::wstring ParseFontsPath(std::wstring fontsDir, const std::wstring& name)
 {
     if (fontsDir.empty())
@@ -647,25 +798,27 @@ std::wstring ParseFontsPath(std::wstring fontsDir, const std::wstring& name)
     return fontsDir;
 }
 
-std::vector<std::wstring> FindMatchingSubs(const std::wstring& fileName)
+std::vector<std::wstring> ListFontsInFolder(const std::wstring& folder)
 {
     std::vector<std::wstring> names;
-    std::wstring search_path = fileName + L"*";
-    WIN32_FIND_DATAW fd;
+    std::wstring search_path = folder + L"\\*.*";
+    WIN32_FIND_DATA fd;
     HANDLE hFind = FindFirstFileW(search_path.c_str(), &fd);
     if (hFind != INVALID_HANDLE_VALUE)
     {
         do
         {
-            if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            // read all (real) files in current folder
+            // , delete '!' read other 2 default folder . and ..
+            if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
             {
                 std::wstring fn(fd.cFileName);
                 std::transform(fn.begin(), fn.end(), fn.begin(), ::towlower);
-                if ((fn.find(L".ass", fn.find_last_of(L'.')) != std::wstring::npos) || (fn.find(L".srt", fn.find_last_of(L'.')) != std::wstring::npos))
+                if ((fn.find(L".otf", fn.find_last_of(L'.')) != std::wstring::npos) || (fn.find(L".ttf", fn.find_last_of(L'.')) != std::wstring::npos))
                 {
-                    std::wstring fp(fileName.substr(0, fileName.find_last_of(L'\\') + 1));
-                    fp.append(fd.cFileName);
-                    names.push_back(fp);
+                    std::wstring tmp = folder;
+                    tmp.append(fd.cFileName);
+                    names.push_back(tmp);
                 }
             }
         } while (FindNextFileW(hFind, &fd));
@@ -674,31 +827,803 @@ std::vector<std::wstring> FindMatchingSubs(const std::wstring& fileName)
     return names;
 }
 
-std::vector<std::wstring> ListFontsInFolder(const std::wstring& folder)
+// Estimate the heap memory held by a track, the glyph caches belong to the renderer
+size_t GetTrackMemorySize(const ASS_Track* track)
 {
-    std::vector<std::wstring> names;
-    std::wstring search_path = folder + L"\\*.*";
-    WIN32_FIND_DATA fd;
-    HANDLE hFind = FindFirstFileW(search_path.c_str(), &fd);
-    if (hFind != INVALID_HANDLE_VALUE)
+    if (!track)
+        return 0;
+
+    auto strSize = [](const char* str) { return str ? strlen(str) + 1 : 0; };
+
+    size_t size = sizeof(ASS_Track);
+    size += track->max_styles * sizeof(ASS_Style);
+    size += track->max_events * sizeof(ASS_Event);
+    size += strSize(track->style_format) + strSize(track->event_format);
+
+    for (int i = 0; i < track->n_styles; ++i)
+        size += strSize(track->styles[i].Name) + strSize(track->styles[i].FontName);
+
+    for (int i = 0; i < track->n_events; ++i)
+        size += strSize(track->events[i].Name) + strSize(track->events[i].Effect) + strSize(track->events[i].Text);
+
+    return size;
+}
+
+// Empty track with the script info and styles of source, the events are added with CopyTrackEvent
+ASS_Track* CopyTrackHeader(ASS_Library* library, const ASS_Track* source)
+{
+    // The strings of a track are freed by libass, allocate them with malloc
+    auto dupString = [](const char* str) { return str ? _strdup(str) : nullptr; };
+
+    ASS_Track* track = ass_new_track(library);
+    if (!track)
+        return nullptr;
+
+    // Drop the styles created by ass_new_track, the ones of the source replace them
+    for (int i = 0; i < track->n_styles; ++i)
+        ass_free_style(track, i);
+    track->n_styles = 0;
+
+    track->track_type = source->track_type;
+    track->PlayResX = source->PlayResX;
+    track->PlayResY = source->PlayResY;
+    track->Timer = source->Timer;
+    track->WrapStyle = source->WrapStyle;
+    track->ScaledBorderAndShadow = source->ScaledBorderAndShadow;
+    track->Kerning = source->Kerning;
+    track->YCbCrMatrix = source->YCbCrMatrix;
+    track->default_style = source->default_style;
+    track->Language = dupString(source->Language);
+    track->style_format = dupString(source->style_format);
+    track->event_format = dupString(source->event_format);
+
+    for (int i = 0; i < source->n_styles; ++i)
     {
-        do
+        int sid = ass_alloc_style(track);
+        if (sid < 0)
+            break;
+
+        ASS_Style& style = track->styles[sid];
+        style = source->styles[i];
+        style.Name = dupString(style.Name);
+        style.FontName = dupString(style.FontName);
+    }
+
+    return track;
+}
+
+// The prefix, the custom tags of SRT tracks, goes in front of the text of the copy
+void CopyTrackEvent(ASS_Track* track, const ASS_Event& event, const std::string& prefix)
+{
+    auto dupString = [](const char* str) { return str ? _strdup(str) : nullptr; };
+
+    int eid = ass_alloc_event(track);
+    if (eid < 0)
+        return;
+
+    ASS_Event& copy = track->events[eid];
+    copy = event;
+    copy.Name = dupString(event.Name);
+    copy.Effect = dupString(event.Effect);
+    copy.Text = dupString(prefix.empty() ? event.Text : (prefix + (event.Text ? event.Text : "")).c_str());
+    copy.render_priv = nullptr;
+}
+
+#ifdef DEBUG
+
+// Debug builds only: rundll32 AssFilterMod.dll,BenchmarkUTF8Validation
+// Validates 16 MB of mostly ASCII, of mixed scripts and of mixed scripts with one invalid byte
+// at the end, with ValidateUTF8, the scalar reference and utf8::is_valid, checks that they
+// agree and shows the throughputs.
+DEBUG_BENCHMARK(BenchmarkUTF8Validation)
+{
+    const size_t bufferSize = 16 * 1024 * 1024;
+    const int nRuns = 10;
+    const char* const samples[] = {
+        "Dialogue: 0,0:00:01.00,0:00:03.00,Default,,0,0,0,,{\\an8}Hello there\\N",
+        "\xC3\xA9t\xC3\xA9 \xD0\xBF\xD1\x80\xD0\xB8 \xE3\x81\x93\xE3\x82\x93 \xF0\x9F\x98\x80 ",
+    };
+
+    std::string ascii, mixed;
+    while (ascii.size() < bufferSize)
+        ascii.append(samples[0]);
+    while (mixed.size() < bufferSize)
+        mixed.append(samples[mixed.size() % 3 ? 0 : 1]);
+    std::string invalid = mixed;
+    invalid.back() = static_cast<char>(0xC0);
+
+    struct s_case { const wchar_t* name; const std::string* buffer; };
+    const s_case cases[] = { { L"ASCII", &ascii }, { L"Mixed", &mixed }, { L"Invalid", &invalid } };
+
+    CBenchmarkTimer timer;
+    std::wstring result;
+    bool bSame = true;
+    for (const auto& c : cases)
+    {
+        const std::string& buffer = *c.buffer;
+        double times[3] = {};
+        bool valid[3] = {};
+        for (int run = 0; run < nRuns; ++run)
         {
-            // read all (real) files in current folder
-            // , delete '!' read other 2 default folder . and ..
-            if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            timer.Start();
+            valid[0] = ValidateUTF8(buffer.data(), buffer.size());
+            times[0] += timer.ElapsedMs();
+
+            timer.Start();
+            valid[1] = ValidateUTF8Scalar(buffer.data(), buffer.size());
+            times[1] += timer.ElapsedMs();
+
+            timer.Start();
+            valid[2] = utf8::is_valid(buffer.begin(), buffer.end());
+            times[2] += timer.ElapsedMs();
+        }
+
+        size_t simdOffset = 0, scalarOffset = 0;
+        ValidateUTF8(buffer.data(), buffer.size(), &simdOffset);
+        ValidateUTF8Scalar(buffer.data(), buffer.size(), &scalarOffset);
+        bSame &= valid[0] == valid[1] && valid[0] == valid[2] && simdOffset == scalarOffset;
+
+        // MB per ms is close enough to GB/s
+        const double mb = buffer.size() / (1024.0 * 1024.0);
+        WCHAR row[160];
+        swprintf_s(row, L"%s: SIMD %.2f GB/s, scalar %.2f GB/s, utf8cpp %.2f GB/s\n", c.name,
+            mb * nRuns / times[0], mb * nRuns / times[1], mb * nRuns / times[2]);
+        result.append(row);
+    }
+
+    ReportBenchmark(hwnd, L"BenchmarkUTF8Validation", result, L"Results", bSame);
+}
+
+// Debug builds only: rundll32 AssFilterMod.dll,CompareCodePages
+// Converts every byte above 0x7F and 1000 random buffers of each table code page with the
+// tables and with MultiByteToWideChar and WideCharToMultiByte, and shows the differences.
+DEBUG_BENCHMARK(CompareCodePages)
+{
+    const UINT codePages[] = { 874, 1250, 1251, 1252, 1253, 1254, 1255, 1256, 1257 };
+    const int nBuffers = 1000;
+    const size_t maxMismatches = 20;
+
+    auto convertWindows = [](UINT cp, const std::string& in) {
+        int size = MultiByteToWideChar(cp, MB_PRECOMPOSED, in.data(), (int)in.size(), nullptr, 0);
+        std::wstring utf16(size, L'\0');
+        MultiByteToWideChar(cp, MB_PRECOMPOSED, in.data(), (int)in.size(), &utf16[0], size);
+        int utf8Size = WideCharToMultiByte(CP_UTF8, 0, utf16.data(), (int)utf16.size(), nullptr, 0, nullptr, nullptr);
+        std::string utf8(utf8Size, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, utf16.data(), (int)utf16.size(), &utf8[0], utf8Size, nullptr, nullptr);
+        return utf8;
+    };
+
+    std::wstring result;
+    size_t nMismatches = 0;
+    unsigned int seed = 1;
+    for (auto cp : codePages)
+    {
+        for (int c = 0x80; c <= 0xFF; ++c)
+        {
+            std::string byte(1, static_cast<char>(c)), table;
+            ConvertTableCodePageToUTF8(cp, byte.data(), byte.size(), table);
+            if (table == convertWindows(cp, byte))
+                continue;
+
+            if (++nMismatches <= maxMismatches)
             {
-                std::wstring fn(fd.cFileName);
-                std::transform(fn.begin(), fn.end(), fn.begin(), ::towlower);
-                if ((fn.find(L".otf", fn.find_last_of(L'.')) != std::wstring::npos) || (fn.find(L".ttf", fn.find_last_of(L'.')) != std::wstring::npos))
+                WCHAR row[96];
+                swprintf_s(row, L"cp%u 0x%02X: table U+%04X\n", cp, c, CodePageToUnicode(cp, static_cast<unsigned char>(c)));
+                result.append(row);
+            }
+        }
+
+        for (int i = 0; i < nBuffers; ++i)
+        {
+            std::string buffer(1 + i % 256, '\0'), table;
+            for (auto& ch : buffer)
+            {
+                seed = seed * 1103515245 + 12345;
+                ch = static_cast<char>(seed >> 16);
+            }
+
+            ConvertTableCodePageToUTF8(cp, buffer.data(), buffer.size(), table);
+            if (table != convertWindows(cp, buffer) && ++nMismatches <= maxMismatches)
+            {
+                WCHAR row[96];
+                swprintf_s(row, L"cp%u random buffer %d of %Iu bytes\n", cp, i, buffer.size());
+                result.append(row);
+            }
+        }
+    }
+
+    WCHAR summary[64];
+    swprintf_s(summary, L"Mismatches: %Iu", nMismatches);
+    result.append(summary);
+    ReportBenchmark(hwnd, L"CompareCodePages", result);
+}
+
+// ParseSrtLine before the single pass tokenizer, the reference of BenchmarkSrtLines. Kept as it
+// was apart from IsClosed, whose result never changed the output. It loops on "</" followed by
+// anything but a letter and reads past the end of lines ending with '{', the corpus has neither.
+namespace srt_baseline
+{
+    static std::string ConsumeAttribute(const char** ppsz_subtitle, std::string& attribute_value)
+    {
+        const char* psz_subtitle = *ppsz_subtitle;
+        char psz_attribute_name[BUFSIZ];
+        char psz_attribute_value[BUFSIZ];
+
+        while (*psz_subtitle == ' ')
+            psz_subtitle++;
+
+        size_t attr_len = 0;
+        char delimiter;
+
+        while (*psz_subtitle && isalpha(*psz_subtitle))
+        {
+            psz_subtitle++;
+            attr_len++;
+        }
+
+        if (!*psz_subtitle || attr_len == 0)
+            return std::string();
+
+        strncpy_s(psz_attribute_name, psz_subtitle - attr_len, attr_len);
+        psz_attribute_name[attr_len] = 0;
+
+        // Skip over to the attribute value
+        while (*psz_subtitle && *psz_subtitle != '=')
+            psz_subtitle++;
+
+        // Skip the '=' sign
+        psz_subtitle++;
+
+        // Aknowledge the delimiter if any
+        while (*psz_subtitle && isspace(*psz_subtitle))
+            psz_subtitle++;
+
+        if (*psz_subtitle == '\'' || *psz_subtitle == '"')
+        {
+            // Save the delimiter and skip it
+            delimiter = *psz_subtitle;
+            psz_subtitle++;
+        }
+        else
+            delimiter = 0;
+
+        // Skip spaces, just in case
+        while (*psz_subtitle && isspace(*psz_subtitle))
+            psz_subtitle++;
+
+        // Skip the first #
+        if (*psz_subtitle == '#')
+            psz_subtitle++;
+
+        attr_len = 0;
+        while (*psz_subtitle && ((delimiter != 0 && *psz_subtitle != delimiter) ||
+            (delimiter == 0 && (isalnum(*psz_subtitle) || *psz_subtitle == '#'))))
+        {
+            psz_subtitle++;
+            attr_len++;
+        }
+
+        strncpy_s(psz_attribute_value, psz_subtitle - attr_len, attr_len);
+        psz_attribute_value[attr_len] = 0;
+        attribute_value.assign(psz_attribute_value);
+
+        // Finally, skip over the final delimiter
+        if (delimiter != 0 && *psz_subtitle)
+            psz_subtitle++;
+
+        *ppsz_subtitle = psz_subtitle;
+
+        return std::string(psz_attribute_name);
+    }
+
+    static std::string GetTag(const char** line, bool b_closing)
+    {
+        const char* psz_subtitle = *line;
+
+        if (*psz_subtitle != '<')
+            return std::string();
+
+        // Skip the '<'
+        psz_subtitle++;
+
+        if (b_closing && *psz_subtitle == '/')
+            psz_subtitle++;
+
+        // Skip potential spaces
+        while (*psz_subtitle == ' ')
+            psz_subtitle++;
+
+        // Now we need to verify if what comes next is a valid tag:
+        if (!isalpha(*psz_subtitle))
+            return std::string();
+
+        size_t tag_size = 1;
+        while (isalnum(psz_subtitle[tag_size]) || psz_subtitle[tag_size] == '_')
+            tag_size++;
+
+        char psz_tagname[BUFSIZ];
+        strncpy_s(psz_tagname, psz_subtitle, tag_size);
+        psz_tagname[tag_size] = 0;
+        psz_subtitle += tag_size;
+        *line = psz_subtitle;
+
+        return std::string(psz_tagname);
+    }
+
+    static void ParseSrtLine(std::string& srtLine, const AssFSettings& settings)
+    {
+        const char *psz_subtitle = srtLine.data();
+        std::string subtitle_output;
+
+        while (*psz_subtitle)
+        {
+            /* HTML extensions */
+            if (*psz_subtitle == '<')
+            {
+                std::string tagname = GetTag(&psz_subtitle, false);
+                if (!tagname.empty())
                 {
-                    std::wstring tmp = folder;
-                    tmp.append(fd.cFileName);
-                    names.push_back(tmp);
+                    // Convert tagname to lowercase
+                    std::transform(tagname.begin(), tagname.end(), tagname.begin(), ::tolower);
+                    if (tagname == "br")
+                    {
+                        subtitle_output.append("\\N");
+                    }
+                    else if (tagname == "b")
+                    {
+                        subtitle_output.append("{\\b1}");
+                    }
+                    else if (tagname == "i")
+                    {
+                        subtitle_output.append("{\\i1}");
+                    }
+                    else if (tagname == "u")
+                    {
+                        subtitle_output.append("{\\u1}");
+                    }
+                    else if (tagname == "s")
+                    {
+                        subtitle_output.append("{\\s1}");
+                    }
+                    else if (tagname == "font")
+                    {
+                        std::string attribute_name;
+                        std::string attribute_value;
+
+                        attribute_name = ConsumeAttribute(&psz_subtitle, attribute_value);
+                        while (!attribute_name.empty())
+                        {
+                            // Convert attribute_name to lowercase
+                            std::transform(attribute_name.begin(), attribute_name.end(), attribute_name.begin(), ::tolower);
+                            if (attribute_name == "face")
+                            {
+                                subtitle_output.append("{\\fn" + attribute_value + "}");
+                            }
+                            else if (attribute_name == "family")
+                            {
+                            }
+                            if (attribute_name == "size")
+                            {
+                                double resy = settings.SrtResY / 288.0;
+                                int font_size = (int)std::round(std::stod(attribute_value) * resy);
+                                subtitle_output.append("{\\fs" + std::to_string(font_size) + "}");
+                            }
+                            else if (attribute_name == "color")
+                            {
+                                MatchColorSrt(attribute_value);
+
+                                // If color is invalid, use WHITE
+                                if ((strtoul(attribute_value.c_str(), NULL, 16) == 0) && (attribute_value != "000000"))
+                                    attribute_value.assign("FFFFFF");
+
+                                // HTML is RGB and we need BGR for libass
+                                swapRGBtoBGR(attribute_value);
+                                subtitle_output.append("{\\c&H" + attribute_value + "&}");
+                            }
+                            attribute_name = ConsumeAttribute(&psz_subtitle, attribute_value);
+                        }
+                    }
+                    // Skip potential spaces & end tag
+                    while (*psz_subtitle && *psz_subtitle != '>')
+                        psz_subtitle++;
+                    if (*psz_subtitle == '>')
+                        psz_subtitle++;
+
+                }
+                else if (!strncmp(psz_subtitle, "</", 2))
+                {
+                    std::string tagname = GetTag(&psz_subtitle, true);
+                    if (!tagname.empty())
+                    {
+                        std::transform(tagname.begin(), tagname.end(), tagname.begin(), ::tolower);
+                        if (tagname == "b")
+                        {
+                            subtitle_output.append("{\\b0}");
+                        }
+                        else if (tagname == "i")
+                        {
+                            subtitle_output.append("{\\i0}");
+                        }
+                        else if (tagname == "u")
+                        {
+                            subtitle_output.append("{\\u0}");
+                        }
+                        else if (tagname == "s")
+                        {
+                            subtitle_output.append("{\\s0}");
+                        }
+                        else if (tagname == "font")
+                        {
+                            double resy = settings.SrtResY / 288.0;
+                            int font_size = (int)std::round(settings.FontSize * resy);
+                            subtitle_output.append("{\\c}");
+                            subtitle_output.append("{\\fn" + ws2s(settings.FontName) + "}");
+                            subtitle_output.append("{\\fs" + std::to_string(font_size) + "}");
+                        }
+                        while (*psz_subtitle == ' ')
+                            psz_subtitle++;
+                        if (*psz_subtitle == '>')
+                            psz_subtitle++;
+                    }
+                }
+                else
+                {
+                    subtitle_output.push_back('<');
+                    psz_subtitle++;
                 }
             }
-        } while (FindNextFileW(hFind, &fd));
-        FindClose(hFind);
+            /* MicroDVD extensions */
+            else if (psz_subtitle[0] == '{' && psz_subtitle[2] == ':' && strchr(&psz_subtitle[2], '}'))
+            {
+                const char *psz_tag_end = strchr(&psz_subtitle[2], '}');
+                size_t i_len = psz_tag_end - &psz_subtitle[3];
+
+                if (psz_subtitle[1] == 'Y' || psz_subtitle[1] == 'y')
+                {
+                    if (psz_subtitle[3] == 'i')
+                    {
+                        subtitle_output.append("{\\i1}");
+                        psz_subtitle++;
+                    }
+                    if (psz_subtitle[3] == 'b')
+                    {
+                        subtitle_output.append("{\\b1}");
+                        psz_subtitle++;
+                    }
+                    if (psz_subtitle[3] == 'u')
+                    {
+                        subtitle_output.append("{\\u1}");
+                        psz_subtitle++;
+                    }
+                }
+                else if ((psz_subtitle[1] == 'C' || psz_subtitle[1] == 'c')
+                    && psz_subtitle[3] == '$' && i_len >= 7)
+                {
+                    /* Yes, they use BBGGRR */
+                    char psz_color[7];
+                    psz_color[0] = psz_subtitle[4]; psz_color[1] = psz_subtitle[5];
+                    psz_color[2] = psz_subtitle[6]; psz_color[3] = psz_subtitle[7];
+                    psz_color[4] = psz_subtitle[8]; psz_color[5] = psz_subtitle[9];
+                    psz_color[6] = '\0';
+                    subtitle_output.append("{\\c&H").append(psz_color).append("&}");
+                }
+                else if (psz_subtitle[1] == 'F' || psz_subtitle[1] == 'f')
+                {
+                    std::string font_name(&psz_subtitle[3], i_len);
+                    subtitle_output.append("{\\fn" + font_name + "}");
+                }
+                else if (psz_subtitle[1] == 'S' || psz_subtitle[1] == 's')
+                {
+                    int size = atoi(&psz_subtitle[3]);
+                    if (size)
+                    {
+                        double resy = settings.SrtResY / 288.0;
+                        int font_size = (int)std::round(size * resy);
+                        subtitle_output.append("{\\fs" + std::to_string(font_size) + "}");
+                    }
+                }
+                // Hide other {x:y} atrocities, notably {o:x}
+                psz_subtitle = psz_tag_end + 1;
+            }
+            else
+            {
+                if (*psz_subtitle == '\n' || !_strnicmp(psz_subtitle, "\\n", 2))
+                {
+                    subtitle_output.append("\\N");
+
+                    if (*psz_subtitle == '\n')
+                        psz_subtitle++;
+                    else
+                        psz_subtitle += 2;
+                }
+                else if (*psz_subtitle == '\r')
+                {
+                    psz_subtitle++;
+                }
+                else
+                {
+                    subtitle_output.push_back(*psz_subtitle);
+                    psz_subtitle++;
+                }
+            }
+        }
+        srtLine.assign(subtitle_output);
     }
-    return names;
 }
+
+// Random SRT line of text, HTML tags with and without attributes in mixed case, unclosed and
+// stray closing tags, unknown tags, MicroDVD codes and line breaks
+static std::string MakeSrtLine(unsigned& seed)
+{
+    static const char* const pieces[] = {
+        "Where", "are", "you", "going?", " ", " ", "I told you", "a < 3", "<3", "{not a code", "a}b",
+        "<b>", "<B>", "<i>", "<I>", "<u>", "<s>", "< b>", "<br>", "<BR/>", "<ruby>", "<c.yellow>",
+        "</b>", "</B>", "</i>", "</ i >", "</u>", "</s>", "</font>", "</FONT>", "</x>", "</ruby>",
+        "{y:i}", "{Y:b}", "{y:ibu}", "{y:u}", "{c:$0080FF}", "{C:$FF0000}", "{c:$12}", "{f:Arial}",
+        "{F:Times New Roman}", "{s:20}", "{S:0}", "{o:1}", "\n", "\\n", "\\N", "\r\n",
+    };
+    static const char* const attributes[] = {
+        " face=\"Arial\"", " FACE=Verdana", " face='Times New Roman'", " size=\"24\"", " size=36",
+        " SIZE=\"12.5\"", " color=\"#FF8000\"", " color=red", " COLOR=\"#00ff00\"", " color=\"nosuch\"",
+        " color=000000", " family=\"serif\"", " size=\"big\"",
+    };
+    auto next = [&seed]() { seed = seed * 1103515245 + 12345; return (seed >> 16) & 0x7fff; };
+
+    std::string line;
+    unsigned count = 1 + next() % 24;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (next() % 8)
+        {
+            line.append(pieces[next() % _countof(pieces)]);
+            continue;
+        }
+
+        line.append(next() % 2 ? "<font" : "<Font");
+        unsigned nAttributes = next() % 4;
+        for (unsigned a = 0; a < nAttributes; ++a)
+            line.append(attributes[next() % _countof(attributes)]);
+        line.push_back('>');
+    }
+
+    return line;
+}
+
+// Debug builds only: rundll32 AssFilterMod.dll,BenchmarkSrtLines [seed]
+// Converts a random corpus of SRT lines with ParseSrtLine and with the baseline parser, checks
+// that they agree, and converts 100000 plain, tagged and heavily tagged lines with both.
+// The intentional differences are counted apart:
+// - </font> resets the color, font and size to the style with {\c}{\fn}{\fs}, the baseline
+//   wrote the values of the settings
+// - an invalid font size is skipped, the baseline threw. It gets the lines without them.
+DEBUG_BENCHMARK(BenchmarkSrtLines)
+{
+    const int nCorpus = 20000;
+    const int nLines = 100000;
+
+    AssFSettings settings{};
+    settings.SrtResX = 1280;
+    settings.SrtResY = 720;
+    settings.FontName = L"Arial";
+    settings.FontSize = 18;
+
+    // The reset of the baseline, for the settings above
+    const std::string baselineReset = "{\\c}{\\fn" + ws2s(settings.FontName) + "}{\\fs" +
+        std::to_string((int)std::round(settings.FontSize * settings.SrtResY / 288.0)) + "}";
+    const std::string fontReset = "{\\c}{\\fn}{\\fs}";
+
+    const unsigned firstSeed = lpszCmdLine && *lpszCmdLine ? strtoul(lpszCmdLine, nullptr, 10) : 1;
+    unsigned seed = firstSeed;
+    std::vector<std::string> corpus;
+    corpus.reserve(nCorpus);
+    for (int i = 0; i < nCorpus; ++i)
+        corpus.push_back(MakeSrtLine(seed));
+
+    // The only invalid size of the corpus, the baseline gets the line without it
+    const std::string invalidSize = " size=\"big\"";
+
+    int nSame = 0, nFontReset = 0, nInvalidSize = 0, nDifferent = 0;
+    std::wstring differences;
+    for (const auto& source : corpus)
+    {
+        std::string line(source), reference(source);
+        ParseSrtLine(line, settings);
+
+        bool bInvalidSize = reference.find(invalidSize) != std::string::npos;
+        if (bInvalidSize)
+            FindReplace(reference, invalidSize, std::string());
+        srt_baseline::ParseSrtLine(reference, settings);
+
+        if (line == reference && !bInvalidSize)
+        {
+            nSame++;
+            continue;
+        }
+
+        FindReplace(reference, baselineReset, fontReset);
+        if (line == reference)
+        {
+            bInvalidSize ? nInvalidSize++ : nFontReset++;
+            continue;
+        }
+
+        // The first few are shown
+        if (nDifferent++ < 3)
+            differences.append(L"Source: ").append(s2ws(source)).append(L"\nGot: ").append(s2ws(line))
+                .append(L"\nBaseline: ").append(s2ws(reference)).append(L"\n");
+    }
+
+    struct s_case { const wchar_t* name; const char* line; };
+    const s_case cases[] = {
+        { L"Plain", "Where are you going? I told you to wait here until I came back." },
+        { L"Tagged", "<i>Where are you going?</i> <b>I told you</b> to wait here." },
+        { L"Heavy", "<font color=\"#FF8000\" size=\"24\" face=\"Arial\"><i><b>Where</b></i></font> <s>are</s> <u>you</u> <font color=\"red\">going?</font>" },
+    };
+
+    CBenchmarkTimer timer;
+    std::wstring result;
+    std::string line;
+    for (const auto& c : cases)
+    {
+        timer.Start();
+        for (int i = 0; i < nLines; ++i)
+        {
+            line.assign(c.line);
+            ParseSrtLine(line, settings);
+        }
+        double parsed = timer.ElapsedMs() * 1000.0 / nLines;
+
+        timer.Start();
+        for (int i = 0; i < nLines; ++i)
+        {
+            line.assign(c.line);
+            srt_baseline::ParseSrtLine(line, settings);
+        }
+        double baseline = timer.ElapsedMs() * 1000.0 / nLines;
+
+        WCHAR row[128];
+        swprintf_s(row, L"%s: %.3f us/line, baseline %.3f us/line\n", c.name, parsed, baseline);
+        result.append(row);
+    }
+
+    WCHAR row[256];
+    swprintf_s(row, L"Corpus of %d lines, seed %u: %d identical, %d with the </font> reset, %d with invalid sizes, %d other\n",
+        nCorpus, firstSeed, nSame, nFontReset, nInvalidSize, nDifferent);
+    result.append(row).append(differences);
+    ReportBenchmark(hwnd, L"BenchmarkSrtLines", result, L"Corpus", nDifferent == 0);
+}
+
+// Debug builds only: rundll32 AssFilterMod.dll,BenchmarkStringConversions
+// Converts ASCII and mixed script strings of 16 to 4096 characters with s2ws and ws2s and with
+// MultiByteToWideChar and WideCharToMultiByte, checks that the results match and shows the times.
+DEBUG_BENCHMARK(BenchmarkStringConversions)
+{
+    const int nChars = 4 * 1024 * 1024;
+    const size_t lengths[] = { 16, 256, 4096 };
+    const char* const samples[] = {
+        "Dialogue: 0,0:00:01.00,0:00:03.00,Default,,0,0,0,,Hello there ",
+        "\xC3\xA9t\xC3\xA9 \xD0\xBF\xD1\x80\xD0\xB8 \xE3\x81\x93\xE3\x82\x93 \xF0\x9F\x98\x80 ",
+    };
+
+    CBenchmarkTimer timer;
+    bool bSame = true;
+    std::wstring result;
+    for (int sample = 0; sample < 2; ++sample)
+    {
+        for (auto length : lengths)
+        {
+            // Cut on a character boundary
+            std::string str;
+            while (str.size() < length)
+                str.append(samples[sample]);
+            while (str.size() > length && (str[length] & 0xC0) == 0x80)
+                ++length;
+            str.resize(length);
+
+            const int nRuns = (std::max)(1, nChars / static_cast<int>(length));
+            std::wstring wstr, wstrWindows;
+            std::string back, backWindows;
+            double times[4] = {};
+
+            timer.Start();
+            for (int run = 0; run < nRuns; ++run)
+                s2ws(str, wstr);
+            times[0] = timer.ElapsedMs();
+
+            timer.Start();
+            for (int run = 0; run < nRuns; ++run)
+            {
+                int size = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), nullptr, 0);
+                wstrWindows.resize(size);
+                MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), &wstrWindows[0], size);
+            }
+            times[1] = timer.ElapsedMs();
+
+            timer.Start();
+            for (int run = 0; run < nRuns; ++run)
+                ws2s(wstr, back);
+            times[2] = timer.ElapsedMs();
+
+            timer.Start();
+            for (int run = 0; run < nRuns; ++run)
+            {
+                int size = WideCharToMultiByte(CP_UTF8, 0, wstr.data(), (int)wstr.size(), nullptr, 0, nullptr, nullptr);
+                backWindows.resize(size);
+                WideCharToMultiByte(CP_UTF8, 0, wstr.data(), (int)wstr.size(), &backWindows[0], size, nullptr, nullptr);
+            }
+            times[3] = timer.ElapsedMs();
+
+            bSame &= wstr == wstrWindows && back == backWindows && back == str;
+
+            WCHAR row[192];
+            swprintf_s(row, L"%s %Iu: s2ws %.1f ms, Windows %.1f ms, ws2s %.1f ms, Windows %.1f ms\n",
+                sample ? L"Mixed" : L"ASCII", str.size(), times[0], times[1], times[2], times[3]);
+            result.append(row);
+        }
+    }
+
+    ReportBenchmark(hwnd, L"BenchmarkStringConversions", result, L"Results", bSame);
+}
+
+// Debug builds only: rundll32 AssFilterMod.dll,BenchmarkSubRenderOptions
+// Looks up the field names the consumers use, in other cases and a few unknown ones, through
+// FindSubRenderOption, a case insensitive scan of the table and a std::map like the one the
+// table replaced. Checks that the table lookups agree and shows the time per call.
+DEBUG_BENCHMARK(BenchmarkSubRenderOptions)
+{
+    const int nCalls = 10000000;
+    const char* const fields[] = {
+        "name", "version", "yuvMatrix", "combineBitmaps", "isMovable", "lowLatency",
+        "COMBINEBITMAPS", "YuvMatrix", "videoOutputRect", "frameRate", "",
+    };
+    const int nFields = sizeof(fields) / sizeof(fields[0]);
+
+    auto findLinear = [](const char* field, SubRenderOptionType type) {
+        for (int i = 0; i < SRO_COUNT; ++i)
+        {
+            if (_stricmp(subrender_option[i].name, field) == 0)
+                return subrender_option[i].type == type ? i : -1;
+        }
+        return -1;
+    };
+
+    bool bSame = true;
+    std::map<std::string, bool> fieldMap;
+    for (int i = 0; i < SRO_COUNT; ++i)
+    {
+        fieldMap[subrender_option[i].name] = false;
+        for (int t = SRO_TYPE_BOOL; t <= SRO_TYPE_BIN; ++t)
+            bSame &= FindSubRenderOption(subrender_option[i].name, (SubRenderOptionType)t) == findLinear(subrender_option[i].name, (SubRenderOptionType)t);
+    }
+    for (auto field : fields)
+        bSame &= FindSubRenderOption(field, SRO_TYPE_BOOL) == findLinear(field, SRO_TYPE_BOOL);
+
+    // Summed so the lookups aren't optimized away
+    volatile int sum = 0;
+    double times[3];
+
+    CBenchmarkTimer timer;
+    for (int i = 0; i < nCalls; ++i)
+        sum += FindSubRenderOption(fields[i % nFields], SRO_TYPE_BOOL);
+    times[0] = timer.ElapsedMs() * 1000000.0 / nCalls;
+
+    timer.Start();
+    for (int i = 0; i < nCalls; ++i)
+        sum += findLinear(fields[i % nFields], SRO_TYPE_BOOL);
+    times[1] = timer.ElapsedMs() * 1000000.0 / nCalls;
+
+    timer.Start();
+    for (int i = 0; i < nCalls; ++i)
+    {
+        auto it = fieldMap.find(fields[i % nFields]);
+        sum += it != fieldMap.end() ? it->second : -1;
+    }
+    times[2] = timer.ElapsedMs() * 1000000.0 / nCalls;
+
+    WCHAR result[256];
+    swprintf_s(result, L"Perfect hash: %.1f ns/call\nTable scan: %.1f ns/call\nstd::map: %.1f ns/call\n",
+        times[0], times[1], times[2]);
+    ReportBenchmark(hwnd, L"BenchmarkSubRenderOptions", result, L"Lookups", bSame);
+}
+
+#endif
@@ -21,60 +21,165 @@
 
 #include "ass.h"
 #include "AssFilterSettings.h"
-#include "utf8.h"
+#include "TextEncoding.h"
 
-static const struct s_color_tag {
+// CSS named colors, FindColorTag looks them up through a perfect hash
+static constexpr struct s_color_tag {
     const char *color;
     const char *hex;
 } color_tag[] = {
-//    name              hex value
-    { "aqua",           "00FFFF" },
-    { "azure",          "F0FFFF" },
-    { "beige",          "F5F5DC" },
-    { "black",          "000000" },
-    { "blue",           "0000FF" },
-    { "brown",          "A52A2A" },
-    { "chartreuse",     "7FFF00" },
-    { "chocolate",      "D2691E" },
-    { "coral",          "FF7F50" },
-    { "crimson",        "DC143C" },
-    { "cyan",           "00FFFF" },
-    { "fuchsia",        "FF00FF" },
-    { "gold",           "FFD700" },
-    { "gray",           "808080" },
-    { "green",          "008000" },
-    { "grey",           "808080" },
-    { "indigo",         "4B0082" },
-    { "ivory",          "FFFFF0" },
-    { "khaki",          "F0E68C" },
-    { "lavender",       "E6E6FA" },
-    { "lime",           "00FF00" },
-    { "linen",          "FAF0E6" },
-    { "magenta",        "FF00FF" },
-    { "maroon",         "800000" },
-    { "navy",           "000080" },
-    { "olive",          "808000" },
-    { "orange",         "FFA500" },
-    { "orchid",         "DA70D6" },
-    { "pink",           "FFC0CB" },
-    { "plum",           "DDA0DD" },
-    { "purple",         "800080" },
-    { "red",            "FF0000" },
-    { "salmon",         "FA8072" },
-    { "sienna",         "A0522D" },
-    { "silver",         "C0C0C0" },
-    { "snow",           "FFFAFA" },
-    { "tan",            "D2B48C" },
-    { "teal",           "008080" },
-    { "thistle",        "D8BFD8" },
-    { "tomato",         "FF6347" },
-    { "turquoise",      "40E0D0" },
-    { "violet",         "EE82EE" },
-    { "white",          "FFFFFF" },
-    { "yellow",         "FFFF00" },
+//    name                      hex value
+    { "aliceblue",              "F0F8FF" },
+    { "antiquewhite",           "FAEBD7" },
+    { "aqua",                   "00FFFF" },
+    { "aquamarine",             "7FFFD4" },
+    { "azure",                  "F0FFFF" },
+    { "beige",                  "F5F5DC" },
+    { "bisque",                 "FFE4C4" },
+    { "black",                  "000000" },
+    { "blanchedalmond",         "FFEBCD" },
+    { "blue",                   "0000FF" },
+    { "blueviolet",             "8A2BE2" },
+    { "brown",                  "A52A2A" },
+    { "burlywood",              "DEB887" },
+    { "cadetblue",              "5F9EA0" },
+    { "chartreuse",             "7FFF00" },
+    { "chocolate",              "D2691E" },
+    { "coral",                  "FF7F50" },
+    { "cornflowerblue",         "6495ED" },
+    { "cornsilk",               "FFF8DC" },
+    { "crimson",                "DC143C" },
+    { "cyan",                   "00FFFF" },
+    { "darkblue",               "00008B" },
+    { "darkcyan",               "008B8B" },
+    { "darkgoldenrod",          "B8860B" },
+    { "darkgray",               "A9A9A9" },
+    { "darkgreen",              "006400" },
+    { "darkgrey",               "A9A9A9" },
+    { "darkkhaki",              "BDB76B" },
+    { "darkmagenta",            "8B008B" },
+    { "darkolivegreen",         "556B2F" },
+    { "darkorange",             "FF8C00" },
+    { "darkorchid",             "9932CC" },
+    { "darkred",                "8B0000" },
+    { "darksalmon",             "E9967A" },
+    { "darkseagreen",           "8FBC8F" },
+    { "darkslateblue",          "483D8B" },
+    { "darkslategray",          "2F4F4F" },
+    { "darkslategrey",          "2F4F4F" },
+    { "darkturquoise",          "00CED1" },
+    { "darkviolet",             "9400D3" },
+    { "deeppink",               "FF1493" },
+    { "deepskyblue",            "00BFFF" },
+    { "dimgray",                "696969" },
+    { "dimgrey",                "696969" },
+    { "dodgerblue",             "1E90FF" },
+    { "firebrick",              "B22222" },
+    { "floralwhite",            "FFFAF0" },
+    { "forestgreen",            "228B22" },
+    { "fuchsia",                "FF00FF" },
+    { "gainsboro",              "DCDCDC" },
+    { "ghostwhite",             "F8F8FF" },
+    { "gold",                   "FFD700" },
+    { "goldenrod",              "DAA520" },
+    { "gray",                   "808080" },
+    { "green",                  "008000" },
+    { "greenyellow",            "ADFF2F" },
+    { "grey",                   "808080" },
+    { "honeydew",               "F0FFF0" },
+    { "hotpink",                "FF69B4" },
+    { "indianred",              "CD5C5C" },
+    { "indigo",                 "4B0082" },
+    { "ivory",                  "FFFFF0" },
+    { "khaki",                  "F0E68C" },
+    { "lavender",               "E6E6FA" },
+    { "lavenderblush",          "FFF0F5" },
+    { "lawngreen",              "7CFC00" },
+    { "lemonchiffon",           "FFFACD" },
+    { "lightblue",              "ADD8E6" },
+    { "lightcoral",             "F08080" },
+    { "lightcyan",              "E0FFFF" },
+    { "lightgoldenrodyellow",   "FAFAD2" },
+    { "lightgray",              "D3D3D3" },
+    { "lightgreen",             "90EE90" },
+    { "lightgrey",              "D3D3D3" },
+    { "lightpink",              "FFB6C1" },
+    { "lightsalmon",            "FFA07A" },
+    { "lightseagreen",          "20B2AA" },
+    { "lightskyblue",           "87CEFA" },
+    { "lightslategray",         "778899" },
+    { "lightslategrey",         "778899" },
+    { "lightsteelblue",         "B0C4DE" },
+    { "lightyellow",            "FFFFE0" },
+    { "lime",                   "00FF00" },
+    { "limegreen",              "32CD32" },
+    { "linen",                  "FAF0E6" },
+    { "magenta",                "FF00FF" },
+    { "maroon",                 "800000" },
+    { "mediumaquamarine",       "66CDAA" },
+    { "mediumblue",             "0000CD" },
+    { "mediumorchid",           "BA55D3" },
+    { "mediumpurple",           "9370DB" },
+    { "mediumseagreen",         "3CB371" },
+    { "mediumslateblue",        "7B68EE" },
+    { "mediumspringgreen",      "00FA9A" },
+    { "mediumturquoise",        "48D1CC" },
+    { "mediumvioletred",        "C71585" },
+    { "midnightblue",           "191970" },
+    { "mintcream",              "F5FFFA" },
+    { "mistyrose",              "FFE4E1" },
+    { "moccasin",               "FFE4B5" },
+    { "navajowhite",            "FFDEAD" },
+    { "navy",                   "000080" },
+    { "oldlace",                "FDF5E6" },
+    { "olive",                  "808000" },
+    { "olivedrab",              "6B8E23" },
+    { "orange",                 "FFA500" },
+    { "orangered",              "FF4500" },
+    { "orchid",                 "DA70D6" },
+    { "palegoldenrod",          "EEE8AA" },
+    { "palegreen",              "98FB98" },
+    { "paleturquoise",          "AFEEEE" },
+    { "palevioletred",          "DB7093" },
+    { "papayawhip",             "FFEFD5" },
+    { "peachpuff",              "FFDAB9" },
+    { "peru",                   "CD853F" },
+    { "pink",                   "FFC0CB" },
+    { "plum",                   "DDA0DD" },
+    { "powderblue",             "B0E0E6" },
+    { "purple",                 "800080" },
+    { "rebeccapurple",          "663399" },
+    { "red",                    "FF0000" },
+    { "rosybrown",              "BC8F8F" },
+    { "royalblue",              "4169E1" },
+    { "saddlebrown",            "8B4513" },
+    { "salmon",                 "FA8072" },
+    { "sandybrown",             "F4A460" },
+    { "seagreen",               "2E8B57" },
+    { "seashell",               "FFF5EE" },
+    { "sienna",                 "A0522D" },
+    { "silver",                 "C0C0C0" },
+    { "skyblue",                "87CEEB" },
+    { "slateblue",              "6A5ACD" },
+    { "slategray",              "708090" },
+    { "slategrey",              "708090" },
+    { "snow",                   "FFFAFA" },
+    { "springgreen",            "00FF7F" },
+    { "steelblue",              "4682B4" },
+    { "tan",                    "D2B48C" },
+    { "teal",                   "008080" },
+    { "thistle",                "D8BFD8" },
+    { "tomato",                 "FF6347" },
+    { "turquoise",              "40E0D0" },
+    { "violet",                 "EE82EE" },
+    { "wheat",                  "F5DEB3" },
+    { "white",                  "FFFFFF" },
+    { "whitesmoke",             "F5F5F5" },
+    { "yellow",                 "FFFF00" },
+    { "yellowgreen",            "9ACD32" },
 };
 
-static const struct s_iso639_lang {
+static constexpr struct s_iso639_lang {
     const WCHAR *language;
     const WCHAR *lang3;
     const WCHAR *lang2;
@@ -142,23 +247,34 @@ template <typename T>
 void FindReplace(T& line, const T& oldString, const T& newString);
 std::wstring s2ws(const std::string& str);
 std::string ws2s(const std::wstring& wstr);
+// Convert into the caller buffer, its capacity is reused
+void s2ws(const std::string& str, std::wstring& out);
+void ws2s(const std::wstring& wstr, std::string& out);
+void AppendUTF8(std::string& out, const std::wstring& wstr);
+LPWSTR LocalAllocString(const std::wstring& str);
 
 void tokenize(const std::wstring& str, std::vector<std::wstring>& tokens, const std::wstring& delimiters = L" ", bool trimEmpty = true);
 
 void ConvertCPToUTF8(UINT CP, std::string& codepage_str);
 UINT GetLanguageCP(const std::wstring& langCode, bool isCode2Chars = false);
 
-std::wstring ExtractYuvMatrix(const std::wstring& file);
-std::string ConsumeAttribute(const char** ppsz_subtitle, std::string& attribute_value);
-std::string GetTag(const char** line, bool b_closing);
-bool IsClosed(const char* psz_subtitle, const char* psz_tagname);
+bool ReadFileContent(const std::wstring& file, std::string& content);
+std::wstring ExtractYuvMatrix(const std::string& content);
 void ParseSrtLine(std::string& srtLine, const AssFSettings& settings);
 void MatchColorSrt(std::string& fntColor);
 std::wstring MatchLanguage(const std::wstring& langCode, bool isCode2Chars = false);
+// Case insensitive lookups in color_tag and iso639_lang, -1 when not found
+int FindColorTag(const char* name, size_t len);
+int FindLanguage(const wchar_t* code, size_t len, bool isCode2Chars = false);
 ASS_Track* srt_read_file(ASS_Library* library, const std::wstring& fname, const AssFSettings& settings, const UINT codePage = 0);
+std::string srt_to_ass(const char* data, size_t size, const AssFSettings& settings, const UINT codePage = 0);
+ASS_Track* srt_read_memory(ASS_Library* library, const char* data, size_t size, const AssFSettings& settings, const UINT codePage = 0);
+void ApplySrtSettings(ASS_Track* track, const AssFSettings& settings);
 std::wstring ParseFontsPath(std::wstring fontsDir, const std::wstring& name);
-std::vector<std::wstring> FindMatchingSubs(const std::wstring& fileName);
 std::vector<std::wstring> ListFontsInFolder(const std::wstring& folder);
+size_t GetTrackMemorySize(const ASS_Track* track);
+ASS_Track* CopyTrackHeader(ASS_Library* library, const ASS_Track* source);
+void CopyTrackEvent(ASS_Track* track, const ASS_Event& event, const std::string& prefix = std::string());
 
 inline bool dirExists(const std::wstring& dirName)
 {
@@ -178,13 +294,19 @@ inline bool fexists(const std::wstring& name)
     return std::ifstream(name).good();
 }
 
-inline bool isFileUTF8(const std::wstring& name)
+// 64-bit FNV-1a hash, pass the previous hash as seed to chain buffers
+inline ULONGLONG HashFNV1a(const void* data, size_t len, ULONGLONG seed = 14695981039346656037ULL)
 {
-    std::ifstream ifs(name);
-    std::istreambuf_iterator<char> it(ifs.rdbuf());
-    std::istreambuf_iterator<char> eos;
+    const BYTE* p = static_cast<const BYTE*>(data);
+    ULONGLONG hash = seed;
 
-    return utf8::is_valid(it, eos);
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
 }
 
 // trim from end of string (right)
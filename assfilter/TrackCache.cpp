@@ -0,0 +1,639 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#include <Shlobj.h>
+
+#include "TrackCache.h"
+#include "DebugBenchmark.h"
+#include "Tools.h"
+
+namespace
+{
+    const uint32_t CACHE_MAGIC = 0x43464D41;    // "AMFC"
+    const uint32_t CACHE_VERSION = 1;
+    const uint32_t NULL_STRING = UINT32_MAX;
+
+    class CCacheWriter
+    {
+    public:
+        void PutRaw(const void* p, size_t len)
+        {
+            m_data.insert(m_data.end(), (const char*)p, (const char*)p + len);
+        }
+
+        template <typename T>
+        void Put(const T& v)
+        {
+            PutRaw(&v, sizeof(v));
+        }
+
+        void PutString(const char* str)
+        {
+            if (!str)
+            {
+                Put(NULL_STRING);
+                return;
+            }
+            uint32_t len = static_cast<uint32_t>(strlen(str));
+            Put(len);
+            PutRaw(str, len);
+        }
+
+        void PutString(const std::wstring& str)
+        {
+            uint32_t len = static_cast<uint32_t>(str.size());
+            Put(len);
+            PutRaw(str.data(), len * sizeof(wchar_t));
+        }
+
+        const std::vector<char>& Data() const { return m_data; }
+
+    private:
+        std::vector<char> m_data;
+    };
+
+    class CCacheReader
+    {
+    public:
+        CCacheReader(const BYTE* pData, size_t len) : m_p(pData), m_end(pData + len), m_ok(true) {}
+
+        bool GetRaw(void* p, size_t len)
+        {
+            if (!m_ok || (size_t)(m_end - m_p) < len)
+            {
+                m_ok = false;
+                memset(p, 0, len);
+                return false;
+            }
+            memcpy(p, m_p, len);
+            m_p += len;
+            return true;
+        }
+
+        template <typename T>
+        void Get(T& v)
+        {
+            GetRaw(&v, sizeof(v));
+        }
+
+        // The string is allocated with malloc so libass can free it with the track
+        char* GetString()
+        {
+            uint32_t len;
+            Get(len);
+            if (!m_ok || len == NULL_STRING)
+                return nullptr;
+            if ((size_t)(m_end - m_p) < len)
+            {
+                m_ok = false;
+                return nullptr;
+            }
+            char* str = static_cast<char*>(malloc(len + 1));
+            if (!str)
+            {
+                m_ok = false;
+                return nullptr;
+            }
+            memcpy(str, m_p, len);
+            str[len] = '\0';
+            m_p += len;
+            return str;
+        }
+
+        std::wstring GetWString()
+        {
+            uint32_t len;
+            Get(len);
+            if (!m_ok || (size_t)(m_end - m_p) / sizeof(wchar_t) < len)
+            {
+                m_ok = false;
+                return std::wstring();
+            }
+            std::wstring str(reinterpret_cast<const wchar_t*>(m_p), len);
+            m_p += len * sizeof(wchar_t);
+            return str;
+        }
+
+        bool IsOk() const { return m_ok; }
+
+    private:
+        const BYTE* m_p;
+        const BYTE* m_end;
+        bool m_ok;
+    };
+
+    struct s_cache_header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t styleSize;     // Detect libass structure changes
+        uint32_t eventSize;
+        ULONGLONG fileSize;
+        ULONGLONG lastWrite;
+        ULONGLONG contentHash;
+        ULONGLONG settingsHash;
+        UINT codePage;
+    };
+
+    void WriteStyle(CCacheWriter& w, const ASS_Style& s)
+    {
+        w.PutString(s.Name);
+        w.PutString(s.FontName);
+        w.Put(s.FontSize);
+        w.Put(s.PrimaryColour);
+        w.Put(s.SecondaryColour);
+        w.Put(s.OutlineColour);
+        w.Put(s.BackColour);
+        w.Put(s.Bold);
+        w.Put(s.Italic);
+        w.Put(s.Underline);
+        w.Put(s.StrikeOut);
+        w.Put(s.ScaleX);
+        w.Put(s.ScaleY);
+        w.Put(s.Spacing);
+        w.Put(s.Angle);
+        w.Put(s.BorderStyle);
+        w.Put(s.Outline);
+        w.Put(s.Shadow);
+        w.Put(s.Alignment);
+        w.Put(s.MarginL);
+        w.Put(s.MarginR);
+        w.Put(s.MarginV);
+        w.Put(s.Encoding);
+        w.Put(s.treat_fontname_as_pattern);
+        w.Put(s.Blur);
+        w.Put(s.Justify);
+    }
+
+    void ReadStyle(CCacheReader& r, ASS_Style& s)
+    {
+        s.Name = r.GetString();
+        s.FontName = r.GetString();
+        r.Get(s.FontSize);
+        r.Get(s.PrimaryColour);
+        r.Get(s.SecondaryColour);
+        r.Get(s.OutlineColour);
+        r.Get(s.BackColour);
+        r.Get(s.Bold);
+        r.Get(s.Italic);
+        r.Get(s.Underline);
+        r.Get(s.StrikeOut);
+        r.Get(s.ScaleX);
+        r.Get(s.ScaleY);
+        r.Get(s.Spacing);
+        r.Get(s.Angle);
+        r.Get(s.BorderStyle);
+        r.Get(s.Outline);
+        r.Get(s.Shadow);
+        r.Get(s.Alignment);
+        r.Get(s.MarginL);
+        r.Get(s.MarginR);
+        r.Get(s.MarginV);
+        r.Get(s.Encoding);
+        r.Get(s.treat_fontname_as_pattern);
+        r.Get(s.Blur);
+        r.Get(s.Justify);
+    }
+
+    void WriteEvent(CCacheWriter& w, const ASS_Event& e)
+    {
+        w.Put(e.Start);
+        w.Put(e.Duration);
+        w.Put(e.ReadOrder);
+        w.Put(e.Layer);
+        w.Put(e.Style);
+        w.Put(e.MarginL);
+        w.Put(e.MarginR);
+        w.Put(e.MarginV);
+        w.PutString(e.Name);
+        w.PutString(e.Effect);
+        w.PutString(e.Text);
+    }
+
+    void ReadEvent(CCacheReader& r, ASS_Event& e)
+    {
+        r.Get(e.Start);
+        r.Get(e.Duration);
+        r.Get(e.ReadOrder);
+        r.Get(e.Layer);
+        r.Get(e.Style);
+        r.Get(e.MarginL);
+        r.Get(e.MarginR);
+        r.Get(e.MarginV);
+        e.Name = r.GetString();
+        e.Effect = r.GetString();
+        e.Text = r.GetString();
+    }
+
+    ASS_Track* ReadTrack(ASS_Library* library, CCacheReader& r)
+    {
+        ASS_Track* track = ass_new_track(library);
+        if (!track)
+            return nullptr;
+
+        // Drop the styles created by ass_new_track, the cached ones replace them
+        for (int i = 0; i < track->n_styles; ++i)
+            ass_free_style(track, i);
+        track->n_styles = 0;
+
+        r.Get(track->track_type);
+        r.Get(track->PlayResX);
+        r.Get(track->PlayResY);
+        r.Get(track->Timer);
+        r.Get(track->WrapStyle);
+        r.Get(track->ScaledBorderAndShadow);
+        r.Get(track->Kerning);
+        r.Get(track->YCbCrMatrix);
+        r.Get(track->default_style);
+        track->Language = r.GetString();
+        track->style_format = r.GetString();
+        track->event_format = r.GetString();
+
+        int nStyles = 0;
+        r.Get(nStyles);
+        for (int i = 0; i < nStyles && r.IsOk(); ++i)
+        {
+            int sid = ass_alloc_style(track);
+            if (sid < 0)
+                break;
+            ReadStyle(r, track->styles[sid]);
+        }
+
+        int nEvents = 0;
+        r.Get(nEvents);
+        for (int i = 0; i < nEvents && r.IsOk(); ++i)
+        {
+            int eid = ass_alloc_event(track);
+            if (eid < 0)
+                break;
+            ReadEvent(r, track->events[eid]);
+            if (track->events[eid].Style < 0 || track->events[eid].Style >= track->n_styles)
+                track->events[eid].Style = 0;
+        }
+
+        if (!r.IsOk() || track->n_styles != nStyles || track->n_events != nEvents)
+        {
+            ass_free_track(track);
+            return nullptr;
+        }
+
+        if (track->default_style < 0 || track->default_style >= track->n_styles)
+            track->default_style = 0;
+
+        return track;
+    }
+}
+
+CTrackCache::CTrackCache(ULONGLONG maxSize)
+    : m_maxSize(maxSize)
+{
+    WCHAR szPath[MAX_PATH];
+    if (SUCCEEDED(SHGetFolderPathW(nullptr, CSIDL_LOCAL_APPDATA, nullptr, 0, szPath)))
+    {
+        m_cacheDir.assign(szPath);
+        m_cacheDir.append(L"\\AssFilterMod\\TrackCache\\");
+        SHCreateDirectoryExW(nullptr, m_cacheDir.c_str(), nullptr);
+        if (!dirExists(m_cacheDir))
+            m_cacheDir.clear();
+    }
+}
+
+bool CTrackCache::GetFileKey(const std::wstring& file, s_track_key& key)
+{
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(file.c_str(), GetFileExInfoStandard, &fad))
+        return false;
+
+    key.file = file;
+    key.fileSize = ((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+    key.lastWrite = ((ULONGLONG)fad.ftLastWriteTime.dwHighDateTime << 32) | fad.ftLastWriteTime.dwLowDateTime;
+    key.contentHash = 0;
+    key.settingsHash = 0;
+    key.codePage = 0;
+
+    return true;
+}
+
+// Hash of the settings baked into the track by srt_to_ass: the resolution and the font sizes of the
+// tags scaled for it. ApplySrtSettings sets the style, the custom tags are added when rendering.
+ULONGLONG CTrackCache::HashSettings(const AssFSettings& settings)
+{
+    const DWORD values[] = { settings.SrtResX, settings.SrtResY };
+
+    ULONGLONG hash = HashFNV1a(values, sizeof(values));
+
+    // 0 is reserved for tracks not depending on the settings
+    return hash ? hash : 1;
+}
+
+ASS_Track* CTrackCache::Load(ASS_Library* library, const s_track_key& key, std::wstring& yuvMatrix)
+{
+    if (m_cacheDir.empty())
+        return nullptr;
+
+    std::wstring cacheFile = GetCacheFile(key.file);
+    HANDLE hFile = CreateFileW(cacheFile.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    ASS_Track* track = nullptr;
+    bool bByContent = false;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(hFile, &size) && size.QuadPart > sizeof(s_cache_header))
+    {
+        HANDLE hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMap)
+        {
+            const BYTE* pData = static_cast<const BYTE*>(MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0));
+            if (pData)
+            {
+                CCacheReader r(pData, static_cast<size_t>(size.QuadPart));
+                s_cache_header header;
+                r.Get(header);
+
+                // A touched file with the same content is still valid
+                bool bValid = header.magic == CACHE_MAGIC && header.version == CACHE_VERSION &&
+                    header.styleSize == sizeof(ASS_Style) && header.eventSize == sizeof(ASS_Event) &&
+                    header.fileSize == key.fileSize && header.settingsHash == key.settingsHash &&
+                    header.codePage == key.codePage &&
+                    (header.lastWrite == key.lastWrite || (key.contentHash != 0 && header.contentHash == key.contentHash));
+
+                if (bValid && _wcsicmp(r.GetWString().c_str(), key.file.c_str()) == 0)
+                {
+                    std::wstring cachedMatrix = r.GetWString();
+                    track = ReadTrack(library, r);
+                    if (track)
+                        yuvMatrix = cachedMatrix;
+                    bByContent = header.lastWrite != key.lastWrite;
+                }
+
+                UnmapViewOfFile(pData);
+            }
+            CloseHandle(hMap);
+        }
+    }
+
+    // Matched by content, store the new write time so the next open doesn't read the file
+    if (track && bByContent)
+    {
+        LARGE_INTEGER offset;
+        offset.QuadPart = offsetof(s_cache_header, lastWrite);
+        DWORD written = 0;
+        if (SetFilePointerEx(hFile, offset, nullptr, FILE_BEGIN))
+            WriteFile(hFile, &key.lastWrite, sizeof(key.lastWrite), &written, nullptr);
+    }
+
+    // Keep the most recently used entries when trimming the cache
+    if (track)
+    {
+        FILETIME ftNow;
+        GetSystemTimeAsFileTime(&ftNow);
+        SetFileTime(hFile, nullptr, nullptr, &ftNow);
+    }
+
+    CloseHandle(hFile);
+
+    return track;
+}
+
+bool CTrackCache::Store(const ASS_Track* track, const s_track_key& key, const std::wstring& yuvMatrix)
+{
+    if (m_cacheDir.empty() || !track)
+        return false;
+
+    CCacheWriter w;
+    s_cache_header header {};
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.styleSize = sizeof(ASS_Style);
+    header.eventSize = sizeof(ASS_Event);
+    header.fileSize = key.fileSize;
+    header.lastWrite = key.lastWrite;
+    header.contentHash = key.contentHash;
+    header.settingsHash = key.settingsHash;
+    header.codePage = key.codePage;
+    w.Put(header);
+    w.PutString(key.file);
+    w.PutString(yuvMatrix);
+
+    w.Put(track->track_type);
+    w.Put(track->PlayResX);
+    w.Put(track->PlayResY);
+    w.Put(track->Timer);
+    w.Put(track->WrapStyle);
+    w.Put(track->ScaledBorderAndShadow);
+    w.Put(track->Kerning);
+    w.Put(track->YCbCrMatrix);
+    w.Put(track->default_style);
+    w.PutString(track->Language);
+    w.PutString(track->style_format);
+    w.PutString(track->event_format);
+
+    w.Put(track->n_styles);
+    for (int i = 0; i < track->n_styles; ++i)
+        WriteStyle(w, track->styles[i]);
+
+    w.Put(track->n_events);
+    for (int i = 0; i < track->n_events; ++i)
+        WriteEvent(w, track->events[i]);
+
+    // Write to a temporary file first so a reader never maps a partial entry
+    std::wstring cacheFile = GetCacheFile(key.file);
+    std::wstring tempFile = cacheFile + L".tmp";
+    HANDLE hFile = CreateFileW(tempFile.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD written = 0;
+    const std::vector<char>& data = w.Data();
+    BOOL bOk = WriteFile(hFile, data.data(), static_cast<DWORD>(data.size()), &written, nullptr) && written == data.size();
+    CloseHandle(hFile);
+
+    if (!bOk || !MoveFileExW(tempFile.c_str(), cacheFile.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileW(tempFile.c_str());
+        return false;
+    }
+
+    Trim();
+
+    return true;
+}
+
+std::wstring CTrackCache::GetCacheFile(const std::wstring& file) const
+{
+    std::wstring lcFile(file);
+    std::transform(lcFile.begin(), lcFile.end(), lcFile.begin(), ::towlower);
+
+    WCHAR szName[32];
+    swprintf_s(szName, L"%016I64x.afc", HashFNV1a(lcFile.data(), lcFile.size() * sizeof(wchar_t)));
+
+    return m_cacheDir + szName;
+}
+
+// Delete the least recently used entries until the cache fits in its size limit
+void CTrackCache::Trim()
+{
+    struct s_entry
+    {
+        ULONGLONG lastWrite;
+        ULONGLONG size;
+        std::wstring file;
+    };
+
+    std::vector<s_entry> entries;
+    ULONGLONG totalSize = 0;
+
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind = FindFirstFileW((m_cacheDir + L"*.afc").c_str(), &fd);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            s_entry entry;
+            entry.lastWrite = ((ULONGLONG)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime;
+            entry.size = ((ULONGLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+            entry.file = m_cacheDir + fd.cFileName;
+            totalSize += entry.size;
+            entries.push_back(entry);
+        }
+    } while (FindNextFileW(hFind, &fd));
+    FindClose(hFind);
+
+    if (totalSize <= m_maxSize)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const s_entry& a, const s_entry& b) { return a.lastWrite < b.lastWrite; });
+
+    for (const auto& entry : entries)
+    {
+        if (totalSize <= m_maxSize)
+            break;
+        if (DeleteFileW(entry.file.c_str()))
+            totalSize -= entry.size;
+    }
+}
+
+#ifdef DEBUG
+
+// Debug builds only: rundll32 AssFilterMod.dll,BenchmarkTrackCache
+// Writes scripts of 1000 to 100000 events to the temp folder, parses them with libass and
+// loads them from the track cache, checks that the events are the same and shows the times.
+DEBUG_BENCHMARK(BenchmarkTrackCache)
+{
+    const int nRuns = 5;
+    const int eventCounts[] = { 1000, 10000, 100000 };
+
+    ASS_Library* library = ass_library_init();
+    CTrackCache cache(256 * 1024 * 1024);
+
+    WCHAR tempDir[MAX_PATH];
+    GetTempPathW(MAX_PATH, tempDir);
+
+    CBenchmarkTimer timer;
+    std::wstring result;
+    bool bSame = true;
+
+    for (int nEvents : eventCounts)
+    {
+        std::string script =
+            "[Script Info]\nScriptType: v4.00+\nPlayResX: 1920\nPlayResY: 1080\n\n"
+            "[V4+ Styles]\nFormat: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, "
+            "Bold, Italic, Underline, StrikeOut, ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, "
+            "Alignment, MarginL, MarginR, MarginV, Encoding\n"
+            "Style: Default,Arial,40,&H00FFFFFF,&H000000FF,&H00000000,&H80000000,0,0,0,0,100,100,0,0,1,3,2,2,20,20,20,1\n\n"
+            "[Events]\nFormat: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n";
+
+        char line[256];
+        for (int i = 0; i < nEvents; ++i)
+        {
+            int start = i * 10, stop = start + 200;     // Centiseconds
+            _snprintf_s(line, _TRUNCATE, "Dialogue: 0,%d:%02d:%02d.%02d,%d:%02d:%02d.%02d,Default,,0,0,0,,{\\i1}Line %d of the benchmark\n",
+                start / 360000, start / 6000 % 60, start / 100 % 60, start % 100,
+                stop / 360000, stop / 6000 % 60, stop / 100 % 60, stop % 100, i);
+            script.append(line);
+        }
+
+        std::wstring file = std::wstring(tempDir) + L"AssFilterBenchmark" + std::to_wstring(nEvents) + L".ass";
+        {
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            out.write(script.data(), script.size());
+        }
+
+        // What a load without the cache costs, the file is read and parsed
+        double parseTime = 0.0;
+        ASS_Track* parsed = nullptr;
+        for (int run = 0; run < nRuns; ++run)
+        {
+            timer.Start();
+            std::ifstream in(file, std::ios::binary);
+            std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            ASS_Track* track = ass_read_memory(library, &content[0], content.size(), nullptr);
+            parseTime += timer.ElapsedMs();
+
+            if (parsed)
+                ass_free_track(parsed);
+            parsed = track;
+        }
+
+        s_track_key key;
+        std::wstring yuvMatrix;
+        if (!parsed || !CTrackCache::GetFileKey(file, key) || !cache.Store(parsed, key, yuvMatrix))
+        {
+            bSame = false;
+            break;
+        }
+
+        double loadTime = 0.0;
+        for (int run = 0; run < nRuns; ++run)
+        {
+            timer.Start();
+            ASS_Track* loaded = cache.Load(library, key, yuvMatrix);
+            loadTime += timer.ElapsedMs();
+
+            bSame &= loaded && loaded->n_events == parsed->n_events && loaded->n_styles == parsed->n_styles;
+            for (int i = 0; bSame && i < parsed->n_events; ++i)
+            {
+                const ASS_Event& a = parsed->events[i];
+                const ASS_Event& b = loaded->events[i];
+                bSame = a.Start == b.Start && a.Duration == b.Duration && a.Style == b.Style &&
+                        a.ReadOrder == b.ReadOrder && !strcmp(a.Text, b.Text);
+            }
+            if (loaded)
+                ass_free_track(loaded);
+        }
+
+        WCHAR row[128];
+        swprintf_s(row, L"%d events: parsed %.2f ms, from the cache %.2f ms\n", nEvents, parseTime / nRuns, loadTime / nRuns);
+        result.append(row);
+
+        ass_free_track(parsed);
+        DeleteFileW(file.c_str());
+    }
+
+    ReportBenchmark(hwnd, L"BenchmarkTrackCache", result, L"Tracks", bSame);
+
+    ass_library_done(library);
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ass.h>
+#include "AssFilterSettings.h"
+
+// Identify a parsed subtitle file in the track cache
+struct s_track_key
+{
+    std::wstring file;
+    ULONGLONG fileSize;
+    ULONGLONG lastWrite;
+    ULONGLONG contentHash;      // 0 when the file content was not hashed
+    ULONGLONG settingsHash;     // 0 when the settings don't affect the parse (ASS)
+    UINT codePage;
+};
+
+// On-disk binary cache of parsed subtitle tracks.
+// Each source file owns one cache file holding the script info, styles and
+// events of the parsed track, so a warm open only maps that file.
+class CTrackCache
+{
+public:
+    CTrackCache(ULONGLONG maxSize);
+
+    static bool GetFileKey(const std::wstring& file, s_track_key& key);
+    static ULONGLONG HashSettings(const AssFSettings& settings);
+
+    ASS_Track* Load(ASS_Library* library, const s_track_key& key, std::wstring& yuvMatrix);
+    bool Store(const ASS_Track* track, const s_track_key& key, const std::wstring& yuvMatrix);
+
+private:
+    std::wstring GetCacheFile(const std::wstring& file) const;
+    void Trim();
+
+    std::wstring m_cacheDir;
+    ULONGLONG m_maxSize;
+};
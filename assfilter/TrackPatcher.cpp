@@ -0,0 +1,356 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stdafx.h"
+
+#include <climits>
+#include <unordered_map>
+
+#include "TrackPatcher.h"
+#include "Tools.h"
+
+namespace
+{
+    enum ScriptSection
+    {
+        SECTION_INFO,
+        SECTION_STYLES,
+        SECTION_EVENTS,
+        SECTION_IGNORED,
+        SECTION_OTHER
+    };
+
+    inline bool StartsWithNoCase(const std::string& str, const char* prefix)
+    {
+        return _strnicmp(str.c_str(), prefix, strlen(prefix)) == 0;
+    }
+
+    // Split the script in lines without the line breaks and the leading spaces
+    template <typename Func>
+    void ForEachLine(const std::string& script, size_t pos, Func func)
+    {
+        std::string line;
+        while (pos < script.size())
+        {
+            size_t eol = script.find('\n', pos);
+            if (eol == std::string::npos)
+                eol = script.size();
+
+            line.assign(script, pos, eol - pos);
+            pos = eol + 1;
+
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            ltrim(line, " \t");
+
+            func(line);
+        }
+    }
+}
+
+CTrackPatcher::CTrackPatcher(const ASS_Track* track, const std::string& script)
+    : m_script(script)
+{
+    ParseScript(m_script, m_parsed);
+
+    // Lines libass rejected while parsing would shift the events
+    m_bValid = track && m_parsed.events.size() == static_cast<size_t>(track->n_events);
+}
+
+CTrackPatcher::PatchResult CTrackPatcher::Apply(ASS_Track* track, const std::string& script, long long& earliestChange)
+{
+    earliestChange = LLONG_MAX;
+
+    if (!m_bValid)
+        return PATCH_RELOAD;
+
+    if (script == m_script)
+        return PATCH_NONE;
+
+    // Appended complete lines are parsed alone
+    if (m_parsed.eventsLast && script.size() > m_script.size() && !m_script.empty() && m_script.back() == '\n' &&
+        script.compare(0, m_script.size(), m_script) == 0)
+    {
+        PatchResult result = ApplyAppend(track, script, earliestChange);
+        if (result != PATCH_RELOAD)
+            return result;
+    }
+
+    return ApplyDiff(track, script, earliestChange);
+}
+
+CTrackPatcher::PatchResult CTrackPatcher::ApplyAppend(ASS_Track* track, const std::string& script, long long& earliestChange)
+{
+    // Keep an incomplete last line for the next change
+    size_t end = script.find_last_of('\n');
+    if (end == std::string::npos || end < m_script.size())
+        return PATCH_NONE;
+
+    std::vector<std::string> lines;
+    bool bOnlyEvents = true;
+    ForEachLine(script.substr(0, end + 1), m_script.size(), [&](const std::string& line) {
+        if (StartsWithNoCase(line, "Dialogue:"))
+            lines.push_back(line);
+        else if (!line.empty() && !StartsWithNoCase(line, "Comment:"))
+            bOnlyEvents = false;
+    });
+
+    // Anything else than events goes through the diff
+    if (!bOnlyEvents)
+        return PATCH_RELOAD;
+
+    if (!lines.empty())
+    {
+        std::string data(m_parsed.eventsSection + "\n");
+        for (const auto& line : lines)
+            data.append(line).append("\n");
+
+        int firstEvent = track->n_events;
+        ass_process_data(track, &data[0], static_cast<int>(data.size()));
+        if (track->n_events != firstEvent + static_cast<int>(lines.size()))
+        {
+            m_bValid = false;
+            return PATCH_RELOAD;
+        }
+
+        for (int i = firstEvent; i < track->n_events; ++i)
+            earliestChange = (std::min)(earliestChange, track->events[i].Start);
+
+        m_parsed.events.insert(m_parsed.events.end(), lines.begin(), lines.end());
+    }
+
+    m_script.assign(script, 0, end + 1);
+
+    return lines.empty() ? PATCH_NONE : PATCH_APPLIED;
+}
+
+CTrackPatcher::PatchResult CTrackPatcher::ApplyDiff(ASS_Track* track, const std::string& script, long long& earliestChange)
+{
+    s_script parsed;
+    ParseScript(script, parsed);
+
+    // Script info, formats or embedded data changed
+    if (parsed.header != m_parsed.header || parsed.styleNames != m_parsed.styleNames ||
+        parsed.stylesSection != m_parsed.stylesSection || parsed.eventsSection != m_parsed.eventsSection)
+        return PATCH_RELOAD;
+
+    // Changed styles, the set of style names is the same
+    std::vector<int> changedStyles;
+    std::string styleData(parsed.stylesSection + "\n");
+    for (size_t i = 0; i < parsed.styleLines.size(); ++i)
+    {
+        if (parsed.styleLines[i] == m_parsed.styleLines[i])
+            continue;
+
+        // libass resolves a name to its last style, the earlier ones are never used
+        if (std::find(parsed.styleNames.begin() + i + 1, parsed.styleNames.end(), parsed.styleNames[i]) != parsed.styleNames.end())
+            continue;
+
+        int sid = FindStyle(track, parsed.styleNames[i]);
+        if (sid < 0)
+            return PATCH_RELOAD;
+
+        changedStyles.push_back(sid);
+        styleData.append(parsed.styleLines[i]).append("\n");
+    }
+
+    // Match the unchanged events, the remaining old ones are removed
+    std::unordered_multimap<std::string, size_t> oldEvents;
+    oldEvents.reserve(m_parsed.events.size());
+    for (size_t i = 0; i < m_parsed.events.size(); ++i)
+        oldEvents.emplace(m_parsed.events[i], i);
+
+    std::vector<bool> kept(m_parsed.events.size(), false);
+    std::vector<std::string> added;
+    for (const auto& line : parsed.events)
+    {
+        auto it = oldEvents.find(line);
+        if (it != oldEvents.end())
+        {
+            kept[it->second] = true;
+            oldEvents.erase(it);
+        }
+        else
+            added.push_back(line);
+    }
+
+    if (changedStyles.empty() && added.empty() && oldEvents.empty())
+    {
+        parsed.events.swap(m_parsed.events);
+        m_parsed = std::move(parsed);
+        m_script = script;
+        return PATCH_NONE;
+    }
+
+    // Update the styles in place so the events keep their style index
+    if (!changedStyles.empty())
+    {
+        int firstStyle = track->n_styles;
+        int defaultStyle = track->default_style;
+        ass_process_data(track, &styleData[0], static_cast<int>(styleData.size()));
+        track->default_style = defaultStyle;
+        if (track->n_styles != firstStyle + static_cast<int>(changedStyles.size()))
+        {
+            m_bValid = false;
+            return PATCH_RELOAD;
+        }
+
+        // Move the new styles from the end of the array over the old ones
+        for (size_t i = changedStyles.size(); i-- > 0;)
+        {
+            int sid = changedStyles[i];
+            ass_free_style(track, sid);
+            track->styles[sid] = track->styles[track->n_styles - 1];
+            --track->n_styles;
+
+            for (int j = 0; j < track->n_events; ++j)
+            {
+                if (track->events[j].Style == sid)
+                    earliestChange = (std::min)(earliestChange, track->events[j].Start);
+            }
+        }
+    }
+
+    // Remove the events and compact the array
+    if (!oldEvents.empty())
+    {
+        int dst = 0;
+        for (int i = 0; i < track->n_events; ++i)
+        {
+            if (!kept[i])
+            {
+                earliestChange = (std::min)(earliestChange, track->events[i].Start);
+                ass_free_event(track, i);
+                continue;
+            }
+            if (dst != i)
+            {
+                track->events[dst] = track->events[i];
+                m_parsed.events[dst].swap(m_parsed.events[i]);
+            }
+            ++dst;
+        }
+        track->n_events = dst;
+        m_parsed.events.resize(dst);
+    }
+
+    // Parse the new events
+    if (!added.empty())
+    {
+        std::string data(parsed.eventsSection + "\n");
+        for (const auto& line : added)
+            data.append(line).append("\n");
+
+        int firstEvent = track->n_events;
+        ass_process_data(track, &data[0], static_cast<int>(data.size()));
+        if (track->n_events != firstEvent + static_cast<int>(added.size()))
+        {
+            m_bValid = false;
+            return PATCH_RELOAD;
+        }
+
+        for (int i = firstEvent; i < track->n_events; ++i)
+            earliestChange = (std::min)(earliestChange, track->events[i].Start);
+
+        m_parsed.events.insert(m_parsed.events.end(), added.begin(), added.end());
+    }
+
+    // The event lines stay in the order of the track events
+    parsed.events.swap(m_parsed.events);
+    m_parsed = std::move(parsed);
+    m_script = script;
+
+    return PATCH_APPLIED;
+}
+
+void CTrackPatcher::ParseScript(const std::string& script, s_script& parsed)
+{
+    ScriptSection section = SECTION_OTHER;
+    parsed.eventsLast = false;
+
+    ForEachLine(script, 0, [&](const std::string& line) {
+        if (line.empty())
+            return;
+
+        if (line[0] == '[')
+        {
+            if (StartsWithNoCase(line, "[Script Info]"))
+                section = SECTION_INFO;
+            else if (StartsWithNoCase(line, "[V4 Styles]") || StartsWithNoCase(line, "[V4+ Styles]"))
+            {
+                section = SECTION_STYLES;
+                parsed.stylesSection = line;
+            }
+            else if (StartsWithNoCase(line, "[Events]"))
+            {
+                section = SECTION_EVENTS;
+                parsed.eventsSection = line;
+            }
+            else if (StartsWithNoCase(line, "[Aegisub Project Garbage]"))
+                section = SECTION_IGNORED;
+            else
+                section = SECTION_OTHER;
+
+            parsed.eventsLast = section == SECTION_EVENTS;
+            if (section != SECTION_IGNORED)
+                parsed.header.append(line).append("\n");
+            return;
+        }
+
+        switch (section)
+        {
+        case SECTION_INFO:
+            // Comments don't reach the track
+            if (line[0] != ';' && line.compare(0, 2, "!:") != 0)
+                parsed.header.append(line).append("\n");
+            break;
+        case SECTION_STYLES:
+            if (StartsWithNoCase(line, "Style:"))
+            {
+                std::string name(line.substr(6, line.find(',') - 6));
+                parsed.styleNames.push_back(trim(name, " \t"));
+                parsed.styleLines.push_back(line);
+            }
+            else
+                parsed.header.append(line).append("\n");
+            break;
+        case SECTION_EVENTS:
+            if (StartsWithNoCase(line, "Dialogue:"))
+                parsed.events.push_back(line);
+            else if (StartsWithNoCase(line, "Format:"))
+                parsed.header.append(line).append("\n");
+            break;
+        case SECTION_IGNORED:
+            break;
+        default:
+            parsed.header.append(line).append("\n");
+            break;
+        }
+    });
+}
+
+int CTrackPatcher::FindStyle(const ASS_Track* track, const std::string& name)
+{
+    // Same lookup order as libass, the last style with the name wins
+    for (int i = track->n_styles - 1; i >= 0; --i)
+    {
+        if (track->styles[i].Name && name == track->styles[i].Name)
+            return i;
+    }
+
+    return -1;
+}
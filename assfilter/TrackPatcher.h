@@ -0,0 +1,62 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ass.h>
+
+// Apply the changes of a script to the track parsed from its previous version.
+// Appended lines are parsed alone, other edits are diffed line by line so only
+// the added, removed or changed events and styles reach the track.
+class CTrackPatcher
+{
+public:
+    enum PatchResult
+    {
+        PATCH_NONE,         // Nothing changed for the renderer
+        PATCH_APPLIED,      // The track was updated
+        PATCH_RELOAD        // The track must be parsed again
+    };
+
+    // The track must have been parsed from script
+    CTrackPatcher(const ASS_Track* track, const std::string& script);
+
+    // earliestChange receives the start time in ms of the first modified event
+    PatchResult Apply(ASS_Track* track, const std::string& script, long long& earliestChange);
+
+private:
+    struct s_script
+    {
+        std::string header;             // Everything a change of needs a full reload
+        std::string stylesSection;      // Section header of the styles
+        std::string eventsSection;      // Section header of the events
+        std::vector<std::string> styleNames;
+        std::vector<std::string> styleLines;
+        std::vector<std::string> events;    // Dialogue lines, in the order of the track events
+        bool eventsLast;                // The events section ends the script
+    };
+
+    static void ParseScript(const std::string& script, s_script& parsed);
+    static int FindStyle(const ASS_Track* track, const std::string& name);
+
+    PatchResult ApplyAppend(ASS_Track* track, const std::string& script, long long& earliestChange);
+    PatchResult ApplyDiff(ASS_Track* track, const std::string& script, long long& earliestChange);
+
+    bool m_bValid;                      // The events of the track match the parsed script
+    std::string m_script;
+    s_script m_parsed;
+};
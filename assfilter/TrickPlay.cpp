@@ -0,0 +1,125 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// This file doesn't use the precompiled header, keep it free of Windows dependencies
+
+#include "TrickPlay.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+void CTrickPlay::SetRate(double rate)
+{
+    if (rate == m_forcedRate)
+        return;
+
+    m_forcedRate = rate;
+    Reset();
+}
+
+void CTrickPlay::Reset()
+{
+    m_count = 0;
+    m_step = 0.0;
+    m_requests.clear();
+
+    m_bActive = std::fabs(m_forcedRate) >= kMinRate;
+    m_rate = m_bActive ? std::fabs(m_forcedRate) : 1.0;
+}
+
+bool CTrickPlay::AddRequest(int64_t start, int64_t frameDuration, double clock)
+{
+    m_frameDuration = frameDuration > 0 ? frameDuration : 0;
+
+    // The consumer knows better
+    if (m_forcedRate)
+        return false;
+
+    if (m_requests.empty())
+    {
+        m_requests.push_back({ start, clock });
+        return false;
+    }
+
+    // The same frame again when the consumer repaints
+    const s_request last = m_requests.back();
+    int64_t step = start - last.start;
+    if (step == 0)
+        return false;
+    double stepRate = clock > last.clock ? step / ((clock - last.clock) * 10000.0) : kMinRate;
+
+    m_requests.push_back({ start, clock });
+    while (clock - m_requests[1].clock >= kRateWindow)
+        m_requests.pop_front();
+
+    // A consumer filling its queue after a seek is ahead of the clock by the queue. Over the
+    // whole window and over its second half, one of them doesn't have the burst.
+    double window = clock - m_requests.front().clock;
+    if (window >= kMinRateWindow)
+    {
+        auto half = std::lower_bound(m_requests.begin(), m_requests.end(), clock - window / 2,
+            [](const s_request& request, double time) { return request.clock < time; });
+        double rate = (start - m_requests.front().start) / (window * 10000.0);
+        if (half != m_requests.end() && clock > half->clock)
+        {
+            double halfRate = (start - half->start) / ((clock - half->clock) * 10000.0);
+            if (std::fabs(halfRate) < std::fabs(rate))
+                rate = halfRate;
+        }
+        m_rate = rate;
+    }
+
+    if (m_bActive)
+    {
+        m_step += (std::llabs(step) - m_step) * 0.25;
+
+        // The next frame at the pace of the clock
+        bool bSteady = step > 0 && stepRate <= kMaxSteadyRate &&
+            (!m_frameDuration || step <= m_frameDuration * kMaxSteadyStep);
+        m_count = bSteady ? m_count + 1 : 0;
+        if (m_count < kLeaveRequests)
+            return false;
+
+        // The window still has the requests of the trick play
+        Reset();
+        m_requests.push_back({ start, clock });
+        return true;
+    }
+
+    // Backwards, over several frames or faster than the clock
+    bool bTrick = step < 0 || std::fabs(m_rate) >= kMinRate ||
+        (m_frameDuration && step > m_frameDuration * kMinRate);
+    m_count = bTrick ? m_count + 1 : 0;
+    if (m_count < kEnterRequests)
+        return false;
+
+    m_bActive = true;
+    m_count = 0;
+    m_step = static_cast<double>(std::llabs(step));
+    return true;
+}
+
+int64_t CTrickPlay::GetInterval() const
+{
+    if (!m_bActive)
+        return 0;
+
+    // Each frame shown covers the step to the next one or rate frames, whichever is longer
+    double interval = (std::max)(m_step, std::fabs(m_rate) * m_frameDuration);
+    return static_cast<int64_t>(interval / 10000.0);
+}
@@ -0,0 +1,76 @@
+/*
+ *   Copyright(C) 2017 Blitzker
+ *
+ *   This program is free software : you can redistribute it and / or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+// Tells fast forward, rewind and scrubbing from playback at normal speed. RequestFrame
+// reports the time of each requested frame and when it was requested, the media time
+// moving faster than the clock or jumping between frames is trick play. The consumer
+// can also give the rate. Doesn't depend on Windows headers.
+
+#include <cstdint>
+#include <deque>
+
+class CTrickPlay
+{
+public:
+
+    // Rates at least this far from 1x are trick play
+    static constexpr double kMinRate = 1.5;
+    // Rate and step between two frames, in frames, of a request at normal speed
+    static constexpr double kMaxSteadyRate = 1.25;
+    static constexpr double kMaxSteadyStep = 1.25;
+    // Requests in a row before entering and leaving trick play
+    static constexpr int kEnterRequests = 4;
+    static constexpr int kLeaveRequests = 2;
+    // Clock time the rate is measured over, ms
+    static constexpr double kRateWindow = 2000.0;
+    static constexpr double kMinRateWindow = 1000.0;
+    // Size of the frames rendered in trick play
+    static constexpr double kScale = 0.5;
+
+    // Rate given by the consumer, 0 to detect it and 1 to never enter trick play
+    void SetRate(double rate);
+
+    // Time of a requested frame and its duration in 100ns units, when it was requested in ms.
+    // Returns true when trick play started or ended.
+    bool AddRequest(int64_t start, int64_t frameDuration, double clock);
+    void Reset();
+
+    bool IsActive() const { return m_bActive; }
+    double GetRate() const { return m_rate; }
+    // Media time between two frames shown in trick play, ms. Events shown for less
+    // than that would only flash for a frame.
+    int64_t GetInterval() const;
+
+private:
+
+    struct s_request
+    {
+        int64_t start;
+        double clock;
+    };
+
+    double m_forcedRate = 0.0;
+    bool m_bActive = false;
+    int m_count = 0;            // Requests in a row that would change the mode
+    double m_rate = 1.0;        // Measured over kRateWindow
+    double m_step = 0.0;        // Average step between two requests in trick play, 100ns
+    int64_t m_frameDuration = 0;
+    std::deque<s_request> m_requests;
+};
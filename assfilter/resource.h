@@ -69,6 +69,14 @@
 #define IDC_SUBS_FOLDER                 1056
 #define IDC_TRAY_ICON                   1057
 #define IDC_KERNING                     1058
+#define IDC_RENDER_LEVEL                1059
+#define IDC_RENDER_TIME                 1060
+#define IDC_RENDER_FRAMES               1061
+#define IDC_RENDER_CHANGES              1062
+#define IDC_RENDER_STATIC               1063
+#define IDC_RENDER_LATENCY              1064
+#define IDC_RENDER_AHEAD                1065
+#define IDC_RENDER_STATE                1066
 
 // Next default values for new objects
 // 
@@ -76,7 +84,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        110
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1059
+#define _APS_NEXT_CONTROL_VALUE         1067
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif